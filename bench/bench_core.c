@@ -0,0 +1,427 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* Runs each built in workload, and any ROM files given, headless for a
+ * fixed number of instructions with the interpreter, fused and tiered
+ * engines, then times converting the display to RGB as io_update_display
+ * does. Results are printed as CSV, each time being the median of several
+ * runs. Timers are updated every C8_BENCH_INSTR_PER_FRAME instructions
+ * and a ROM waiting on a key is given key 0, so every run is the same. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "chip8_core.h"
+
+#define C8_BENCH_INSTRUCTIONS_DEFAULT 10000000L
+#define C8_BENCH_REPEATS_DEFAULT 5
+#define C8_BENCH_REPEATS_MAX 99
+#define C8_BENCH_INSTR_PER_FRAME 10
+#define C8_BENCH_CONVERT_FRAMES 20000
+#define C8_BENCH_SEED 1
+
+typedef struct {
+    const char *name;
+    const uint8_t *rom;
+    size_t rom_size;
+} Chip8BenchWorkload;
+
+/* Arithmetic and logic on registers only */
+static const uint8_t c8_bench_alu[] = {
+    0x60, 0x01, /* 200: V0 = 1 */
+    0x61, 0x03, /* 202: V1 = 3 */
+    0x80, 0x14, /* 204: V0 += V1 */
+    0x81, 0x05, /* 206: V1 -= V0 */
+    0x82, 0x06, /* 208: V2 >>= 1 */
+    0x80, 0x12, /* 20A: V0 &= V1 */
+    0x82, 0x13, /* 20C: V2 ^= V1 */
+    0x80, 0x11, /* 20E: V0 |= V1 */
+    0x82, 0x0E, /* 210: V2 <<= 1 */
+    0x73, 0x07, /* 212: V3 += 7 */
+    0x82, 0x37, /* 214: V2 = V3 - V2 */
+    0x83, 0x04, /* 216: V3 += V0 */
+    0x12, 0x04  /* 218: jump 204 */
+};
+
+/* Three font sprites drawn for every three other instructions */
+static const uint8_t c8_bench_draw[] = {
+    0xA0, 0x00, /* 200: I = sprite for 0 */
+    0x60, 0x00, /* 202: V0 = 0 */
+    0x61, 0x00, /* 204: V1 = 0 */
+    0xD0, 0x15, /* 206: draw at V0, V1 */
+    0x70, 0x05, /* 208: V0 += 5 */
+    0xD0, 0x15, /* 20A: draw at V0, V1 */
+    0x71, 0x03, /* 20C: V1 += 3 */
+    0xD0, 0x15, /* 20E: draw at V0, V1 */
+    0x12, 0x06  /* 210: jump 206 */
+};
+
+/* Subroutines nested three deep */
+static const uint8_t c8_bench_call[] = {
+    0x22, 0x06, /* 200: call 206 */
+    0x70, 0x01, /* 202: V0 += 1 */
+    0x12, 0x00, /* 204: jump 200 */
+    0x22, 0x0C, /* 206: call 20C */
+    0x71, 0x01, /* 208: V1 += 1 */
+    0x00, 0xEE, /* 20A: return */
+    0x22, 0x12, /* 20C: call 212 */
+    0x72, 0x01, /* 20E: V2 += 1 */
+    0x00, 0xEE, /* 210: return */
+    0x73, 0x01, /* 212: V3 += 1 */
+    0x00, 0xEE  /* 214: return */
+};
+
+/* Rewrites the instruction at 20C before executing it each time round */
+static const uint8_t c8_bench_selfmod[] = {
+    0xA2, 0x0C, /* 200: I = 20C */
+    0x60, 0x71, /* 202: V0 = 0x71 */
+    0x71, 0x01, /* 204: V1 += 1 */
+    0xF1, 0x55, /* 206: store V0 - V1 at I, making 20C V1 += V1 */
+    0x72, 0x01, /* 208: V2 += 1 */
+    0x73, 0x01, /* 20A: V3 += 1 */
+    0x00, 0x00, /* 20C: replaced */
+    0x12, 0x00  /* 20E: jump 200 */
+};
+
+/* Waits on the delay timer the way most games wait for the next frame */
+static const uint8_t c8_bench_idle[] = {
+    0x65, 0x02, /* 200: V5 = 2 */
+    0xF5, 0x15, /* 202: delay timer = V5 */
+    0xF5, 0x07, /* 204: V5 = delay timer */
+    0x35, 0x00, /* 206: skip if V5 == 0 */
+    0x12, 0x04, /* 208: jump 204 */
+    0x12, 0x00  /* 20A: jump 200 */
+};
+
+/* Copies 32 bytes 16 registers at a time */
+static const uint8_t c8_bench_memcpy[] = {
+    0xA3, 0x00, /* 200: I = 300 */
+    0xFF, 0x65, /* 202: load V0 - VF from I */
+    0xA4, 0x00, /* 204: I = 400 */
+    0xFF, 0x55, /* 206: store V0 - VF at I */
+    0xA3, 0x10, /* 208: I = 310 */
+    0xFF, 0x65, /* 20A: load V0 - VF from I */
+    0xA4, 0x10, /* 20C: I = 410 */
+    0xFF, 0x55, /* 20E: store V0 - VF at I */
+    0x12, 0x00  /* 210: jump 200 */
+};
+
+static const Chip8BenchWorkload c8_bench_workloads[] = {
+    { "alu"    , c8_bench_alu    , sizeof(c8_bench_alu)     },
+    { "draw"   , c8_bench_draw   , sizeof(c8_bench_draw)    },
+    { "call"   , c8_bench_call   , sizeof(c8_bench_call)    },
+    { "selfmod", c8_bench_selfmod, sizeof(c8_bench_selfmod) },
+    { "idle"   , c8_bench_idle   , sizeof(c8_bench_idle)    },
+    { "memcpy" , c8_bench_memcpy , sizeof(c8_bench_memcpy)  }
+};
+
+static bool c8_bench_workload(const char *name, const Chip8 *start, long instructions, int repeats);
+static uint64_t c8_bench_count_draws(const Chip8 *start, long instructions);
+static double c8_bench_run(const Chip8 *start, Chip8FusionCache *fusion, Chip8TierCache *tier,
+                           long instructions);
+static void c8_bench_convert(int width, int height, int repeats);
+static int c8_bench_compare_double(const void *a, const void *b);
+static double c8_bench_now(void);
+
+int main(int argc, char *argv[])
+{
+    long instructions = C8_BENCH_INSTRUCTIONS_DEFAULT;
+    int repeats = C8_BENCH_REPEATS_DEFAULT;
+    Chip8Profile profile = C8_PROFILE_DEFAULT;
+    int ch;
+
+    while ((ch = getopt(argc, argv, "n:p:r:")) != -1) {
+        switch (ch) {
+            case 'n': {
+                instructions = atol(optarg);
+                break;
+            }
+            case 'p': {
+                if (!c8_parse_profile(optarg, &profile)) {
+                    fprintf(stderr, "Unknown profile %s\n", optarg);
+                    return 1;
+                }
+
+                break;
+            }
+            case 'r': {
+                repeats = atoi(optarg);
+                break;
+            }
+            default: {
+                fprintf(stderr, "Usage: %s [-n INSTRUCTIONS] [-p PROFILE] [-r REPEATS] [ROMFILE...]\n",
+                        argv[0]);
+                return 1;
+            }
+        }
+    }
+
+    if (instructions < 1 || repeats < 1 || repeats > C8_BENCH_REPEATS_MAX) {
+        fprintf(stderr, "Instructions must be positive and repeats between 1 and %d\n",
+                C8_BENCH_REPEATS_MAX);
+        return 1;
+    }
+
+    Chip8 *start = c8_alloc_aligned(sizeof(Chip8));
+
+    if (start == NULL) {
+        fprintf(stderr, "Unable to allocate interpreter\n");
+        return 1;
+    }
+
+    printf("benchmark,workload,engine,count,seconds,ns_per_op,mops_per_sec,draws_per_sec\n");
+
+    int num_workloads = sizeof(c8_bench_workloads) / sizeof(c8_bench_workloads[0]);
+    bool success = true;
+
+    for (int k = 0; k < num_workloads + (argc - optind) && success; k++) {
+        c8_init(start);
+        c8_seed(start, C8_BENCH_SEED);
+        c8_set_profile(start, profile);
+
+        if (k < num_workloads) {
+            const Chip8BenchWorkload *workload = &c8_bench_workloads[k];
+            c8_load_rom(start, workload->rom, workload->rom_size);
+            success = c8_bench_workload(workload->name, start, instructions, repeats);
+        } else {
+            const char *path = argv[optind + k - num_workloads];
+            const char *name = strrchr(path, '/');
+
+            success = c8_load_rom_file(start, path) &&
+                      c8_bench_workload(name != NULL ? name + 1 : path, start,
+                                        instructions, repeats);
+        }
+
+        fflush(stdout);
+    }
+
+    free(start);
+
+    if (!success) {
+        return 1;
+    }
+
+    c8_bench_convert(C8_DISPLAY_WIDTH, C8_DISPLAY_HEIGHT, repeats);
+    c8_bench_convert(C8_DISPLAY_MAX_WIDTH, C8_DISPLAY_MAX_HEIGHT, repeats);
+
+    return 0;
+}
+
+static bool c8_bench_workload(const char *name, const Chip8 *start, long instructions, int repeats)
+{
+    static const char *engines[] = { "interp", "fused", "tiered" };
+    Chip8FusionCache *fusion = malloc(sizeof(Chip8FusionCache));
+    Chip8TierCache *tier = malloc(sizeof(Chip8TierCache));
+    int num_engines = sizeof(engines) / sizeof(engines[0]);
+    bool success = true;
+
+    if (fusion == NULL || tier == NULL) {
+        fprintf(stderr, "Unable to allocate engine caches\n");
+        free(fusion);
+        free(tier);
+        return false;
+    }
+
+    uint64_t draws = c8_bench_count_draws(start, instructions);
+
+    for (int engine = 0; engine < num_engines && success; engine++) {
+        double times[C8_BENCH_REPEATS_MAX];
+
+        for (int k = 0; k < repeats && success; k++) {
+            c8_fusion_init(fusion);
+            c8_tier_init(tier, C8_TIER_THRESHOLD_DEFAULT);
+            times[k] = c8_bench_run(start, engine == 1 ? fusion : NULL,
+                                    engine == 2 ? tier : NULL, instructions);
+            success = times[k] >= 0;
+        }
+
+        if (!success) {
+            break;
+        }
+
+        qsort(times, repeats, sizeof(double), c8_bench_compare_double);
+        double seconds = times[repeats / 2];
+
+        printf("core,%s,%s,%ld,%.6f,%.3f,%.2f,%.0f\n", name, engines[engine],
+               instructions, seconds, (seconds * 1e9) / instructions,
+               instructions / seconds / 1e6, draws / seconds);
+    }
+
+    free(fusion);
+    free(tier);
+
+    return success;
+}
+
+/* Draws are counted in a separate untimed run, which executes the same
+ * instructions as the timed ones */
+static uint64_t c8_bench_count_draws(const Chip8 *start, long instructions)
+{
+    Chip8 *chip8 = c8_alloc_aligned(sizeof(Chip8));
+    uint64_t draws = 0;
+
+    if (chip8 == NULL) {
+        return 0;
+    }
+
+    *chip8 = *start;
+
+    for (long executed = 0; executed < instructions;) {
+        uint16_t pc = chip8->program_counter;
+        uint16_t instr = (chip8->memory[pc] << 8) | chip8->memory[(uint16_t)(pc + 1)];
+        int count = c8_run_cycle(chip8);
+
+        if (count == 0) {
+            c8_key_event(chip8, 0, true);
+            c8_key_event(chip8, 0, false);
+            continue;
+        }
+
+        draws += (instr & 0xF000) == 0xD000;
+
+        if (executed / C8_BENCH_INSTR_PER_FRAME != (executed + count) / C8_BENCH_INSTR_PER_FRAME) {
+            c8_update_timers(chip8);
+        }
+
+        executed += count;
+    }
+
+    free(chip8);
+
+    return draws;
+}
+
+/* Returns the time taken to execute instructions, or -1 on failure */
+/* Blocks are cut short at the end of a frame, so the
+ * tiered engine updates the timers at the same points */
+static double c8_bench_run(const Chip8 *start, Chip8FusionCache *fusion, Chip8TierCache *tier,
+                           long instructions)
+{
+    Chip8 *chip8 = c8_alloc_aligned(sizeof(Chip8));
+
+    if (chip8 == NULL) {
+        fprintf(stderr, "Unable to allocate interpreter\n");
+        return -1;
+    }
+
+    *chip8 = *start;
+    double begin = c8_bench_now();
+
+    for (long executed = 0; executed < instructions;) {
+        int count;
+
+        if (tier != NULL) {
+            count = c8_run_tiered(chip8, tier,
+                                  (int)(C8_BENCH_INSTR_PER_FRAME - executed % C8_BENCH_INSTR_PER_FRAME));
+        } else if (fusion != NULL) {
+            count = c8_run_fused(chip8, fusion);
+        } else {
+            count = c8_run_cycle(chip8);
+        }
+
+        /* The benchmark never skips ahead, so an idle loop is just run */
+        chip8->idle = false;
+
+        if (count == 0) {
+            c8_key_event(chip8, 0, true);
+            c8_key_event(chip8, 0, false);
+            continue;
+        }
+
+        if (executed / C8_BENCH_INSTR_PER_FRAME != (executed + count) / C8_BENCH_INSTR_PER_FRAME) {
+            c8_update_timers(chip8);
+        }
+
+        executed += count;
+    }
+
+    double elapsed = c8_bench_now() - begin;
+    free(chip8);
+
+    return elapsed;
+}
+
+/* Times c8_display_to_rgb on a fixed pseudo random display */
+static void c8_bench_convert(int width, int height, int repeats)
+{
+    Chip8 *chip8 = c8_alloc_aligned(sizeof(Chip8));
+    uint32_t *pixels = malloc(sizeof(uint32_t) * width * height);
+
+    if (chip8 == NULL || pixels == NULL) {
+        fprintf(stderr, "Unable to allocate display\n");
+        free(chip8);
+        free(pixels);
+        return;
+    }
+
+    c8_init(chip8);
+    chip8->display_width = width;
+    chip8->display_height = height;
+
+    uint64_t seed = C8_BENCH_SEED;
+
+    for (int plane = 0; plane < C8_DISPLAY_PLANES; plane++) {
+        for (int y = 0; y < C8_DISPLAY_MAX_HEIGHT; y++) {
+            for (int w = 0; w < C8_DISPLAY_ROW_WORDS; w++) {
+                seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+                chip8->display[plane][y][w] = seed;
+            }
+        }
+    }
+
+    double times[C8_BENCH_REPEATS_MAX];
+
+    for (int k = 0; k < repeats; k++) {
+        double begin = c8_bench_now();
+
+        for (int frame = 0; frame < C8_BENCH_CONVERT_FRAMES; frame++) {
+            c8_display_to_rgb(chip8, pixels);
+        }
+
+        times[k] = c8_bench_now() - begin;
+    }
+
+    qsort(times, repeats, sizeof(double), c8_bench_compare_double);
+    double seconds = times[repeats / 2];
+
+    printf("convert,%dx%d,rgb,%d,%.6f,%.3f,%.2f,0\n", width, height, C8_BENCH_CONVERT_FRAMES,
+           seconds, (seconds * 1e9) / C8_BENCH_CONVERT_FRAMES,
+           (double)width * height * C8_BENCH_CONVERT_FRAMES / seconds / 1e6);
+
+    free(pixels);
+    free(chip8);
+}
+
+static int c8_bench_compare_double(const void *a, const void *b)
+{
+    double value_a = *(const double *)a;
+    double value_b = *(const double *)b;
+
+    return (value_a > value_b) - (value_a < value_b);
+}
+
+static double c8_bench_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + (now.tv_nsec / 1e9);
+}
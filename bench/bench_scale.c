@@ -0,0 +1,96 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* Times each CPU scaling filter at every scale factor the interpreter
+ * accepts, on a 64x32 frame, and prints the results as CSV */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "chip8_core.h"
+#include "chip8_scale.h"
+
+#define C8_BENCH_SCALE_MIN 1
+#define C8_BENCH_SCALE_MAX 16
+/* Roughly the number of output pixels written per measurement */
+#define C8_BENCH_SCALE_PIXELS 200000000.0
+
+static double c8_bench_now(void);
+
+int main(void)
+{
+    int width = C8_DISPLAY_WIDTH;
+    int height = C8_DISPLAY_HEIGHT;
+    uint32_t *src = malloc(sizeof(uint32_t) * width * height);
+    uint32_t *dst = malloc(sizeof(uint32_t) * width * height * C8_BENCH_SCALE_MAX * C8_BENCH_SCALE_MAX);
+
+    if (src == NULL || dst == NULL) {
+        fprintf(stderr, "Unable to allocate frame buffers\n");
+        return 1;
+    }
+
+    /* A fixed pseudo random frame so diagonal edges exercise Scale2x/3x */
+    uint32_t seed = 1;
+
+    for (int k = 0; k < width * height; k++) {
+        seed = seed * 1103515245 + 12345;
+        src[k] = c8_palette[(seed >> 16) % C8_PALETTE_SIZE];
+    }
+
+    printf("benchmark,filter,factor,frames,ns_per_frame,mpixels_per_sec\n");
+
+    for (int filter = C8_SCALE_SDL + 1; filter < C8_SCALE_NUM; filter++) {
+        for (int factor = C8_BENCH_SCALE_MIN; factor <= C8_BENCH_SCALE_MAX; factor++) {
+            Chip8Scaler scaler;
+
+            if (!c8_scaler_init(&scaler, filter, factor, width, height)) {
+                fprintf(stderr, "Unable to create scaler\n");
+                return 1;
+            }
+
+            double frame_pixels = (double)width * height * factor * factor;
+            long frames = (long)(C8_BENCH_SCALE_PIXELS / frame_pixels) + 1;
+            double start = c8_bench_now();
+
+            for (long k = 0; k < frames; k++) {
+                c8_scaler_run(&scaler, src, width, height, dst, width * factor);
+            }
+
+            double elapsed = c8_bench_now() - start;
+
+            printf("scale,%s,%d,%ld,%.1f,%.1f\n", c8_scale_filter_name(filter), factor,
+                   frames, (elapsed * 1e9) / frames, (frame_pixels * frames) / elapsed / 1e6);
+
+            c8_scaler_free(&scaler);
+        }
+    }
+
+    free(src);
+    free(dst);
+
+    return 0;
+}
+
+static double c8_bench_now(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + (now.tv_nsec / 1e9);
+}
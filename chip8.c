@@ -17,30 +17,46 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include <limits.h>
 #include <errno.h>
 #include <getopt.h>
 #include "chip8.h"
 #include "chip8_core.h"
 #include "chip8_io.h"
+#include "chip8_library.h"
 
 #define C8_INSTR_PER_SEC_DEFAULT 300
 #define C8_INSTR_PER_SEC_MIN 1
 #define C8_SCALE_FACTOR_DEFAULT 8
 #define C8_SCALE_FACTOR_MIN 1
 #define C8_SCALE_FACTOR_MAX 16
+#define C8_FRAME_SKIP_DEFAULT 10
+#define C8_FRAME_SKIP_MIN 1
+#define C8_CACHE_DIR_MAX 4096
 
 static bool c8_parse_args(Chip8Option *opt, int argc, char *argv[]);
+static bool c8_load_library_rom(Chip8Option *opt, Chip8 *chip8, Chip8FusionCache *fusion,
+                                char keymap[C8_KEY_NUM + 1]);
 static void c8_print_usage(void);
 static bool c8_parse_int(const char *string_value, int *int_ptr);
-static bool c8_load(Chip8 *chip8, const char *rom_file_path);
-
 int main(int argc, char *argv[])
 {
     Chip8Option opt = {
         .rom_file_path = NULL,
+        .library_path = NULL,
         .scale_factor = C8_SCALE_FACTOR_DEFAULT,
-        .instr_per_sec = C8_INSTR_PER_SEC_DEFAULT
+        .scale_filter = C8_SCALE_SDL,
+        .profile = C8_PROFILE_NUM,
+        .instr_per_sec = 0,
+        .keymap = NULL,
+        .fuse = false,
+        .tiered = false,
+        .turbo = false,
+        .frame_skip = C8_FRAME_SKIP_DEFAULT,
+        .calibrate = false,
+        .startup_times = false,
+        .record_file_path = NULL
     };
 
     if (!c8_parse_args(&opt, argc, argv)) {
@@ -49,49 +65,241 @@ int main(int argc, char *argv[])
     }
 
     Chip8 chip8;
+    Chip8FusionCache *fusion = NULL;
+    Chip8TierCache *tier = NULL;
 
     c8_init(&chip8);
 
-    if (!c8_load(&chip8, opt.rom_file_path)) {
-        return false;
+    /* The tiered engine fuses sequences itself */
+    if (opt.tiered) {
+        tier = malloc(sizeof(Chip8TierCache));
+
+        if (tier == NULL) {
+            C8_LOG_ERROR("Unable to allocate %zu bytes for tier cache", sizeof(Chip8TierCache));
+            return 1;
+        }
+
+        c8_tier_init(tier, C8_TIER_THRESHOLD_DEFAULT);
+    } else if (opt.fuse) {
+        fusion = malloc(sizeof(Chip8FusionCache));
+
+        if (fusion == NULL) {
+            C8_LOG_ERROR("Unable to allocate %zu bytes for fusion cache", sizeof(Chip8FusionCache));
+            return 1;
+        }
+
+        c8_fusion_init(fusion);
+    }
+
+    char library_keymap[C8_KEY_NUM + 1];
+
+    if (opt.library_path != NULL) {
+        if (!c8_load_library_rom(&opt, &chip8, fusion, library_keymap)) {
+            free(fusion);
+            free(tier);
+            return 1;
+        }
+    } else if (!c8_load_rom_file(&chip8, opt.rom_file_path)) {
+        free(fusion);
+        free(tier);
+        return 1;
+    }
+
+    if (opt.profile == C8_PROFILE_NUM) {
+        opt.profile = C8_PROFILE_DEFAULT;
+    }
+
+    if (opt.instr_per_sec == 0) {
+        opt.instr_per_sec = C8_INSTR_PER_SEC_DEFAULT;
+    }
+
+    if (opt.keymap == NULL) {
+        opt.keymap = C8_KEYMAP_DEFAULT;
     }
 
+    c8_set_profile(&chip8, opt.profile);
+
     Chip8IO io;
 
     if (!io_init(&io, &chip8, &opt)) {
+        free(fusion);
+        free(tier);
         return 1;
     }
 
     int quit = 0;
+    uint32_t polled_ticks = io_timer_ticks(&io);
 
     while (!quit) {
-        io_reset_instruction_timer(&io);
+        c8_key_queue_apply(&io.key_queue, &chip8);
         io_lock_timer(&io);
-        c8_run_cycle(&chip8);
+        int executed;
+
+        /* A block runs at most a frame's worth of instructions, so
+         * the timers and input are still seen once a frame */
+        if (tier != NULL) {
+            executed = c8_run_tiered(&chip8, tier, MAX(1, io.instr_per_sec / C8_TIMER_FREQ_HZ));
+        } else if (fusion != NULL) {
+            executed = c8_run_fused(&chip8, fusion);
+        } else {
+            executed = c8_run_cycle(&chip8);
+        }
+
+        uint32_t ticks = io_timer_ticks(&io);
         io_unlock_timer(&io);
+
+        if (io.turbo) {
+            /* Waiting for a key or in an idle loop, nothing more can
+             * happen until the timers change, so skip to the next frame */
+            bool waiting = c8_waiting_for_key(&chip8);
+
+            if (io_turbo_advance(&io, &chip8, executed, waiting || chip8.idle)) {
+                io_poll_events(&io, &chip8, &quit);
+            }
+
+            chip8.idle = false;
+
+            if (waiting) {
+                io_wait_for_input(&io);
+            }
+
+            continue;
+        }
+
         io_update_display(&io, &chip8);
-        io_update_key_states(&chip8, &quit);
-        io_cycle_time_limit(&io);
+
+        /* Input is only collected once per frame, or as soon as
+         * possible when an Fx0A instruction is waiting for it */
+        if (ticks != polled_ticks || c8_waiting_for_key(&chip8)) {
+            io_poll_events(&io, &chip8, &quit);
+            polled_ticks = ticks;
+        }
+
+        /* When waiting for a key, or in a loop which can't progress until
+         * the timers change, sleep rather than spinning through the loop */
+        if (c8_waiting_for_key(&chip8)) {
+            io_wait_for_input(&io);
+        } else if (chip8.idle) {
+            chip8.idle = false;
+            io_wait_for_timer_tick(&io, ticks);
+        } else {
+            io_cycle_time_limit(&io, executed);
+        }
+
+        if (io.calibrate) {
+            io_calibrate(&io, executed);
+        }
     }
 
     io_free(&io);
 
+    if (fusion != NULL) {
+        c8_fusion_report(fusion, stderr);
+        free(fusion);
+    }
+
+    if (tier != NULL) {
+        c8_tier_report(tier, stderr);
+        free(tier);
+    }
+
     return 0;
 }
 
+/* Loads the ROM named by opt->rom_file_path from the library at
+ * opt->library_path. Options not given on the command line are taken
+ * from the ROM's metadata, and the fusion cache, when there is one, is
+ * filled in from the ROM's cached analysis. */
+static bool c8_load_library_rom(Chip8Option *opt, Chip8 *chip8, Chip8FusionCache *fusion,
+                                char keymap[C8_KEY_NUM + 1])
+{
+    char cache_dir[C8_CACHE_DIR_MAX];
+    bool has_cache_dir = c8_library_default_cache_dir(cache_dir, sizeof(cache_dir));
+    Chip8Library library;
+
+    if (!c8_library_open(&library, opt->library_path, has_cache_dir ? cache_dir : NULL)) {
+        return false;
+    }
+
+    const Chip8LibraryRom *rom = c8_library_lookup(&library, opt->rom_file_path);
+    bool success = rom != NULL && c8_library_load(rom, chip8);
+
+    if (success) {
+        if (opt->profile == C8_PROFILE_NUM && rom->metadata.has_profile) {
+            opt->profile = rom->metadata.profile;
+        }
+
+        if (opt->instr_per_sec == 0) {
+            opt->instr_per_sec = rom->metadata.instr_per_sec;
+        }
+
+        /* Copied, as the library is closed once the ROM is loaded */
+        if (opt->keymap == NULL && rom->metadata.keymap[0] != '\0') {
+            memcpy(keymap, rom->metadata.keymap, C8_KEY_NUM + 1);
+            opt->keymap = keymap;
+        }
+    }
+
+    if (success && fusion != NULL) {
+        Chip8RomAnalysis analysis;
+
+        success = c8_library_analyse(&library, rom, &analysis);
+
+        if (success) {
+            c8_library_warm_fusion(&analysis, fusion);
+            c8_library_analysis_free(&analysis);
+        }
+    }
+
+    c8_library_close(&library);
+
+    return success;
+}
+
 static bool c8_parse_args(Chip8Option *opt, int argc, char *argv[])
 {
     struct option chip8_options[] = {
-        { "help"        , no_argument      , 0, 'h' },
-        { "instr-rate"  , optional_argument, 0, 'r' },
-        { "scale-factor", optional_argument, 0, 's' },
+        { "calibrate"    , no_argument      , 0, 'c' },
+        { "filter"       , required_argument, 0, 'F' },
+        { "frame-skip"   , required_argument, 0, 'n' },
+        { "fuse"         , no_argument      , 0, 'f' },
+        { "help"         , no_argument      , 0, 'h' },
+        { "instr-rate"   , optional_argument, 0, 'r' },
+        { "keymap"       , required_argument, 0, 'k' },
+        { "library"      , required_argument, 0, 'L' },
+        { "profile"      , required_argument, 0, 'p' },
+        { "record"       , required_argument, 0, 'o' },
+        { "scale-factor" , optional_argument, 0, 's' },
+        { "startup-times", no_argument      , 0, 'S' },
+        { "tiered"       , no_argument      , 0, 'T' },
+        { "turbo"        , no_argument      , 0, 't' },
         { 0, 0, 0, 0 }
     };
 
     int ch;
 
-    while ((ch = getopt_long(argc, argv, "hs:r:", chip8_options, NULL)) != -1) {
+    while ((ch = getopt_long(argc, argv, "cF:fhk:L:n:s:Sr:p:o:Tt", chip8_options, NULL)) != -1) {
         switch (ch) {
+            case 'c': {
+                opt->calibrate = true;
+                break;
+            }
+            case 'F': {
+                if (!c8_scale_parse_filter(optarg, &opt->scale_filter)) {
+                    fprintf(stderr,
+                            "Invalid value passed for filter: %s, filter must "
+                            "be one of sdl, nearest, scalex or scanline\n",
+                            optarg);
+
+                    return false;
+                }
+
+                break;
+            }
+            case 'f': {
+                opt->fuse = true;
+                break;
+            }
             case 'h': {
                 c8_print_usage();
                 exit(0);
@@ -110,6 +318,55 @@ static bool c8_parse_args(Chip8Option *opt, int argc, char *argv[])
 
                 break;
             }
+            case 'k': {
+                uint8_t keymap[SDL_NUM_SCANCODES];
+
+                if (!io_parse_keymap(optarg, keymap)) {
+                    fprintf(stderr,
+                            "Invalid value passed for keymap: %s, "
+                            "keymap must be %d characters from a-z or 0-9\n",
+                            optarg, C8_KEY_NUM);
+
+                    return false;
+                }
+
+                opt->keymap = optarg;
+                break;
+            }
+            case 'L': {
+                opt->library_path = optarg;
+                break;
+            }
+            case 'n': {
+                if (!c8_parse_int(optarg, &opt->frame_skip) ||
+                    opt->frame_skip < C8_FRAME_SKIP_MIN) {
+
+                    fprintf(stderr,
+                            "Invalid value passed for frame-skip: %s, "
+                            "frame-skip must be an integer greater than %d\n",
+                            optarg, C8_FRAME_SKIP_MIN - 1);
+
+                    return false;
+                }
+
+                break;
+            }
+            case 'o': {
+                opt->record_file_path = optarg;
+                break;
+            }
+            case 'p': {
+                if (!c8_parse_profile(optarg, &opt->profile)) {
+                    fprintf(stderr,
+                            "Invalid value passed for profile: %s, "
+                            "profile must be one of chip8, schip or xochip\n",
+                            optarg);
+
+                    return false;
+                }
+
+                break;
+            }
             case 's': {
                 if (!c8_parse_int(optarg, &opt->scale_factor) ||
                     opt->scale_factor < C8_SCALE_FACTOR_MIN ||
@@ -125,6 +382,18 @@ static bool c8_parse_args(Chip8Option *opt, int argc, char *argv[])
 
                 break;
             }
+            case 'S': {
+                opt->startup_times = true;
+                break;
+            }
+            case 'T': {
+                opt->tiered = true;
+                break;
+            }
+            case 't': {
+                opt->turbo = true;
+                break;
+            }
             case '?': {
                 return false;  
             }
@@ -154,18 +423,53 @@ Usage:\n\
 chip8 [OPTIONS] ROMFILE\n\
 \n\
 ROMFILE:\n\
-File path to a CHIP-8 ROM (required).\n\
+File path to a CHIP-8 ROM, or with --library the name or the start of\n\
+the hash of a ROM in the library (required).\n\
 \n\
 OPTIONS:\n\
+-c, --calibrate              Measure the instruction rate the host can keep\n\
+                             up and lower the rate to match when needed.\n\
+-F, --filter=FILTER          Scale the display with FILTER, one of sdl,\n\
+                             nearest, scalex or scanline. All but sdl\n\
+                             scale on the CPU.\n\
+                             Default: sdl.\n\
+-f, --fuse                   Execute common instruction sequences as a single\n\
+                             step and report which were used on exit.\n\
 -h, --help                   Print this message.\n\
+-k, --keymap=KEYS            Map the keyboard keys in KEYS, each a-z or 0-9,\n\
+                             to CHIP-8 keys 0-F in turn.\n\
+                             Default: %s.\n\
+-L, --library=PATH           Load ROMFILE from the ROM library in PATH, a\n\
+                             directory or an archive made by\n\
+                             tools/chip8-library. Settings in the library\n\
+                             are used for any options not given.\n\
+-n, --frame-skip=FRAMES      Show one in every FRAMES frames when\n\
+                             fast-forwarding.\n\
+                             Default: %d, Min: %d.\n\
+-o, --record=FILE            Record every frame displayed to FILE, see\n\
+                             tools/chip8-record-convert.\n\
+-p, --profile=PROFILE        Emulate the quirks of PROFILE, one of\n\
+                             chip8, schip or xochip. XO-CHIP instructions\n\
+                             are only available with xochip.\n\
+                             Default: schip.\n\
 -r, --instr-rate=RATE        Run (roughly) RATE instructions per second.\n\
                              Default: %d, Min: %d.\n\
 -s, --scale-factor=FACTOR    Scale display resolution by FACTOR.\n\
                              Default: %d, Min: %d, Max: %d.\n\
+-S, --startup-times          Print how long each part of starting up took\n\
+                             once the first frame has been shown.\n\
+-T, --tiered                 Interpret each block of instructions until it\n\
+                             has run often, then switch it to pre-decoded\n\
+                             and fused instructions. Report the\n\
+                             instructions run by each tier on exit.\n\
+-t, --turbo                  Fast-forward, running instructions as fast as\n\
+                             possible with the timers kept in step. Holding\n\
+                             Tab fast-forwards too.\n\
 \n\
 ";
 
-    printf(help_msg, C8_INSTR_PER_SEC_DEFAULT, C8_INSTR_PER_SEC_MIN, 
+    printf(help_msg, C8_KEYMAP_DEFAULT, C8_FRAME_SKIP_DEFAULT, C8_FRAME_SKIP_MIN,
+           C8_INSTR_PER_SEC_DEFAULT, C8_INSTR_PER_SEC_MIN,
            C8_SCALE_FACTOR_DEFAULT, C8_SCALE_FACTOR_MIN, C8_SCALE_FACTOR_MAX);
 }
 
@@ -193,47 +497,3 @@ static bool c8_parse_int(const char *string_value, int *int_ptr)
 
     return true;
 }
-
-static bool c8_load(Chip8 *chip8, const char *rom_file_path)
-{
-    FILE *rom_file = fopen(rom_file_path, "rb");
-
-    if (rom_file == NULL) {
-        fprintf(stderr, "Unable to open file %s for reading - %s\n", 
-                        rom_file_path, strerror(errno));
-        return false;
-    }
-
-    fseek(rom_file, 0, SEEK_END);
-    long rom_size = ftell(rom_file);
-    fseek(rom_file, 0, SEEK_SET);
-
-    if (ferror(rom_file) || rom_size < 0) {
-        fprintf(stderr, "Unable to determine size of file %s - %s\n", 
-                        rom_file_path, strerror(errno));
-        return false;
-    } else if (rom_size > C8_PROGRAM_MEMORY_SIZE) {
-        fprintf(stderr, "Size of ROM file %s exceeds CHIP-8 "
-                        "program memory space\n", rom_file_path);
-        return false;
-    }
-
-    size_t read = fread(chip8->memory + C8_PROGRAM_MEMORY_START, 
-                        1, C8_PROGRAM_MEMORY_SIZE, rom_file);
-
-    bool error = ferror(rom_file);
-
-    fclose(rom_file);
-
-    if (error) {
-        fprintf(stderr, "Error when reading file %s - %s\n",
-                        rom_file_path, strerror(errno));
-        return false;
-    } else if ((long)read != rom_size) {
-        fprintf(stderr, "Reading ROM file %s data failed", rom_file_path);
-        return false;
-    }
-
-    return true;
-}
-
@@ -20,6 +20,8 @@
 #define C8_CHIP8_H
 
 #include <stdio.h>
+#include "chip8_core.h"
+#include "chip8_scale.h"
 
 #define MIN(a,b) ((a) < (b) ? (a) : (b))
 #define MAX(a,b) ((a) > (b) ? (a) : (b))
@@ -28,8 +30,21 @@
 /* Values that can be set from the command line, see help message for explanation */
 typedef struct {
     const char *rom_file_path;
+    const char *library_path;
     int scale_factor;
+    Chip8ScaleFilter scale_filter;
+    /* Unset, as C8_PROFILE_NUM, 0 and NULL, until the command
+     * line and any library metadata have been read */
+    Chip8Profile profile;
     int instr_per_sec;
+    const char *keymap;
+    bool fuse;
+    bool tiered;
+    bool turbo;
+    int frame_skip;
+    bool calibrate;
+    bool startup_times;
+    const char *record_file_path;
 } Chip8Option;
 
 #endif
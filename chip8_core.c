@@ -16,10 +16,15 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
  */
 
+#define _POSIX_C_SOURCE 200809L
+
 #include <stdio.h>
+#include <stdarg.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <errno.h>
+#include <inttypes.h>
 #include "chip8_core.h"
 #include "chip8.h"
 
@@ -27,8 +32,151 @@
 #define C8_REG_V2_IDX(instruction) (((instruction) & 0x00F0) >> 4)
 #define C8_INSTR_VALUE(instruction) ((instruction) & 0x00FF)
 
-static uint16_t c8_fetch_next_instruction(const Chip8 *);
-static void execute_instruction(Chip8 *, uint16_t);
+/* Fails to compile if the fields used by almost every
+ * instruction outgrow the first cache line of Chip8 */
+typedef char c8_hot_state_size[offsetof(Chip8, input_keys) + C8_KEY_NUM <= C8_CACHE_LINE_SIZE ? 1 : -1];
+
+typedef void (*Chip8ExecuteFn)(Chip8 *, uint16_t);
+typedef int (*Chip8FusedExecuteFn)(Chip8 *, uint8_t);
+
+static void c8_save_register_range(Chip8 *, uint8_t, uint8_t);
+static void c8_load_register_range(Chip8 *, uint8_t, uint8_t);
+static uint8_t c8_fusion_detect(const Chip8 *, uint16_t);
+static void c8_fusion_invalidate(Chip8FusionCache *, uint16_t, uint8_t);
+static bool c8_tier_ends_block(uint16_t);
+static int c8_tier_run_next(Chip8 *, Chip8TierCache *, int);
+static int c8_tier_interpret(Chip8 *, Chip8TierCache *, int);
+static int c8_tier_run_block(Chip8 *, Chip8TierCache *, Chip8Block *, int);
+static int c8_tier_promote(const Chip8 *, Chip8TierCache *, uint16_t);
+static void c8_tier_compile(const Chip8 *, Chip8Block *, uint16_t, Chip8Tier);
+static void c8_tier_cover(Chip8TierCache *, const Chip8Block *, int);
+static void c8_tier_invalidate(Chip8TierCache *, uint16_t, uint8_t);
+static void c8_error(const Chip8 *, const char *, ...);
+
+/* splitmix64 finaliser */
+static inline uint64_t c8_hash_mix(uint64_t value)
+{
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+    return value ^ (value >> 31);
+}
+
+static inline uint8_t c8_random_byte(Chip8 *chip8)
+{
+    uint32_t x = chip8->random_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    chip8->random_state = x;
+
+    return (uint8_t)(x >> 24);
+}
+
+static inline uint16_t c8_read_instruction(const Chip8 *chip8, uint16_t address)
+{
+    /* Instructions are 2 bytes long and stored most significant byte first */
+    return chip8->memory[address & C8_ADDRESS_MASK] << 8 | 
+           chip8->memory[(address + 1) & C8_ADDRESS_MASK];
+}
+
+static inline uint16_t c8_fetch_next_instruction(const Chip8 *chip8)
+{
+    return c8_read_instruction(chip8, chip8->program_counter);
+}
+
+/* Called for a jump from the current instruction to target. Recognises
+ * loops which can make no progress until the next timer tick:
+ *
+ *     1nnn              jump to itself
+ *     Fx07; 3x00; 1nnn  spin until the delay timer reaches zero */
+static inline bool c8_is_idle_loop(const Chip8 *chip8, uint16_t target)
+{
+    if (target == chip8->program_counter) {
+        return true;
+    } else if ((uint16_t)(target + 4) != chip8->program_counter) {
+        return false;
+    }
+
+    uint16_t read_timer = c8_read_instruction(chip8, target);
+    uint16_t skip = c8_read_instruction(chip8, target + 2);
+
+    return (read_timer & 0xF0FF) == 0xF007 &&
+           skip == (0x3000 | (read_timer & 0x0F00));
+}
+
+/* Original COSMAC VIP behaviour */
+#define C8_PROFILE_NAME chip8
+#define C8_QUIRK_SHIFT_VY 1
+#define C8_QUIRK_LOAD_STORE_INC_I 1
+#define C8_QUIRK_WRAP_SPRITES 0
+#define C8_QUIRK_JUMP_VX 0
+#define C8_QUIRK_XO_CHIP 0
+#include "chip8_core_exec.h"
+
+/* CHIP-48 and SuperChip 1.1 behaviour */
+#define C8_PROFILE_NAME schip
+#define C8_QUIRK_SHIFT_VY 0
+#define C8_QUIRK_LOAD_STORE_INC_I 0
+#define C8_QUIRK_WRAP_SPRITES 0
+#define C8_QUIRK_JUMP_VX 1
+#define C8_QUIRK_XO_CHIP 0
+#include "chip8_core_exec.h"
+
+/* Octo XO-CHIP behaviour */
+#define C8_PROFILE_NAME xochip
+#define C8_QUIRK_SHIFT_VY 1
+#define C8_QUIRK_LOAD_STORE_INC_I 1
+#define C8_QUIRK_WRAP_SPRITES 1
+#define C8_QUIRK_JUMP_VX 0
+#define C8_QUIRK_XO_CHIP 1
+#include "chip8_core_exec.h"
+
+static const Chip8ExecuteFn c8_profile_executors[C8_PROFILE_NUM] = {
+    [C8_PROFILE_CHIP8] = execute_instruction_chip8,
+    [C8_PROFILE_SCHIP] = execute_instruction_schip,
+    [C8_PROFILE_XOCHIP] = execute_instruction_xochip
+};
+
+static const Chip8FusedExecuteFn c8_profile_fused_executors[C8_PROFILE_NUM] = {
+    [C8_PROFILE_CHIP8] = execute_fused_chip8,
+    [C8_PROFILE_SCHIP] = execute_fused_schip,
+    [C8_PROFILE_XOCHIP] = execute_fused_xochip
+};
+
+static const char *c8_fusion_names[C8_FUSION_NUM] = {
+    [C8_FUSION_LOAD_LOAD_DRAW] = "6xnn; 6ynn; Dxyn",
+    [C8_FUSION_DELAY_LOOP] = "Fx07; 3x00; 1nnn",
+    [C8_FUSION_INDEX_DRAW] = "Annn; Dxyn",
+    [C8_FUSION_INDEX_LOAD] = "Annn; Fx65",
+    [C8_FUSION_ADD_SKIP] = "7xnn; 3xnn/4xnn"
+};
+
+/* Number of instructions in each fused sequence */
+static const uint8_t c8_fusion_lengths[C8_FUSION_NUM] = {
+    [C8_FUSION_NONE] = 1,
+    [C8_FUSION_LOAD_LOAD_DRAW] = 3,
+    [C8_FUSION_DELAY_LOOP] = 3,
+    [C8_FUSION_INDEX_DRAW] = 2,
+    [C8_FUSION_INDEX_LOAD] = 2,
+    [C8_FUSION_ADD_SKIP] = 2
+};
+
+static const char *c8_tier_names[C8_TIER_NUM] = {
+    [C8_TIER_INTERPRETED] = "interpreted",
+    [C8_TIER_DECODED] = "decoded",
+    [C8_TIER_FUSED] = "fused"
+};
+
+static const char *c8_profile_names[C8_PROFILE_NUM] = {
+    [C8_PROFILE_CHIP8] = "chip8",
+    [C8_PROFILE_SCHIP] = "schip",
+    [C8_PROFILE_XOCHIP] = "xochip"
+};
+
+const uint32_t c8_palette[C8_PALETTE_SIZE] = {
+    0x00000000, 0x00FFFFFF, 0x00FF6600, 0x00662200
+};
 
 static const uint8_t c8_builtin_sprites[] = {
     0xF0, 0x90, 0x90, 0x90, 0xF0,
@@ -49,6 +197,19 @@ static const uint8_t c8_builtin_sprites[] = {
     0xF0, 0x80, 0xF0, 0x80, 0x80 
 };
 
+/* Allocates size bytes on a C8_CACHE_LINE_SIZE boundary, which
+ * a Chip8 needs, returning NULL on failure. Freed with free. */
+void *c8_alloc_aligned(size_t size)
+{
+    void *memory;
+
+    if (posix_memalign(&memory, C8_CACHE_LINE_SIZE, size) != 0) {
+        return NULL;
+    }
+
+    return memory;
+}
+
 void c8_init(Chip8 *chip8)
 {
     memset(chip8, 0, sizeof(Chip8));
@@ -57,346 +218,669 @@ void c8_init(Chip8 *chip8)
     chip8->display_height = C8_DISPLAY_HEIGHT;
     chip8->display_width = C8_DISPLAY_WIDTH;
     chip8->wait_key_V_reg = -1;
+    chip8->profile = C8_PROFILE_DEFAULT;
+    chip8->plane_mask = 0x1;
+    chip8->audio_pitch = C8_AUDIO_PITCH_DEFAULT;
 
     memcpy(chip8->memory, c8_builtin_sprites, sizeof(c8_builtin_sprites));
 
-    srand(time(NULL));
+    c8_seed(chip8, time(NULL));
 }
 
-void c8_run_cycle(Chip8 *chip8)
+/* Each instance has its own random number generator so runs
+ * can be reproduced from a seed, even across threads */
+void c8_seed(Chip8 *chip8, uint64_t seed)
 {
+    /* Mixed with the splitmix64 finaliser so similar seeds give
+     * unrelated sequences. xorshift state mustn't be zero. */
+    seed = c8_hash_mix(seed + 0x9E3779B97F4A7C15ULL);
+
+    chip8->random_state = (uint32_t)seed != 0 ? (uint32_t)seed : 1;
+}
+
+/* Copies a ROM image into program memory, returns false if it is too large */
+bool c8_load_rom(Chip8 *chip8, const uint8_t *rom, size_t rom_size)
+{
+    if (rom_size > C8_PROGRAM_MEMORY_SIZE) {
+        return false;
+    }
+
+    memcpy(chip8->memory + C8_PROGRAM_MEMORY_START, rom, rom_size);
+
+    return true;
+}
+
+bool c8_load_rom_file(Chip8 *chip8, const char *rom_file_path)
+{
+    FILE *rom_file = fopen(rom_file_path, "rb");
+
+    if (rom_file == NULL) {
+        fprintf(stderr, "Unable to open file %s for reading - %s\n", 
+                        rom_file_path, strerror(errno));
+        return false;
+    }
+
+    fseek(rom_file, 0, SEEK_END);
+    long rom_size = ftell(rom_file);
+    fseek(rom_file, 0, SEEK_SET);
+
+    if (ferror(rom_file) || rom_size < 0) {
+        fprintf(stderr, "Unable to determine size of file %s - %s\n", 
+                        rom_file_path, strerror(errno));
+        fclose(rom_file);
+        return false;
+    } else if (rom_size > C8_PROGRAM_MEMORY_SIZE) {
+        fprintf(stderr, "Size of ROM file %s exceeds XO-CHIP "
+                        "program memory space\n", rom_file_path);
+        fclose(rom_file);
+        return false;
+    }
+
+    size_t read = fread(chip8->memory + C8_PROGRAM_MEMORY_START, 
+                        1, C8_PROGRAM_MEMORY_SIZE, rom_file);
+
+    bool error = ferror(rom_file);
+
+    fclose(rom_file);
+
+    if (error) {
+        fprintf(stderr, "Error when reading file %s - %s\n",
+                        rom_file_path, strerror(errno));
+        return false;
+    } else if ((long)read != rom_size) {
+        fprintf(stderr, "Reading ROM file %s data failed", rom_file_path);
+        return false;
+    }
+
+    return true;
+}
+
+/* Returns the number of instructions executed */
+int c8_run_cycle(Chip8 *chip8)
+{
+    if (c8_waiting_for_key(chip8)) {
+        return 0;
+    }
+
     uint16_t instr = c8_fetch_next_instruction(chip8);
-    execute_instruction(chip8, instr);
+    c8_profile_executors[chip8->profile](chip8, instr);
+    chip8->cycles++;
+
+    return 1;
 }
 
-static uint16_t c8_fetch_next_instruction(const Chip8 *chip8)
+void c8_fusion_init(Chip8FusionCache *cache)
 {
-    /* Instructions are 2 bytes long and stored most significant byte first */
-    return chip8->memory[chip8->program_counter] << 8 | 
-           chip8->memory[chip8->program_counter + 1];
+    memset(cache, 0, sizeof(Chip8FusionCache));
 }
 
-static void execute_instruction(Chip8 *chip8, uint16_t instr)
+/* Equivalent to c8_run_cycle, but executes a whole fused sequence at once
+ * when one starts at the program counter. The cache must be reinitialised
+ * if memory is changed other than by c8_run_fused, or by c8_run_cycle
+ * followed by c8_fusion_note_write. */
+int c8_run_fused(Chip8 *chip8, Chip8FusionCache *cache)
 {
-    /* See http://devernay.free.fr/hacks/chip8/C8TECH10.HTM#3.1 
-     * for a description of CHIP-8 instructions */
+    if (c8_waiting_for_key(chip8)) {
+        return 0;
+    }
 
-    switch (instr & 0xF000) {
-        case 0x0: {
-            switch (instr) {
-                case 0x00E0: {
-                    memset(chip8->display, 0, sizeof(chip8->display));
-                    chip8->update_display = true;
-                    chip8->program_counter += 2;
-                    return;
-                }
-                case 0x00EE: {
-                    chip8->program_counter = chip8->stack[--chip8->stack_pointer];
-                    chip8->program_counter += 2;
-                    return;
-                }
-                default: {
-                    break;
-                }
-            }
+    uint16_t pc = chip8->program_counter;
+    uint8_t kind = cache->kind[pc];
+
+    if (kind == C8_FUSION_UNKNOWN) {
+        kind = cache->kind[pc] = c8_fusion_detect(chip8, pc);
+    }
+
+    int executed;
+
+    if (kind == C8_FUSION_NONE) {
+        c8_profile_executors[chip8->profile](chip8, c8_fetch_next_instruction(chip8));
+        executed = 1;
+    } else {
+        executed = c8_profile_fused_executors[chip8->profile](chip8, kind);
+        cache->fired[kind]++;
+    }
+
+    chip8->cycles += executed;
+    c8_fusion_note_write(cache, chip8);
+
+    return executed;
+}
+
+/* Invalidates the sequences which the last memory write may have changed.
+ * Must be called after each c8_run_cycle between calls to c8_run_fused,
+ * as only the last write is recorded. */
+void c8_fusion_note_write(Chip8FusionCache *cache, Chip8 *chip8)
+{
+    if (chip8->write_length != 0) {
+        c8_fusion_invalidate(cache, chip8->write_address, chip8->write_length);
+        chip8->write_length = 0;
+    }
+}
+
+static uint8_t c8_fusion_detect(const Chip8 *chip8, uint16_t address)
+{
+    uint16_t instr1 = c8_read_instruction(chip8, address);
+    uint16_t instr2 = c8_read_instruction(chip8, address + 2);
+    uint16_t instr3 = c8_read_instruction(chip8, address + 4);
+
+    if ((instr1 & 0xF000) == 0x6000 && (instr2 & 0xF000) == 0x6000 &&
+        (instr3 & 0xF000) == 0xD000) {
+        return C8_FUSION_LOAD_LOAD_DRAW;
+    } else if ((instr1 & 0xF0FF) == 0xF007 &&
+               instr2 == (0x3000 | (instr1 & 0x0F00)) &&
+               /* 1nnn can't jump back to an address past 4 KB */
+               address <= 0x0FFF && instr3 == (0x1000 | address)) {
+        return C8_FUSION_DELAY_LOOP;
+    } else if ((instr1 & 0xF000) == 0xA000 && (instr2 & 0xF000) == 0xD000) {
+        return C8_FUSION_INDEX_DRAW;
+    } else if ((instr1 & 0xF000) == 0xA000 && (instr2 & 0xF0FF) == 0xF065) {
+        return C8_FUSION_INDEX_LOAD;
+    } else if ((instr1 & 0xF000) == 0x7000 &&
+               ((instr2 & 0xF000) == 0x3000 || (instr2 & 0xF000) == 0x4000) &&
+               (instr1 & 0x0F00) == (instr2 & 0x0F00)) {
+        return C8_FUSION_ADD_SKIP;
+    }
+
+    return C8_FUSION_NONE;
+}
+
+/* Finds the sequence c8_run_fused would detect at each of length addresses
+ * from start, so a fusion cache can be filled before the program is run */
+void c8_fusion_analyse(const Chip8 *chip8, uint16_t start, size_t length, uint8_t *kinds)
+{
+    for (size_t k = 0; k < length; k++) {
+        kinds[k] = c8_fusion_detect(chip8, (uint16_t)(start + k));
+    }
+}
+
+/* A fused sequence is at most 6 bytes long, so any sequence
+ * starting up to 5 bytes before the write may have changed */
+static void c8_fusion_invalidate(Chip8FusionCache *cache, uint16_t address, uint8_t length)
+{
+    for (int k = -5; k < length; k++) {
+        cache->kind[(uint16_t)(address + k)] = C8_FUSION_UNKNOWN;
+    }
+}
+
+void c8_fusion_report(const Chip8FusionCache *cache, FILE *out)
+{
+    fprintf(out, "Fused instruction sequences executed:\n");
+
+    for (int k = C8_FUSION_NONE + 1; k < C8_FUSION_NUM; k++) {
+        fprintf(out, "  %-20s %" PRIu64 "\n", c8_fusion_names[k], cache->fired[k]);
+    }
+}
+
+/* threshold is the number of times a block is run before
+ * being promoted to the next tier */
+void c8_tier_init(Chip8TierCache *cache, uint16_t threshold)
+{
+    memset(cache, 0, sizeof(Chip8TierCache));
+    cache->threshold = threshold;
+}
+
+/* Equivalent to calling c8_run_cycle up to max_instructions times, but
+ * stops early when a key is waited for or an idle loop is found. Returns
+ * the number of instructions executed. The cache must be reinitialised
+ * if memory or the profile is changed other than by c8_run_tiered. */
+int c8_run_tiered(Chip8 *chip8, Chip8TierCache *cache, int max_instructions)
+{
+    int executed = 0;
+
+    while (executed < max_instructions && !c8_waiting_for_key(chip8)) {
+        executed += c8_tier_run_next(chip8, cache, max_instructions - executed);
+
+        if (chip8->idle) {
+            break;
         }
-        case 0x1000: {
-            chip8->program_counter = instr & 0x0FFF;            
-            return;
+    }
+
+    return executed;
+}
+
+/* Runs the basic block at the program counter in whichever tier it has
+ * reached, after counting the run towards promoting it */
+static int c8_tier_run_next(Chip8 *chip8, Chip8TierCache *cache, int max_instructions)
+{
+    uint16_t pc = chip8->program_counter;
+    int index = cache->block_index[pc];
+
+    if (index == 0) {
+        if (cache->heat[pc] < cache->threshold) {
+            cache->heat[pc]++;
+        } else {
+            index = c8_tier_promote(chip8, cache, pc);
         }
-        case 0x2000: {
-            chip8->stack[chip8->stack_pointer++] = chip8->program_counter;
-            chip8->program_counter = instr & 0x0FFF;            
-            return;
+    }
+
+    if (index != 0) {
+        Chip8Block *block = &cache->blocks[index - 1];
+
+        if (block->tier == C8_TIER_DECODED && block->executions >= cache->threshold) {
+            c8_tier_cover(cache, block, -1);
+            c8_tier_compile(chip8, block, pc, C8_TIER_FUSED);
+            c8_tier_cover(cache, block, 1);
+            cache->promotions[C8_TIER_FUSED]++;
         }
-        case 0x3000: {
-            if (chip8->register_V[C8_REG_V_IDX(instr)] == C8_INSTR_VALUE(instr)) {
-                chip8->program_counter += 4;
-            } else {
-                chip8->program_counter += 2;
-            }
 
-            return;
+        /* A block is only entered when at least its first step fits */
+        if (block->ops[0].count <= max_instructions) {
+            return c8_tier_run_block(chip8, cache, block, max_instructions);
         }
-        case 0x4000: {
-            if (chip8->register_V[C8_REG_V_IDX(instr)] != C8_INSTR_VALUE(instr)) {
-                chip8->program_counter += 4;
-            } else {
-                chip8->program_counter += 2;
-            }
+    }
+
+    return c8_tier_interpret(chip8, cache, max_instructions);
+}
+
+void c8_tier_report(const Chip8TierCache *cache, FILE *out)
+{
+    fprintf(out, "Instructions executed by tier:\n");
+
+    for (int k = 0; k < C8_TIER_NUM; k++) {
+        fprintf(out, "  %-20s %" PRIu64 "\n", c8_tier_names[k], cache->instructions[k]);
+    }
 
-            return;
+    fprintf(out, "Blocks promoted to decoded: %" PRIu64 ", to fused: %" PRIu64
+                 ", demoted: %" PRIu64 ", live: %d\n",
+            cache->promotions[C8_TIER_DECODED], cache->promotions[C8_TIER_FUSED],
+            cache->demotions, cache->num_blocks);
+}
+
+/* Whether instr may leave the program counter anywhere other than the
+ * next instruction, or stop to wait for a key. Unknown 0nnn and 8xyn
+ * instructions fall through to the jump and skip which follow them. */
+static bool c8_tier_ends_block(uint16_t instr)
+{
+    switch (instr & 0xF000) {
+        case 0x0000: {
+            return instr != 0x00E0;
+        }
+        case 0x8000: {
+            return (instr & 0x000F) > 0x7 && (instr & 0x000F) != 0xE;
         }
         case 0x5000: {
-            if (chip8->register_V[C8_REG_V_IDX(instr)] == chip8->register_V[C8_REG_V2_IDX(instr)]) {
-                chip8->program_counter += 4;
-            } else {
-                chip8->program_counter += 2;
-            }
+            return (instr & 0x000F) == 0x0;
+        }
+        case 0xF000: {
+            return (instr & 0x00FF) == 0x0A;
+        }
+        case 0x1000:
+        case 0x2000:
+        case 0x3000:
+        case 0x4000:
+        case 0x9000:
+        case 0xB000:
+        case 0xE000: {
+            return true;
+        }
+        default: {
+            return false;
+        }
+    }
+}
 
-            return;
+static int c8_tier_interpret(Chip8 *chip8, Chip8TierCache *cache, int max_instructions)
+{
+    Chip8ExecuteFn execute = c8_profile_executors[chip8->profile];
+    int executed = 0;
+    bool block_end;
+
+    do {
+        uint16_t instr = c8_fetch_next_instruction(chip8);
+        block_end = c8_tier_ends_block(instr);
+        execute(chip8, instr);
+        executed++;
+
+        if (chip8->write_length != 0) {
+            c8_tier_invalidate(cache, chip8->write_address, chip8->write_length);
+            chip8->write_length = 0;
         }
-        case 0x6000: {
-            chip8->register_V[C8_REG_V_IDX(instr)] = C8_INSTR_VALUE(instr);
-            chip8->program_counter += 2;
-            return;
+    } while (!block_end && executed < max_instructions);
+
+    chip8->cycles += executed;
+    cache->instructions[C8_TIER_INTERPRETED] += executed;
+
+    return executed;
+}
+
+/* Runs the steps of block which fit in max_instructions. Stops early
+ * after a memory write, which may have demoted block itself. */
+static int c8_tier_run_block(Chip8 *chip8, Chip8TierCache *cache, Chip8Block *block,
+                             int max_instructions)
+{
+    Chip8ExecuteFn execute = c8_profile_executors[chip8->profile];
+    Chip8FusedExecuteFn execute_fused = c8_profile_fused_executors[chip8->profile];
+    const Chip8BlockOp *op = block->ops;
+    const Chip8BlockOp *end = op + block->num_ops;
+    Chip8Tier tier = block->tier;
+    int executed = 0;
+
+    block->executions++;
+
+    do {
+        if (op->kind == C8_FUSION_NONE) {
+            execute(chip8, op->instr);
+            executed++;
+        } else {
+            executed += execute_fused(chip8, op->kind);
         }
-        case 0x7000: {
-            chip8->register_V[C8_REG_V_IDX(instr)] += C8_INSTR_VALUE(instr);
-            chip8->program_counter += 2;
-            return;
+
+        if (chip8->write_length != 0) {
+            c8_tier_invalidate(cache, chip8->write_address, chip8->write_length);
+            chip8->write_length = 0;
+            break;
         }
-        case 0x8000: {
-            switch (instr & 0x000F) {
-                case 0x0: {
-                    chip8->register_V[C8_REG_V_IDX(instr)] = chip8->register_V[C8_REG_V2_IDX(instr)];
-                    chip8->program_counter += 2;
-                    return;
-                }
-                case 0x1: {
-                    chip8->register_V[C8_REG_V_IDX(instr)] |= chip8->register_V[C8_REG_V2_IDX(instr)];
-                    chip8->program_counter += 2;
-                    return;
-                }
-                case 0x2: {
-                    chip8->register_V[C8_REG_V_IDX(instr)] &= chip8->register_V[C8_REG_V2_IDX(instr)];
-                    chip8->program_counter += 2;
-                    return;
-                }
-                case 0x3: {
-                    chip8->register_V[C8_REG_V_IDX(instr)] ^= chip8->register_V[C8_REG_V2_IDX(instr)];
-                    chip8->program_counter += 2;
-                    return;
-                }
-                case 0x4: {
-                    uint8_t value1 = chip8->register_V[C8_REG_V_IDX(instr)];
-                    uint8_t value2 = chip8->register_V[C8_REG_V2_IDX(instr)];
-
-                    if (value1 > UINT8_MAX - value2) {
-                        chip8->register_V[0xF] = 1;
-                    } else {
-                        chip8->register_V[0xF] = 0;
-                    }
-
-                    chip8->register_V[C8_REG_V_IDX(instr)] = value1 + value2;
-                    chip8->program_counter += 2;
-                    return;
-                }
-                case 0x5: {
-                    uint8_t value1 = chip8->register_V[C8_REG_V_IDX(instr)];
-                    uint8_t value2 = chip8->register_V[C8_REG_V2_IDX(instr)];
-
-                    if (value1 > value2) {
-                        chip8->register_V[0xF] = 1;
-                    } else {
-                        chip8->register_V[0xF] = 0;
-                    }
-
-                    chip8->register_V[C8_REG_V_IDX(instr)] = value1 - value2;
-                    chip8->program_counter += 2;
-                    return;
-                }
-                case 0x6: {
-                    uint8_t value = chip8->register_V[C8_REG_V_IDX(instr)];
-
-                    if (value & 0x1) {
-                        chip8->register_V[0xF] = 1;
-                    } else {
-                        chip8->register_V[0xF] = 0;
-                    }
-
-                    chip8->register_V[C8_REG_V_IDX(instr)] /= 2;
-                    chip8->program_counter += 2;
-                    return;
-                }
-                case 0x7: {
-                    uint8_t value1 = chip8->register_V[C8_REG_V_IDX(instr)];
-                    uint8_t value2 = chip8->register_V[C8_REG_V2_IDX(instr)];
-
-                    if (value2 > value1) {
-                        chip8->register_V[0xF] = 1;
-                    } else {
-                        chip8->register_V[0xF] = 0;
-                    }
-
-                    chip8->register_V[C8_REG_V_IDX(instr)] = value2 - value1;
-                    chip8->program_counter += 2;
-                    return;
-                }
-                case 0xE: {
-                    uint8_t value = chip8->register_V[C8_REG_V_IDX(instr)];
-
-                    if (value & 0x80) {
-                        chip8->register_V[0xF] = 1;
-                    } else {
-                        chip8->register_V[0xF] = 0;
-                    }
-
-                    chip8->register_V[C8_REG_V_IDX(instr)] *= 2;
-                    chip8->program_counter += 2;
-                    return;
-                }
-                default: {
-                    break;
-                }
-            }
+
+        op++;
+    } while (op < end && executed + op->count <= max_instructions);
+
+    chip8->cycles += executed;
+    cache->instructions[tier] += executed;
+
+    return executed;
+}
+
+/* Returns the index + 1 of the new block, or 0 when there's no room */
+static int c8_tier_promote(const Chip8 *chip8, Chip8TierCache *cache, uint16_t start)
+{
+    if (cache->num_blocks == C8_TIER_MAX_BLOCKS) {
+        return 0;
+    }
+
+    Chip8Block *block = &cache->blocks[cache->num_blocks++];
+
+    c8_tier_compile(chip8, block, start, C8_TIER_DECODED);
+    block->executions = 0;
+    c8_tier_cover(cache, block, 1);
+    cache->block_index[start] = cache->num_blocks;
+    cache->promotions[C8_TIER_DECODED]++;
+
+    return cache->num_blocks;
+}
+
+/* Fused sequences which jump or skip must end the block, as the
+ * instructions after them may not be the ones executed next */
+static void c8_tier_compile(const Chip8 *chip8, Chip8Block *block, uint16_t start, Chip8Tier tier)
+{
+    uint16_t address = start;
+    int instructions = 0;
+    bool block_end;
+
+    block->num_ops = 0;
+
+    do {
+        uint16_t instr = c8_read_instruction(chip8, address);
+        uint8_t kind = tier == C8_TIER_FUSED ? c8_fusion_detect(chip8, address) : C8_FUSION_NONE;
+
+        if (instructions + c8_fusion_lengths[kind] > C8_TIER_BLOCK_MAX_INSTRUCTIONS) {
+            kind = C8_FUSION_NONE;
         }
-        case 0x9000: {
-            if (chip8->register_V[C8_REG_V_IDX(instr)] != chip8->register_V[C8_REG_V2_IDX(instr)]) {
-                chip8->program_counter += 4;
-            } else {
-                chip8->program_counter += 2;
-            }
 
-            return;
+        Chip8BlockOp *op = &block->ops[block->num_ops++];
+        op->instr = instr;
+        op->kind = kind;
+        op->count = c8_fusion_lengths[kind];
+        instructions += op->count;
+
+        if (kind == C8_FUSION_NONE) {
+            block_end = c8_tier_ends_block(instr);
+            /* F000 NNNN is the only 4 byte instruction */
+            address += chip8->profile == C8_PROFILE_XOCHIP && instr == 0xF000 ? 4 : 2;
+        } else {
+            block_end = kind == C8_FUSION_DELAY_LOOP || kind == C8_FUSION_ADD_SKIP;
+            address += 2 * op->count;
         }
-        case 0xA000: {
-            chip8->register_I = (instr & 0x0FFF);
-            chip8->program_counter += 2;
-            return;
+    } while (!block_end && instructions < C8_TIER_BLOCK_MAX_INSTRUCTIONS);
+
+    block->start = start;
+    block->length = (uint16_t)(address - start);
+    block->tier = tier;
+}
+
+static void c8_tier_cover(Chip8TierCache *cache, const Chip8Block *block, int delta)
+{
+    for (int k = 0; k < block->length; k++) {
+        cache->coverage[(uint16_t)(block->start + k)] += delta;
+    }
+}
+
+/* Demotes every block overlapping the memory written back to the
+ * interpreter, where it has to become hot again to be recompiled */
+static void c8_tier_invalidate(Chip8TierCache *cache, uint16_t address, uint8_t length)
+{
+    bool covered = false;
+
+    for (int k = 0; k < length && !covered; k++) {
+        covered = cache->coverage[(uint16_t)(address + k)] != 0;
+    }
+
+    if (!covered) {
+        return;
+    }
+
+    /* Blocks are removed by moving the last block into their place, so
+     * going backwards every block is checked exactly once */
+    for (int k = cache->num_blocks - 1; k >= 0; k--) {
+        Chip8Block *block = &cache->blocks[k];
+
+        if ((uint16_t)(address - block->start) >= block->length &&
+            (uint16_t)(block->start - address) >= length) {
+            continue;
         }
-        case 0xB000: {
-            chip8->program_counter = (instr & 0x0FFF) + chip8->register_V[0];
-            return;
+
+        c8_tier_cover(cache, block, -1);
+        cache->block_index[block->start] = 0;
+        cache->heat[block->start] = 0;
+        cache->demotions++;
+
+        Chip8Block *last = &cache->blocks[--cache->num_blocks];
+
+        if (block != last) {
+            *block = *last;
+            cache->block_index[block->start] = k + 1;
         }
-        case 0xC000: {
-            chip8->register_V[C8_REG_V_IDX(instr)] = (rand() % UINT8_MAX) & C8_INSTR_VALUE(instr);
-            chip8->program_counter += 2;
-            return;
+    }
+}
+
+void c8_set_profile(Chip8 *chip8, Chip8Profile profile)
+{
+    chip8->profile = profile;
+}
+
+/* Must be set again after c8_init */
+void c8_set_error_handler(Chip8 *chip8, Chip8ErrorFn handler, void *user_data)
+{
+    chip8->error_handler = handler;
+    chip8->error_user_data = user_data;
+}
+
+static void c8_error(const Chip8 *chip8, const char *format, ...)
+{
+    char message[128];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    if (chip8->error_handler != NULL) {
+        chip8->error_handler(message, chip8->error_user_data);
+    } else {
+        C8_LOG_ERROR("%s", message);
+    }
+}
+
+bool c8_parse_profile(const char *name, Chip8Profile *profile)
+{
+    for (int k = 0; k < C8_PROFILE_NUM; k++) {
+        if (strcmp(name, c8_profile_names[k]) == 0) {
+            *profile = k;
+            return true;
         }
-        case 0xD000: {
-            uint8_t x = chip8->register_V[C8_REG_V_IDX(instr)];
-            uint8_t y = chip8->register_V[C8_REG_V2_IDX(instr)];
-            uint8_t byte_num = (instr & 0x000F);
-            uint8_t sprite_byte;
-            uint16_t display_index;
+    }
 
-            chip8->register_V[0xF] = 0;
+    return false;
+}
 
-            for (int byte = 0; byte < byte_num; byte++) {
-                sprite_byte = chip8->memory[chip8->register_I + byte];
+const char *c8_profile_name(Chip8Profile profile)
+{
+    return c8_profile_names[profile];
+}
 
-                for (int bit = 0; bit < 8; bit++) {
-                    if (((0x80 >> bit) & sprite_byte) != 0) {
-                        display_index = ((y + byte) * chip8->display_width) + x + bit; 
+static void c8_save_register_range(Chip8 *chip8, uint8_t first, uint8_t last)
+{
+    /* Registers are stored in reverse order when first > last */
+    int step = first <= last ? 1 : -1;
+    int count = (first <= last ? last - first : first - last) + 1;
 
-                        if (chip8->display[display_index] == 1) {
-                            chip8->register_V[0xF] = 1; 
-                        }
+    chip8->write_address = chip8->register_I;
+    chip8->write_length = count;
 
-                        chip8->display[display_index] ^= 1;
-                    }
-                }
-            }
+    for (int k = 0; k < count; k++) {
+        chip8->memory[(chip8->register_I + k) & C8_ADDRESS_MASK] = chip8->register_V[first + (k * step)];
+    }
+}
 
-            chip8->update_display = true;
-            chip8->program_counter += 2;
+static void c8_load_register_range(Chip8 *chip8, uint8_t first, uint8_t last)
+{
+    int step = first <= last ? 1 : -1;
+    int count = (first <= last ? last - first : first - last) + 1;
 
-            return;
+    for (int k = 0; k < count; k++) {
+        chip8->register_V[first + (k * step)] = chip8->memory[(chip8->register_I + k) & C8_ADDRESS_MASK];
+    }
+}
+
+uint8_t c8_display_pixel(const Chip8 *chip8, int x, int y)
+{
+    uint8_t value = 0;
+
+    for (int plane = 0; plane < C8_DISPLAY_PLANES; plane++) {
+        uint64_t word = chip8->display[plane][y][x / 64];
+        value |= ((word >> (63 - (x % 64))) & 0x1) << plane;
+    }
+
+    return value;
+}
+
+/* Converts the visible part of the display to RGB using c8_palette,
+ * writing display_width * display_height pixels row by row */
+void c8_display_to_rgb(const Chip8 *chip8, uint32_t *pixels)
+{
+    for (int y = 0; y < chip8->display_height; y++) {
+        for (int x = 0; x < chip8->display_width; x++) {
+            *pixels++ = c8_palette[c8_display_pixel(chip8, x, y)];
         }
-        case 0xE000: {
-            switch (instr & 0x00FF) {
-                case 0x9E: {
-                    uint8_t key = chip8->register_V[C8_REG_V_IDX(instr)];
-
-                    if (chip8->input_keys[key]) {
-                        chip8->program_counter += 4;
-                    } else {
-                        chip8->program_counter += 2;
-                    }
-
-                    return;
-                }
-                case 0xA1: {
-                    uint8_t key = chip8->register_V[C8_REG_V_IDX(instr)];
-
-                    if (chip8->input_keys[key]) {
-                        chip8->program_counter += 2;
-                    } else {
-                        chip8->program_counter += 4;
-                    }
-
-                    return;
-                }
-                default: {
-                    break;
-                }
+    }
+}
+
+/* Hash of the visible part of the display. Pixels are hashed a word at a
+ * time independent of byte order, so hashes can be compared across hosts. */
+uint64_t c8_display_hash(const Chip8 *chip8)
+{
+    int row_words = (chip8->display_width + 63) / 64;
+    uint64_t hash = c8_hash_word(0, ((uint64_t)chip8->display_width << 8) |
+                                    chip8->display_height);
+
+    for (int plane = 0; plane < C8_DISPLAY_PLANES; plane++) {
+        for (int y = 0; y < chip8->display_height; y++) {
+            for (int w = 0; w < row_words; w++) {
+                hash = c8_hash_word(hash, chip8->display[plane][y][w]);
             }
         }
-        case 0xF000: {
-            switch (instr & 0x00FF) {
-                case 0x07: {
-                    chip8->register_V[C8_REG_V_IDX(instr)] = chip8->register_delay_timer;
-                    chip8->program_counter += 2;
-                    return;
-                }
-                case 0x0A: {
-                    chip8->wait_key_V_reg = C8_REG_V_IDX(instr);
-                    chip8->program_counter += 2;
-                    return;
-                }
-                case 0x15: {
-                    chip8->register_delay_timer = chip8->register_V[C8_REG_V_IDX(instr)];
-                    chip8->program_counter += 2;
-                    return;
-                }
-                case 0x18: {
-                    chip8->register_sound_timer = chip8->register_V[C8_REG_V_IDX(instr)];
-                    chip8->program_counter += 2;
-                    return;
-                }
-                case 0x1E: {
-                    chip8->register_I += chip8->register_V[C8_REG_V_IDX(instr)];
-                    chip8->program_counter += 2;
-                    return;
-                }
-                case 0x29: {
-                    chip8->register_I = (chip8->register_V[C8_REG_V_IDX(instr)] * 5);
-                    chip8->program_counter += 2;
-                    return;
-                }
-                case 0x33: {
-                    uint8_t value = chip8->register_V[C8_REG_V_IDX(instr)];
-
-                    chip8->memory[chip8->register_I] = value / 100;
-                    chip8->memory[chip8->register_I + 1] = (value / 10) % 10;
-                    chip8->memory[chip8->register_I + 2] = value % 10;
-
-                    chip8->program_counter += 2;
-                    return;
-                }
-                case 0x55: {
-                    uint8_t v_reg_num = C8_REG_V_IDX(instr) + 1;
-
-                    for (int k = 0; k < v_reg_num; k++) {
-                        chip8->memory[chip8->register_I + k] = chip8->register_V[k];
-                    }
-
-                    chip8->program_counter += 2;
-                    return;
-                }
-                case 0x65: {
-                    uint8_t v_reg_num = C8_REG_V_IDX(instr) + 1;
-
-                    for (int k = 0; k < v_reg_num; k++) {
-                        chip8->register_V[k] = chip8->memory[chip8->register_I + k];
-                    }
-
-                    chip8->program_counter += 2;
-                    return;
-                }
-                default: {
-                    break;
-                }
-            }
+    }
+
+    return c8_hash_mix(hash);
+}
+
+/* Hash of the registers, timers and the used part of the stack */
+uint64_t c8_register_hash(const Chip8 *chip8)
+{
+    uint64_t hash = 0;
+
+    for (int k = 0; k < C8_V_REGISTERS; k += 8) {
+        uint64_t word = 0;
+
+        for (int b = 7; b >= 0; b--) {
+            word = (word << 8) | chip8->register_V[k + b];
         }
-        default: {
-             break;
+
+        hash = c8_hash_word(hash, word);
+    }
+
+    hash = c8_hash_word(hash, (uint64_t)chip8->register_I |
+                              ((uint64_t)chip8->program_counter << 16) |
+                              ((uint64_t)chip8->stack_pointer << 32) |
+                              ((uint64_t)chip8->register_delay_timer << 40) |
+                              ((uint64_t)chip8->register_sound_timer << 48));
+
+    for (int k = 0; k < chip8->stack_pointer && k < C8_STACK_SIZE; k++) {
+        hash = c8_hash_word(hash, chip8->stack[k]);
+    }
+
+    return c8_hash_mix(hash);
+}
+
+/* A fast non-cryptographic 64 bit hash, bytes are read little endian */
+uint64_t c8_hash(const void *data, size_t length, uint64_t seed)
+{
+    const uint8_t *bytes = data;
+    uint64_t hash = c8_hash_word(seed, length);
+    size_t k = 0;
+
+    for (; k + 8 <= length; k += 8) {
+        uint64_t word = 0;
+
+        for (int b = 7; b >= 0; b--) {
+            word = (word << 8) | bytes[k + b];
         }
+
+        hash = c8_hash_word(hash, word);
     }
 
-    C8_LOG_ERROR("Unknown instruction %X", instr);
-    chip8->program_counter += 2;
+    if (k < length) {
+        uint64_t word = 0;
+
+        for (size_t b = length; b > k; b--) {
+            word = (word << 8) | bytes[b - 1];
+        }
+
+        hash = c8_hash_word(hash, word);
+    }
+
+    return c8_hash_mix(hash);
+}
+
+/* Combines one more word into a running hash */
+uint64_t c8_hash_word(uint64_t hash, uint64_t word)
+{
+    return (hash ^ c8_hash_mix(word + 0x9E3779B97F4A7C15ULL)) * 0x9FB21C651E98DF25ULL;
+}
+
+bool c8_waiting_for_key(const Chip8 *chip8)
+{
+    return chip8->wait_key_V_reg != -1;
+}
+
+/* Completes a pending Fx0A, frontends without a keyboard
+ * can call this directly from their own input source */
+void c8_key_press(Chip8 *chip8, uint8_t key)
+{
+    if (chip8->wait_key_V_reg != -1) {
+        chip8->register_V[chip8->wait_key_V_reg] = key;
+        chip8->wait_key_V_reg = -1;
+    }
+}
+
+void c8_key_event(Chip8 *chip8, uint8_t key, bool pressed)
+{
+    key &= C8_KEY_MASK;
+    chip8->input_keys[key] = pressed;
+
+    if (pressed) {
+        c8_key_press(chip8, key);
+    }
 }
 
 void c8_update_timers(Chip8 *chip8)
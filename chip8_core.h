@@ -19,47 +19,221 @@
 #ifndef C8_CHIP8_CORE_H
 #define C8_CHIP8_CORE_H
 
+#include <stdio.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
-#define C8_MEMORY_SIZE 0x1000
+/* XO-CHIP extends the address space to 64 KB. Any 16 bit address
+ * is therefore a valid index into memory. */
+#define C8_MEMORY_SIZE 0x10000
 #define C8_V_REGISTERS 16
 #define C8_STACK_SIZE 16
+/* Guest addresses, stack indices and keys are masked rather than checked,
+ * so a bad ROM wraps around instead of reaching outside of its buffers */
+#define C8_ADDRESS_MASK (C8_MEMORY_SIZE - 1)
+#define C8_STACK_MASK (C8_STACK_SIZE - 1)
+#define C8_KEY_MASK (C8_KEY_NUM - 1)
+#define C8_CACHE_LINE_SIZE 64
 #define C8_DISPLAY_MAX_HEIGHT 64
 #define C8_DISPLAY_MAX_WIDTH 128
 #define C8_DISPLAY_HEIGHT 32
 #define C8_DISPLAY_WIDTH 64
+#define C8_DISPLAY_PLANES 2
+#define C8_DISPLAY_ROW_WORDS (C8_DISPLAY_MAX_WIDTH / 64)
+#define C8_PALETTE_SIZE (1 << C8_DISPLAY_PLANES)
+#define C8_AUDIO_PATTERN_SIZE 16
+#define C8_AUDIO_PITCH_DEFAULT 64
 #define C8_KEY_NUM 16
 #define C8_TIMER_FREQ_HZ 60
 #define C8_PROGRAM_MEMORY_START 0x200
 #define C8_PROGRAM_MEMORY_SIZE (C8_MEMORY_SIZE - C8_PROGRAM_MEMORY_START)
 
+/* Each quirk profile is a separately compiled interpreter,
+ * see chip8_core_exec.h for the behaviour of each quirk */
+typedef enum {
+    C8_PROFILE_CHIP8,
+    C8_PROFILE_SCHIP,
+    C8_PROFILE_XOCHIP,
+    C8_PROFILE_NUM
+} Chip8Profile;
+
+/* SuperChip behaviour matches what this interpreter has always done
+ * for shifts and Fx55/Fx65, which many popular ROMs rely on. Bxnn
+ * differs: it jumps to xnn + Vx, where it used to jump to nnn + V0,
+ * so ROMs using B0nn-style jump tables need --profile=chip8 */
+#define C8_PROFILE_DEFAULT C8_PROFILE_SCHIP
+
+/* Common instruction sequences which c8_run_fused executes with a single
+ * dispatch. UNKNOWN marks an address which hasn't been analysed yet. */
+typedef enum {
+    C8_FUSION_UNKNOWN,
+    C8_FUSION_NONE,
+    C8_FUSION_LOAD_LOAD_DRAW, /* 6xnn; 6ynn; Dxyn */
+    C8_FUSION_DELAY_LOOP,     /* Fx07; 3x00; 1nnn back to Fx07 */
+    C8_FUSION_INDEX_DRAW,     /* Annn; Dxyn */
+    C8_FUSION_INDEX_LOAD,     /* Annn; Fx65 */
+    C8_FUSION_ADD_SKIP,       /* 7xnn; 3xnn or 4xnn */
+    C8_FUSION_NUM
+} Chip8FusionKind;
+
+/* Most instructions a single call to c8_run_fused can execute */
+#define C8_FUSION_MAX_INSTRUCTIONS 3
+
+/* The sequence starting at each address is found the first time it is
+ * executed and forgotten again when that memory is written to */
+typedef struct {
+    uint8_t kind[C8_MEMORY_SIZE];
+    uint64_t fired[C8_FUSION_NUM];
+} Chip8FusionCache;
+
+/* Tiers of c8_run_tiered, in the order code is promoted through them */
+typedef enum {
+    C8_TIER_INTERPRETED,
+    C8_TIER_DECODED,
+    C8_TIER_FUSED,
+    C8_TIER_NUM
+} Chip8Tier;
+
+#define C8_TIER_BLOCK_MAX_INSTRUCTIONS 32
+#define C8_TIER_MAX_BLOCKS 1024
+#define C8_TIER_THRESHOLD_DEFAULT 64
+
+/* A step of a compiled block: a single pre-decoded instruction
+ * when kind is C8_FUSION_NONE, otherwise a fused sequence */
+typedef struct {
+    uint16_t instr;
+    uint8_t kind;
+    /* Most instructions the step can execute */
+    uint8_t count;
+} Chip8BlockOp;
+
+/* Straight line code from start up to and including the first
+ * instruction which may jump, skip or wait for a key */
+typedef struct {
+    uint16_t start;
+    /* In bytes */
+    uint16_t length;
+    uint8_t tier;
+    uint8_t num_ops;
+    uint64_t executions;
+    Chip8BlockOp ops[C8_TIER_BLOCK_MAX_INSTRUCTIONS];
+} Chip8Block;
+
+/* Each basic block is interpreted until it has been entered threshold
+ * times, then compiled to pre-decoded instructions and, once those have
+ * run threshold times, recompiled with fused sequences. A block goes
+ * back to being interpreted when memory it covers is written to. */
+typedef struct {
+    uint16_t heat[C8_MEMORY_SIZE];
+    /* Index + 1 of the block starting at each address, 0 for none */
+    uint16_t block_index[C8_MEMORY_SIZE];
+    /* Number of blocks covering each byte */
+    uint8_t coverage[C8_MEMORY_SIZE];
+    Chip8Block blocks[C8_TIER_MAX_BLOCKS];
+    int num_blocks;
+    uint16_t threshold;
+    uint64_t instructions[C8_TIER_NUM];
+    uint64_t promotions[C8_TIER_NUM];
+    uint64_t demotions;
+} Chip8TierCache;
+
+/* Receives errors found while running, which are
+ * otherwise written to stderr */
+typedef void (*Chip8ErrorFn)(const char *message, void *user_data);
+
+/* Fields used by almost every instruction come first and fit in the
+ * first C8_CACHE_LINE_SIZE bytes, see c8_hot_state_size in chip8_core.c,
+ * so they share one cache line. Chip8 is aligned to a cache line for
+ * this, so one on the heap, or anything containing one, must be
+ * allocated with c8_alloc_aligned. The call stack and less used state
+ * follow, then the large buffers. */
 typedef struct {
-    uint8_t memory[C8_MEMORY_SIZE]; 
     uint8_t register_V[C8_V_REGISTERS];
     uint16_t register_I;
-    uint8_t register_delay_timer;
-    uint8_t register_sound_timer;
     uint16_t program_counter;
-    uint16_t stack[C8_STACK_SIZE];
+    /* Always less than C8_STACK_SIZE, calls and returns wrap around */
     uint8_t stack_pointer;
-    /* SuperChip allows for larger display, so maximum possible 
-     * display size is allocated and current dimensions are stored */
-    uint8_t display[C8_DISPLAY_MAX_WIDTH * C8_DISPLAY_MAX_HEIGHT];
-    uint8_t display_height;
-    uint8_t display_width;
-    bool update_display;
-    uint8_t input_keys[C8_KEY_NUM];
+    uint8_t register_delay_timer;
+    uint8_t register_sound_timer;
     /* This variable starts off with a value of -1.
      * When we need to wait for keyboard input and place the entered value
      * into a specified V register, this variable is set equal to the V register
-     * where the input should be placed. After the keyboard input has been read and
-     * the V register updated this variable is set back to -1. */
+     * where the input should be placed. c8_run_cycle executes nothing while
+     * waiting. Once c8_key_press has been called and the V register updated
+     * this variable is set back to -1. */
     int8_t wait_key_V_reg;
-} Chip8;
+    uint8_t display_height;
+    uint8_t display_width;
+    /* Bitmask of the planes affected by 00E0 and Dxyn, set by FN01 */
+    uint8_t plane_mask;
+    bool update_display;
+    /* Set when the last instruction executed closed a loop which can't make
+     * progress until the timers next change. Cleared by the caller, which may
+     * then skip ahead to the next timer tick without changing behaviour. */
+    bool idle;
+    /* Range of memory written by the last instruction which wrote to
+     * memory, write_length is reset to 0 by c8_run_fused and c8_run_tiered
+     * once seen */
+    uint8_t write_length;
+    uint16_t write_address;
+    /* xorshift32 state used by Cxnn */
+    uint32_t random_state;
+    Chip8Profile profile;
+    /* Number of instructions executed, used to timestamp input */
+    uint64_t cycles;
+    uint8_t input_keys[C8_KEY_NUM];
+
+    uint16_t stack[C8_STACK_SIZE];
+    uint8_t audio_pitch;
+    bool audio_pattern_set;
+    bool update_audio;
+    /* Set by c8_set_error_handler, NULL to write errors to stderr */
+    Chip8ErrorFn error_handler;
+    void *error_user_data;
+    /* XO-CHIP 1 bit audio pattern, played back while the sound timer is
+     * non-zero at a rate of 4000 * 2 ^ ((audio_pitch - 64) / 48) Hz */
+    uint8_t audio_pattern[C8_AUDIO_PATTERN_SIZE];
+    /* SuperChip allows for larger display, so maximum possible 
+     * display size is allocated and current dimensions are stored.
+     * Each XO-CHIP bitplane is stored packed with one bit per pixel,
+     * most significant bit first, so sprite rows are drawn and tested
+     * for collisions a 64 bit word at a time. */
+    uint64_t display[C8_DISPLAY_PLANES][C8_DISPLAY_MAX_HEIGHT][C8_DISPLAY_ROW_WORDS];
+    uint8_t memory[C8_MEMORY_SIZE]; 
+} __attribute__((aligned(C8_CACHE_LINE_SIZE))) Chip8;
+
+/* Colours for each combination of the XO-CHIP bitplanes. A ROM
+ * which only uses the first plane is drawn in black and white. */
+extern const uint32_t c8_palette[C8_PALETTE_SIZE];
 
+void *c8_alloc_aligned(size_t size);
 void c8_init(Chip8 *chip8);
-void c8_run_cycle(Chip8 *chip8);
+void c8_seed(Chip8 *chip8, uint64_t seed);
+bool c8_load_rom(Chip8 *chip8, const uint8_t *rom, size_t rom_size);
+bool c8_load_rom_file(Chip8 *chip8, const char *rom_file_path);
+int c8_run_cycle(Chip8 *chip8);
+void c8_fusion_init(Chip8FusionCache *cache);
+int c8_run_fused(Chip8 *chip8, Chip8FusionCache *cache);
+void c8_fusion_note_write(Chip8FusionCache *cache, Chip8 *chip8);
+void c8_fusion_analyse(const Chip8 *chip8, uint16_t start, size_t length, uint8_t *kinds);
+void c8_fusion_report(const Chip8FusionCache *cache, FILE *out);
+void c8_tier_init(Chip8TierCache *cache, uint16_t threshold);
+int c8_run_tiered(Chip8 *chip8, Chip8TierCache *cache, int max_instructions);
+void c8_tier_report(const Chip8TierCache *cache, FILE *out);
 void c8_update_timers(Chip8 *chip8);
+bool c8_waiting_for_key(const Chip8 *chip8);
+void c8_key_press(Chip8 *chip8, uint8_t key);
+void c8_key_event(Chip8 *chip8, uint8_t key, bool pressed);
+void c8_set_profile(Chip8 *chip8, Chip8Profile profile);
+void c8_set_error_handler(Chip8 *chip8, Chip8ErrorFn handler, void *user_data);
+bool c8_parse_profile(const char *name, Chip8Profile *profile);
+const char *c8_profile_name(Chip8Profile profile);
+uint8_t c8_display_pixel(const Chip8 *chip8, int x, int y);
+void c8_display_to_rgb(const Chip8 *chip8, uint32_t *pixels);
+uint64_t c8_display_hash(const Chip8 *chip8);
+uint64_t c8_register_hash(const Chip8 *chip8);
+uint64_t c8_hash(const void *data, size_t length, uint64_t seed);
+uint64_t c8_hash_word(uint64_t hash, uint64_t word);
 
 #endif
@@ -0,0 +1,596 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* Interpreter template, deliberately without an include guard.
+ * chip8_core.c includes this file once per quirk profile after defining
+ * C8_PROFILE_NAME and each of the C8_QUIRK_* macros below as 0 or 1.
+ * The quirks are compile time constants so every profile gets its own
+ * specialised copy of execute_instruction with no runtime quirk checks.
+ *
+ * C8_QUIRK_SHIFT_VY           8xy6/8xyE shift Vy into Vx rather than Vx in place
+ * C8_QUIRK_LOAD_STORE_INC_I   Fx55/Fx65 leave I pointing past the last register
+ * C8_QUIRK_WRAP_SPRITES       Dxyn wraps sprites around the display edges
+ *                             rather than clipping them
+ * C8_QUIRK_JUMP_VX            Bxnn jumps to xnn + Vx rather than nnn + V0
+ * C8_QUIRK_XO_CHIP            XO-CHIP instructions are available */
+
+#define C8_EXEC_CONCAT_(name, profile) name##_##profile
+#define C8_EXEC_CONCAT(name, profile) C8_EXEC_CONCAT_(name, profile)
+#define C8_EXEC_FN(name) C8_EXEC_CONCAT(name, C8_PROFILE_NAME)
+
+static void C8_EXEC_FN(c8_skip_next_instruction)(Chip8 *chip8)
+{
+    chip8->program_counter += 2;
+
+    /* F000 NNNN is the only 4 byte instruction and must be skipped whole */
+    if (C8_QUIRK_XO_CHIP && c8_fetch_next_instruction(chip8) == 0xF000) {
+        chip8->program_counter += 4;
+    } else {
+        chip8->program_counter += 2;
+    }
+}
+
+static void C8_EXEC_FN(c8_draw_sprite)(Chip8 *chip8, uint8_t x, uint8_t y, uint8_t rows)
+{
+    /* The starting position always wraps around the display */
+    x %= chip8->display_width;
+    y %= chip8->display_height;
+
+    int word = x / 64;
+    int shift = x % 64;
+    int row_words = chip8->display_width / 64;
+    uint16_t sprite_addr = chip8->register_I;
+
+    chip8->register_V[0xF] = 0;
+
+    /* When more than one plane is selected the sprite data for
+     * each plane is stored consecutively, lowest plane first */
+    for (int plane = 0; plane < C8_DISPLAY_PLANES; plane++) {
+        if (!(chip8->plane_mask & (1 << plane))) {
+            continue;
+        }
+
+        for (int row = 0; row < rows; row++) {
+            int display_y = y + row;
+
+            if (display_y >= chip8->display_height) {
+                if (!C8_QUIRK_WRAP_SPRITES) {
+                    break;
+                }
+
+                display_y -= chip8->display_height;
+            }
+
+            uint8_t sprite_byte = chip8->memory[(sprite_addr + row) & C8_ADDRESS_MASK];
+            uint64_t *display_row = chip8->display[plane][display_y];
+            uint64_t sprite_row[C8_DISPLAY_ROW_WORDS] = { 0 };
+
+            sprite_row[word] = ((uint64_t)sprite_byte << 56) >> shift;
+
+            /* The display width is a multiple of 64, so only the part of the
+             * sprite which crosses a word boundary can leave the display */
+            if (shift > 56) {
+                uint64_t overflow = (uint64_t)sprite_byte << (120 - shift);
+
+                if (word + 1 < row_words) {
+                    sprite_row[word + 1] = overflow;
+                } else if (C8_QUIRK_WRAP_SPRITES) {
+                    sprite_row[0] |= overflow;
+                }
+            }
+
+            for (int w = 0; w < row_words; w++) {
+                if (display_row[w] & sprite_row[w]) {
+                    chip8->register_V[0xF] = 1;
+                }
+
+                display_row[w] ^= sprite_row[w];
+            }
+        }
+
+        sprite_addr += rows;
+    }
+
+    chip8->update_display = true;
+}
+
+static void C8_EXEC_FN(c8_load_registers)(Chip8 *chip8, uint8_t last)
+{
+    uint8_t v_reg_num = last + 1;
+
+    for (int k = 0; k < v_reg_num; k++) {
+        chip8->register_V[k] = chip8->memory[(chip8->register_I + k) & C8_ADDRESS_MASK];
+    }
+
+    if (C8_QUIRK_LOAD_STORE_INC_I) {
+        chip8->register_I += v_reg_num;
+    }
+}
+
+static void C8_EXEC_FN(execute_instruction)(Chip8 *chip8, uint16_t instr)
+{
+    /* See http://devernay.free.fr/hacks/chip8/C8TECH10.HTM#3.1 
+     * for a description of CHIP-8 instructions */
+
+    switch (instr & 0xF000) {
+        case 0x0: {
+            switch (instr) {
+                case 0x00E0: {
+                    for (int plane = 0; plane < C8_DISPLAY_PLANES; plane++) {
+                        if (chip8->plane_mask & (1 << plane)) {
+                            memset(chip8->display[plane], 0, sizeof(chip8->display[plane]));
+                        }
+                    }
+
+                    chip8->update_display = true;
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0x00EE: {
+                    chip8->stack_pointer = (chip8->stack_pointer - 1) & C8_STACK_MASK;
+                    chip8->program_counter = chip8->stack[chip8->stack_pointer];
+                    chip8->program_counter += 2;
+                    return;
+                }
+                default: {
+                    break;
+                }
+            }
+        }
+        case 0x1000: {
+            uint16_t target = instr & 0x0FFF;
+
+            if (c8_is_idle_loop(chip8, target)) {
+                chip8->idle = true;
+            }
+
+            chip8->program_counter = target;
+            return;
+        }
+        case 0x2000: {
+            chip8->stack[chip8->stack_pointer] = chip8->program_counter;
+            chip8->stack_pointer = (chip8->stack_pointer + 1) & C8_STACK_MASK;
+            chip8->program_counter = instr & 0x0FFF;            
+            return;
+        }
+        case 0x3000: {
+            if (chip8->register_V[C8_REG_V_IDX(instr)] == C8_INSTR_VALUE(instr)) {
+                C8_EXEC_FN(c8_skip_next_instruction)(chip8);
+            } else {
+                chip8->program_counter += 2;
+            }
+
+            return;
+        }
+        case 0x4000: {
+            if (chip8->register_V[C8_REG_V_IDX(instr)] != C8_INSTR_VALUE(instr)) {
+                C8_EXEC_FN(c8_skip_next_instruction)(chip8);
+            } else {
+                chip8->program_counter += 2;
+            }
+
+            return;
+        }
+        case 0x5000: {
+            switch (instr & 0x000F) {
+                case 0x0: {
+                    if (chip8->register_V[C8_REG_V_IDX(instr)] == chip8->register_V[C8_REG_V2_IDX(instr)]) {
+                        C8_EXEC_FN(c8_skip_next_instruction)(chip8);
+                    } else {
+                        chip8->program_counter += 2;
+                    }
+
+                    return;
+                }
+                case 0x2: {
+                    if (!C8_QUIRK_XO_CHIP) {
+                        break;
+                    }
+
+                    c8_save_register_range(chip8, C8_REG_V_IDX(instr), C8_REG_V2_IDX(instr));
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0x3: {
+                    if (!C8_QUIRK_XO_CHIP) {
+                        break;
+                    }
+
+                    c8_load_register_range(chip8, C8_REG_V_IDX(instr), C8_REG_V2_IDX(instr));
+                    chip8->program_counter += 2;
+                    return;
+                }
+                default: {
+                    break;
+                }
+            }
+
+            break;
+        }
+        case 0x6000: {
+            chip8->register_V[C8_REG_V_IDX(instr)] = C8_INSTR_VALUE(instr);
+            chip8->program_counter += 2;
+            return;
+        }
+        case 0x7000: {
+            chip8->register_V[C8_REG_V_IDX(instr)] += C8_INSTR_VALUE(instr);
+            chip8->program_counter += 2;
+            return;
+        }
+        case 0x8000: {
+            switch (instr & 0x000F) {
+                case 0x0: {
+                    chip8->register_V[C8_REG_V_IDX(instr)] = chip8->register_V[C8_REG_V2_IDX(instr)];
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0x1: {
+                    chip8->register_V[C8_REG_V_IDX(instr)] |= chip8->register_V[C8_REG_V2_IDX(instr)];
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0x2: {
+                    chip8->register_V[C8_REG_V_IDX(instr)] &= chip8->register_V[C8_REG_V2_IDX(instr)];
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0x3: {
+                    chip8->register_V[C8_REG_V_IDX(instr)] ^= chip8->register_V[C8_REG_V2_IDX(instr)];
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0x4: {
+                    uint8_t value1 = chip8->register_V[C8_REG_V_IDX(instr)];
+                    uint8_t value2 = chip8->register_V[C8_REG_V2_IDX(instr)];
+
+                    if (value1 > UINT8_MAX - value2) {
+                        chip8->register_V[0xF] = 1;
+                    } else {
+                        chip8->register_V[0xF] = 0;
+                    }
+
+                    chip8->register_V[C8_REG_V_IDX(instr)] = value1 + value2;
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0x5: {
+                    uint8_t value1 = chip8->register_V[C8_REG_V_IDX(instr)];
+                    uint8_t value2 = chip8->register_V[C8_REG_V2_IDX(instr)];
+
+                    if (value1 > value2) {
+                        chip8->register_V[0xF] = 1;
+                    } else {
+                        chip8->register_V[0xF] = 0;
+                    }
+
+                    chip8->register_V[C8_REG_V_IDX(instr)] = value1 - value2;
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0x6: {
+                    uint8_t value = chip8->register_V[C8_QUIRK_SHIFT_VY ? C8_REG_V2_IDX(instr) : C8_REG_V_IDX(instr)];
+
+                    if (value & 0x1) {
+                        chip8->register_V[0xF] = 1;
+                    } else {
+                        chip8->register_V[0xF] = 0;
+                    }
+
+                    chip8->register_V[C8_REG_V_IDX(instr)] = value / 2;
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0x7: {
+                    uint8_t value1 = chip8->register_V[C8_REG_V_IDX(instr)];
+                    uint8_t value2 = chip8->register_V[C8_REG_V2_IDX(instr)];
+
+                    if (value2 > value1) {
+                        chip8->register_V[0xF] = 1;
+                    } else {
+                        chip8->register_V[0xF] = 0;
+                    }
+
+                    chip8->register_V[C8_REG_V_IDX(instr)] = value2 - value1;
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0xE: {
+                    uint8_t value = chip8->register_V[C8_QUIRK_SHIFT_VY ? C8_REG_V2_IDX(instr) : C8_REG_V_IDX(instr)];
+
+                    if (value & 0x80) {
+                        chip8->register_V[0xF] = 1;
+                    } else {
+                        chip8->register_V[0xF] = 0;
+                    }
+
+                    chip8->register_V[C8_REG_V_IDX(instr)] = value * 2;
+                    chip8->program_counter += 2;
+                    return;
+                }
+                default: {
+                    break;
+                }
+            }
+        }
+        case 0x9000: {
+            if (chip8->register_V[C8_REG_V_IDX(instr)] != chip8->register_V[C8_REG_V2_IDX(instr)]) {
+                C8_EXEC_FN(c8_skip_next_instruction)(chip8);
+            } else {
+                chip8->program_counter += 2;
+            }
+
+            return;
+        }
+        case 0xA000: {
+            chip8->register_I = (instr & 0x0FFF);
+            chip8->program_counter += 2;
+            return;
+        }
+        case 0xB000: {
+            chip8->program_counter = (instr & 0x0FFF) +
+                chip8->register_V[C8_QUIRK_JUMP_VX ? C8_REG_V_IDX(instr) : 0];
+            return;
+        }
+        case 0xC000: {
+            chip8->register_V[C8_REG_V_IDX(instr)] = c8_random_byte(chip8) & C8_INSTR_VALUE(instr);
+            chip8->program_counter += 2;
+            return;
+        }
+        case 0xD000: {
+            C8_EXEC_FN(c8_draw_sprite)(chip8, chip8->register_V[C8_REG_V_IDX(instr)],
+                                       chip8->register_V[C8_REG_V2_IDX(instr)], instr & 0x000F);
+            chip8->program_counter += 2;
+
+            return;
+        }
+        case 0xE000: {
+            switch (instr & 0x00FF) {
+                case 0x9E: {
+                    uint8_t key = chip8->register_V[C8_REG_V_IDX(instr)] & C8_KEY_MASK;
+
+                    if (chip8->input_keys[key]) {
+                        C8_EXEC_FN(c8_skip_next_instruction)(chip8);
+                    } else {
+                        chip8->program_counter += 2;
+                    }
+
+                    return;
+                }
+                case 0xA1: {
+                    uint8_t key = chip8->register_V[C8_REG_V_IDX(instr)] & C8_KEY_MASK;
+
+                    if (chip8->input_keys[key]) {
+                        chip8->program_counter += 2;
+                    } else {
+                        C8_EXEC_FN(c8_skip_next_instruction)(chip8);
+                    }
+
+                    return;
+                }
+                default: {
+                    break;
+                }
+            }
+        }
+        case 0xF000: {
+            switch (instr & 0x00FF) {
+                case 0x00: {
+                    if (!C8_QUIRK_XO_CHIP || instr != 0xF000) {
+                        break;
+                    }
+
+                    /* XO-CHIP long load, the address follows the instruction */
+                    chip8->register_I = chip8->memory[(chip8->program_counter + 2) & C8_ADDRESS_MASK] << 8 |
+                                        chip8->memory[(chip8->program_counter + 3) & C8_ADDRESS_MASK];
+                    chip8->program_counter += 4;
+                    return;
+                }
+                case 0x01: {
+                    if (!C8_QUIRK_XO_CHIP) {
+                        break;
+                    }
+
+                    chip8->plane_mask = C8_REG_V_IDX(instr) & ((1 << C8_DISPLAY_PLANES) - 1);
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0x02: {
+                    if (!C8_QUIRK_XO_CHIP || instr != 0xF002) {
+                        break;
+                    }
+
+                    for (int k = 0; k < C8_AUDIO_PATTERN_SIZE; k++) {
+                        chip8->audio_pattern[k] = chip8->memory[(chip8->register_I + k) & C8_ADDRESS_MASK];
+                    }
+
+                    chip8->audio_pattern_set = true;
+                    chip8->update_audio = true;
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0x07: {
+                    chip8->register_V[C8_REG_V_IDX(instr)] = chip8->register_delay_timer;
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0x0A: {
+                    chip8->wait_key_V_reg = C8_REG_V_IDX(instr);
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0x15: {
+                    chip8->register_delay_timer = chip8->register_V[C8_REG_V_IDX(instr)];
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0x18: {
+                    chip8->register_sound_timer = chip8->register_V[C8_REG_V_IDX(instr)];
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0x1E: {
+                    chip8->register_I += chip8->register_V[C8_REG_V_IDX(instr)];
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0x29: {
+                    chip8->register_I = (chip8->register_V[C8_REG_V_IDX(instr)] * 5);
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0x33: {
+                    uint8_t value = chip8->register_V[C8_REG_V_IDX(instr)];
+
+                    chip8->write_address = chip8->register_I;
+                    chip8->write_length = 3;
+                    chip8->memory[chip8->register_I & C8_ADDRESS_MASK] = value / 100;
+                    chip8->memory[(chip8->register_I + 1) & C8_ADDRESS_MASK] = (value / 10) % 10;
+                    chip8->memory[(chip8->register_I + 2) & C8_ADDRESS_MASK] = value % 10;
+
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0x3A: {
+                    if (!C8_QUIRK_XO_CHIP) {
+                        break;
+                    }
+
+                    chip8->audio_pitch = chip8->register_V[C8_REG_V_IDX(instr)];
+                    chip8->update_audio = true;
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0x55: {
+                    uint8_t v_reg_num = C8_REG_V_IDX(instr) + 1;
+
+                    chip8->write_address = chip8->register_I;
+                    chip8->write_length = v_reg_num;
+
+                    for (int k = 0; k < v_reg_num; k++) {
+                        chip8->memory[(chip8->register_I + k) & C8_ADDRESS_MASK] = chip8->register_V[k];
+                    }
+
+                    if (C8_QUIRK_LOAD_STORE_INC_I) {
+                        chip8->register_I += v_reg_num;
+                    }
+
+                    chip8->program_counter += 2;
+                    return;
+                }
+                case 0x65: {
+                    C8_EXEC_FN(c8_load_registers)(chip8, C8_REG_V_IDX(instr));
+                    chip8->program_counter += 2;
+                    return;
+                }
+                default: {
+                    break;
+                }
+            }
+        }
+        default: {
+             break;
+        }
+    }
+
+    c8_error(chip8, "Unknown instruction %X", instr);
+    chip8->program_counter += 2;
+}
+
+
+/* Executes the sequence of instructions starting at the program counter
+ * which c8_fusion_detect identified as kind, with exactly the same effect
+ * as executing them one at a time. Returns the number of instructions
+ * executed, which may be less than the length of the sequence when a
+ * skip is taken. */
+static int C8_EXEC_FN(execute_fused)(Chip8 *chip8, uint8_t kind)
+{
+    uint16_t pc = chip8->program_counter;
+    uint16_t instr1 = c8_read_instruction(chip8, pc);
+    uint16_t instr2 = c8_read_instruction(chip8, pc + 2);
+
+    switch (kind) {
+        case C8_FUSION_LOAD_LOAD_DRAW: {
+            uint16_t instr3 = c8_read_instruction(chip8, pc + 4);
+
+            chip8->register_V[C8_REG_V_IDX(instr1)] = C8_INSTR_VALUE(instr1);
+            chip8->register_V[C8_REG_V_IDX(instr2)] = C8_INSTR_VALUE(instr2);
+            C8_EXEC_FN(c8_draw_sprite)(chip8, chip8->register_V[C8_REG_V_IDX(instr3)],
+                                       chip8->register_V[C8_REG_V2_IDX(instr3)], instr3 & 0x000F);
+            chip8->program_counter = pc + 6;
+            return 3;
+        }
+        case C8_FUSION_DELAY_LOOP: {
+            uint8_t x = C8_REG_V_IDX(instr1);
+
+            chip8->register_V[x] = chip8->register_delay_timer;
+
+            if (chip8->register_V[x] == 0) {
+                chip8->program_counter = pc + 6;
+                return 2;
+            }
+
+            /* The jump returns to the start of the loop */
+            chip8->idle = true;
+            return 3;
+        }
+        case C8_FUSION_INDEX_DRAW: {
+            chip8->register_I = instr1 & 0x0FFF;
+            C8_EXEC_FN(c8_draw_sprite)(chip8, chip8->register_V[C8_REG_V_IDX(instr2)],
+                                       chip8->register_V[C8_REG_V2_IDX(instr2)], instr2 & 0x000F);
+            chip8->program_counter = pc + 4;
+            return 2;
+        }
+        case C8_FUSION_INDEX_LOAD: {
+            chip8->register_I = instr1 & 0x0FFF;
+            C8_EXEC_FN(c8_load_registers)(chip8, C8_REG_V_IDX(instr2));
+            chip8->program_counter = pc + 4;
+            return 2;
+        }
+        case C8_FUSION_ADD_SKIP: {
+            uint8_t value = chip8->register_V[C8_REG_V_IDX(instr1)] + C8_INSTR_VALUE(instr1);
+            bool equal = value == C8_INSTR_VALUE(instr2);
+
+            chip8->register_V[C8_REG_V_IDX(instr1)] = value;
+            chip8->program_counter = pc + 2;
+
+            if (equal == ((instr2 & 0xF000) == 0x3000)) {
+                C8_EXEC_FN(c8_skip_next_instruction)(chip8);
+            } else {
+                chip8->program_counter += 2;
+            }
+
+            return 2;
+        }
+        default: {
+            break;
+        }
+    }
+
+    C8_EXEC_FN(execute_instruction)(chip8, instr1);
+    return 1;
+}
+
+#undef C8_EXEC_FN
+#undef C8_EXEC_CONCAT
+#undef C8_EXEC_CONCAT_
+#undef C8_PROFILE_NAME
+#undef C8_QUIRK_SHIFT_VY
+#undef C8_QUIRK_LOAD_STORE_INC_I
+#undef C8_QUIRK_WRAP_SPRITES
+#undef C8_QUIRK_JUMP_VX
+#undef C8_QUIRK_XO_CHIP
@@ -0,0 +1,514 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "chip8_env.h"
+#include "chip8.h"
+
+typedef struct {
+    Chip8 chip8;
+    /* Observations written since the environment was created */
+    uint64_t written;
+    uint64_t step;
+    uint8_t reward_last;
+    bool done;
+} Chip8EnvInstance;
+
+typedef struct {
+    Chip8VecEnv *env;
+    int partition;
+} Chip8EnvWorker;
+
+struct Chip8VecEnv {
+    Chip8EnvConfig config;
+    Chip8EnvInstance *instances;
+    uint8_t *shm;
+    size_t shm_size;
+    size_t ring_stride;
+    int shm_fd;
+    pthread_t *workers;
+    Chip8EnvWorker *worker_args;
+    int num_workers;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t finished;
+    uint64_t generation;
+    int pending;
+    bool quit;
+    /* The step currently being run by the workers */
+    const uint16_t *step_keys;
+    int step_frames;
+};
+
+static bool c8_env_map(Chip8VecEnv *env);
+static void c8_env_unmap(Chip8VecEnv *env);
+static bool c8_env_start_workers(Chip8VecEnv *env);
+static void c8_env_stop_workers(Chip8VecEnv *env);
+static void *c8_env_worker(void *arg);
+static void c8_env_step_partition(Chip8VecEnv *env, int partition);
+static void c8_env_step_instance(Chip8VecEnv *env, int index, const uint16_t *keys, int frames);
+static void c8_env_write_observation(Chip8VecEnv *env, int index, double reward);
+static Chip8EnvShmRing *c8_env_ring(const Chip8VecEnv *env, int index);
+
+void c8_env_default_config(Chip8EnvConfig *config)
+{
+    memset(config, 0, sizeof(Chip8EnvConfig));
+
+    config->profile = C8_PROFILE_DEFAULT;
+    config->instr_per_frame = C8_ENV_INSTR_PER_FRAME_DEFAULT;
+    config->num_envs = 1;
+    config->num_threads = 1;
+    config->ring_size = C8_ENV_RING_SIZE_DEFAULT;
+    config->reward_address = -1;
+    config->done_address = -1;
+}
+
+Chip8VecEnv *c8_env_create(const Chip8EnvConfig *config)
+{
+    if (config->num_envs < 1 || config->num_threads < 1 ||
+        config->ring_size < 1 || config->instr_per_frame < 1) {
+        C8_LOG_ERROR("%s", "Invalid environment configuration");
+        return NULL;
+    }
+
+    if (config->rom_size > C8_PROGRAM_MEMORY_SIZE) {
+        C8_LOG_ERROR("ROM size %zu exceeds maximum of %d",
+                     config->rom_size, C8_PROGRAM_MEMORY_SIZE);
+        return NULL;
+    }
+
+    if (config->reward_address >= C8_MEMORY_SIZE ||
+        config->done_address >= C8_MEMORY_SIZE) {
+        C8_LOG_ERROR("%s", "Reward and done addresses must be within memory");
+        return NULL;
+    }
+
+    Chip8VecEnv *env = calloc(1, sizeof(Chip8VecEnv));
+
+    if (env == NULL) {
+        C8_LOG_ERROR("%s", "Unable to allocate environment");
+        return NULL;
+    }
+
+    env->config = *config;
+    env->config.num_threads = MIN(config->num_threads, config->num_envs);
+    env->shm_fd = -1;
+    env->instances = c8_alloc_aligned(config->num_envs * sizeof(Chip8EnvInstance));
+
+    if (env->instances == NULL) {
+        C8_LOG_ERROR("%s", "Unable to allocate environment instances");
+        free(env);
+        return NULL;
+    }
+
+    memset(env->instances, 0, config->num_envs * sizeof(Chip8EnvInstance));
+
+    if (!c8_env_map(env)) {
+        free(env->instances);
+        free(env);
+        return NULL;
+    }
+
+    c8_env_reset(env, -1, 0);
+
+    if (!c8_env_start_workers(env)) {
+        c8_env_unmap(env);
+        free(env->instances);
+        free(env);
+        return NULL;
+    }
+
+    return env;
+}
+
+void c8_env_destroy(Chip8VecEnv *env)
+{
+    if (env == NULL) {
+        return;
+    }
+
+    c8_env_stop_workers(env);
+    c8_env_unmap(env);
+    free(env->instances);
+    free(env);
+}
+
+/* Resets a single environment, or all of them when index is -1. Each
+ * environment is seeded with seed + index so they don't run in step. */
+void c8_env_reset(Chip8VecEnv *env, int index, uint64_t seed)
+{
+    int first = index < 0 ? 0 : index;
+    int last = index < 0 ? env->config.num_envs : index + 1;
+
+    for (int k = first; k < last; k++) {
+        Chip8EnvInstance *instance = &env->instances[k];
+        Chip8 *chip8 = &instance->chip8;
+
+        c8_init(chip8);
+        c8_seed(chip8, seed + k);
+        c8_set_profile(chip8, env->config.profile);
+        c8_load_rom(chip8, env->config.rom, env->config.rom_size);
+
+        instance->step = 0;
+        instance->done = false;
+        instance->reward_last = env->config.reward_address < 0 ? 0 :
+                                chip8->memory[env->config.reward_address];
+
+        c8_env_write_observation(env, k, 0);
+    }
+}
+
+/* Runs frames frames in every environment that isn't done. keys holds a
+ * bitmask of pressed keys for each environment, bit n being key n, or is
+ * NULL to leave the keys as they are. The reward and done callbacks are
+ * called from the worker threads. */
+void c8_env_step(Chip8VecEnv *env, const uint16_t *keys, int frames)
+{
+    env->step_keys = keys;
+    env->step_frames = frames;
+
+    if (env->num_workers == 0) {
+        c8_env_step_partition(env, 0);
+        return;
+    }
+
+    pthread_mutex_lock(&env->lock);
+    env->pending = env->num_workers;
+    env->generation++;
+    pthread_cond_broadcast(&env->start);
+    pthread_mutex_unlock(&env->lock);
+
+    /* The calling thread takes the first partition */
+    c8_env_step_partition(env, 0);
+
+    pthread_mutex_lock(&env->lock);
+
+    while (env->pending > 0) {
+        pthread_cond_wait(&env->finished, &env->lock);
+    }
+
+    pthread_mutex_unlock(&env->lock);
+}
+
+/* The latest observation for an environment. This points into the shared
+ * memory ring so is only valid until ring_size further steps are made. */
+const Chip8Observation *c8_env_observation(const Chip8VecEnv *env, int index)
+{
+    Chip8EnvShmRing *ring = c8_env_ring(env, index);
+    Chip8Observation *slots = (Chip8Observation *)(ring + 1);
+
+    return &slots[ring->latest % env->config.ring_size];
+}
+
+const Chip8 *c8_env_state(const Chip8VecEnv *env, int index)
+{
+    return &env->instances[index].chip8;
+}
+
+static bool c8_env_map(Chip8VecEnv *env)
+{
+    const Chip8EnvConfig *config = &env->config;
+    env->ring_stride = sizeof(Chip8EnvShmRing) +
+                       (size_t)config->ring_size * sizeof(Chip8Observation);
+    env->shm_size = sizeof(Chip8EnvShmHeader) + config->num_envs * env->ring_stride;
+
+    if (config->shm_name == NULL) {
+        void *memory;
+
+        if (posix_memalign(&memory, 64, env->shm_size) != 0) {
+            C8_LOG_ERROR("%s", "Unable to allocate observation memory");
+            return false;
+        }
+
+        env->shm = memory;
+    } else {
+        env->shm_fd = shm_open(config->shm_name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+        if (env->shm_fd == -1) {
+            C8_LOG_ERROR("Unable to open shared memory %s - %s",
+                         config->shm_name, strerror(errno));
+            return false;
+        }
+
+        void *memory = MAP_FAILED;
+
+        if (ftruncate(env->shm_fd, env->shm_size) == 0) {
+            memory = mmap(NULL, env->shm_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED, env->shm_fd, 0);
+        }
+
+        if (memory == MAP_FAILED) {
+            C8_LOG_ERROR("Unable to map shared memory %s - %s",
+                         config->shm_name, strerror(errno));
+            close(env->shm_fd);
+            shm_unlink(config->shm_name);
+            return false;
+        }
+
+        env->shm = memory;
+    }
+
+    memset(env->shm, 0, env->shm_size);
+
+    Chip8EnvShmHeader *header = (Chip8EnvShmHeader *)env->shm;
+    header->version = C8_ENV_SHM_VERSION;
+    header->num_envs = config->num_envs;
+    header->ring_size = config->ring_size;
+    header->observation_size = sizeof(Chip8Observation);
+    header->ring_stride = env->ring_stride;
+    /* Written last so a reader that sees the magic sees a valid header */
+    __atomic_store_n(&header->magic, C8_ENV_SHM_MAGIC, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+static void c8_env_unmap(Chip8VecEnv *env)
+{
+    if (env->shm_fd == -1) {
+        free(env->shm);
+        return;
+    }
+
+    munmap(env->shm, env->shm_size);
+    close(env->shm_fd);
+    shm_unlink(env->config.shm_name);
+}
+
+static bool c8_env_start_workers(Chip8VecEnv *env)
+{
+    env->num_workers = env->config.num_threads - 1;
+
+    if (env->num_workers == 0) {
+        return true;
+    }
+
+    env->workers = calloc(env->num_workers, sizeof(pthread_t));
+    env->worker_args = calloc(env->num_workers, sizeof(Chip8EnvWorker));
+
+    if (env->workers == NULL || env->worker_args == NULL) {
+        C8_LOG_ERROR("%s", "Unable to allocate environment workers");
+        free(env->worker_args);
+        free(env->workers);
+        env->workers = NULL;
+        return false;
+    }
+
+    pthread_mutex_init(&env->lock, NULL);
+    pthread_cond_init(&env->start, NULL);
+    pthread_cond_init(&env->finished, NULL);
+
+    for (int k = 0; k < env->num_workers; k++) {
+        env->worker_args[k].env = env;
+        env->worker_args[k].partition = k + 1;
+
+        if (pthread_create(&env->workers[k], NULL, c8_env_worker,
+                           &env->worker_args[k]) != 0) {
+            C8_LOG_ERROR("%s", "Unable to create environment worker thread");
+            env->num_workers = k;
+            c8_env_stop_workers(env);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static void c8_env_stop_workers(Chip8VecEnv *env)
+{
+    if (env->workers == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&env->lock);
+    env->quit = true;
+    pthread_cond_broadcast(&env->start);
+    pthread_mutex_unlock(&env->lock);
+
+    for (int k = 0; k < env->num_workers; k++) {
+        pthread_join(env->workers[k], NULL);
+    }
+
+    pthread_cond_destroy(&env->finished);
+    pthread_cond_destroy(&env->start);
+    pthread_mutex_destroy(&env->lock);
+    free(env->worker_args);
+    free(env->workers);
+    env->workers = NULL;
+}
+
+static void *c8_env_worker(void *arg)
+{
+    Chip8EnvWorker *worker = arg;
+    Chip8VecEnv *env = worker->env;
+    uint64_t generation = 0;
+
+    for (;;) {
+        pthread_mutex_lock(&env->lock);
+
+        while (!env->quit && env->generation == generation) {
+            pthread_cond_wait(&env->start, &env->lock);
+        }
+
+        if (env->quit) {
+            pthread_mutex_unlock(&env->lock);
+            break;
+        }
+
+        generation = env->generation;
+        pthread_mutex_unlock(&env->lock);
+
+        c8_env_step_partition(env, worker->partition);
+
+        pthread_mutex_lock(&env->lock);
+
+        if (--env->pending == 0) {
+            pthread_cond_signal(&env->finished);
+        }
+
+        pthread_mutex_unlock(&env->lock);
+    }
+
+    return NULL;
+}
+
+/* Environments are split evenly between threads. Every instance runs the
+ * same number of frames so there is little to gain from work stealing. */
+static void c8_env_step_partition(Chip8VecEnv *env, int partition)
+{
+    int num_envs = env->config.num_envs;
+    int num_threads = env->config.num_threads;
+    int first = (int)((int64_t)num_envs * partition / num_threads);
+    int last = (int)((int64_t)num_envs * (partition + 1) / num_threads);
+
+    for (int k = first; k < last; k++) {
+        c8_env_step_instance(env, k, env->step_keys, env->step_frames);
+    }
+}
+
+static void c8_env_step_instance(Chip8VecEnv *env, int index, const uint16_t *keys, int frames)
+{
+    const Chip8EnvConfig *config = &env->config;
+    Chip8EnvInstance *instance = &env->instances[index];
+    Chip8 *chip8 = &instance->chip8;
+
+    if (instance->done) {
+        return;
+    }
+
+    if (keys != NULL) {
+        for (uint8_t key = 0; key < C8_KEY_NUM; key++) {
+            bool pressed = (keys[index] >> key) & 0x1;
+
+            if (pressed != chip8->input_keys[key]) {
+                c8_key_event(chip8, key, pressed);
+            }
+        }
+    }
+
+    for (int frame = 0; frame < frames; frame++) {
+        for (int k = 0; k < config->instr_per_frame; k++) {
+            if (c8_run_cycle(chip8) == 0) {
+                /* Waiting on a key which can't arrive until the next step */
+                break;
+            }
+        }
+
+        c8_update_timers(chip8);
+    }
+
+    double reward = 0;
+
+    if (config->reward != NULL) {
+        reward = config->reward(chip8, config->user_data);
+    } else if (config->reward_address >= 0) {
+        uint8_t value = chip8->memory[config->reward_address];
+        reward = (int)value - (int)instance->reward_last;
+        instance->reward_last = value;
+    }
+
+    if (config->done != NULL) {
+        instance->done = config->done(chip8, config->user_data);
+    } else if (config->done_address >= 0) {
+        instance->done = chip8->memory[config->done_address] == config->done_value;
+    }
+
+    instance->step++;
+    c8_env_write_observation(env, index, reward);
+}
+
+static void c8_env_write_observation(Chip8VecEnv *env, int index, double reward)
+{
+    Chip8EnvInstance *instance = &env->instances[index];
+    const Chip8 *chip8 = &instance->chip8;
+    Chip8EnvShmRing *ring = c8_env_ring(env, index);
+    Chip8Observation *slots = (Chip8Observation *)(ring + 1);
+    Chip8Observation *obs = &slots[instance->written % env->config.ring_size];
+
+    uint64_t sequence = obs->sequence + 1;
+    __atomic_store_n(&obs->sequence, sequence, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    obs->step = instance->step;
+    obs->cycles = chip8->cycles;
+    obs->reward = reward;
+    obs->done = instance->done;
+    obs->waiting_for_key = c8_waiting_for_key(chip8);
+    obs->display_width = chip8->display_width;
+    obs->display_height = chip8->display_height;
+    obs->register_I = chip8->register_I;
+    obs->program_counter = chip8->program_counter;
+    memcpy(obs->register_V, chip8->register_V, C8_V_REGISTERS);
+    obs->stack_pointer = chip8->stack_pointer;
+    obs->register_delay_timer = chip8->register_delay_timer;
+    obs->register_sound_timer = chip8->register_sound_timer;
+
+    /* Unpacked a word at a time rather than through c8_display_pixel */
+    for (int y = 0; y < C8_DISPLAY_MAX_HEIGHT; y++) {
+        uint8_t *row = obs->pixels + y * C8_DISPLAY_MAX_WIDTH;
+
+        for (int w = 0; w < C8_DISPLAY_ROW_WORDS; w++) {
+            uint64_t low = chip8->display[0][y][w];
+            uint64_t high = chip8->display[1][y][w];
+            uint8_t *out = row + w * 64;
+
+            for (int bit = 0; bit < 64; bit++) {
+                out[bit] = ((low >> (63 - bit)) & 0x1) |
+                           (((high >> (63 - bit)) & 0x1) << 1);
+            }
+        }
+    }
+
+    __atomic_store_n(&obs->sequence, sequence + 1, __ATOMIC_RELEASE);
+    __atomic_store_n(&ring->latest, instance->written, __ATOMIC_RELEASE);
+    instance->written++;
+}
+
+static Chip8EnvShmRing *c8_env_ring(const Chip8VecEnv *env, int index)
+{
+    return (Chip8EnvShmRing *)(env->shm + sizeof(Chip8EnvShmHeader) +
+                               index * env->ring_stride);
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef C8_CHIP8_ENV_H
+#define C8_CHIP8_ENV_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "chip8_core.h"
+
+/* Step based environment for training agents, running any number of
+ * interpreters in lock step across a pool of threads. No SDL is involved:
+ * each step applies the requested keys, then runs a number of frames, each
+ * made up of instr_per_frame instructions followed by a timer update.
+ *
+ * After every reset and step an observation of each environment is
+ * written into a ring of slots in shared memory. When shm_name is given
+ * the memory is created with shm_open, so another local process can map
+ * /dev/shm/<shm_name> and read observations in place. The layout is:
+ *
+ *   Chip8EnvShmHeader
+ *   num_envs times:
+ *     Chip8EnvShmRing, followed by ring_size Chip8Observation slots
+ *
+ * Every struct is a multiple of 64 bytes with naturally aligned fields.
+ * Ring latest is the index of the most recently completed observation, to
+ * be read from slot latest % ring_size. A slot's sequence is odd while it
+ * is being written, so a reader should read sequence, copy or use the
+ * slot, then check sequence is even and unchanged. */
+
+#define C8_ENV_SHM_MAGIC 0x45563843
+#define C8_ENV_SHM_VERSION 1
+#define C8_ENV_RING_SIZE_DEFAULT 4
+#define C8_ENV_INSTR_PER_FRAME_DEFAULT 10
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_envs;
+    uint32_t ring_size;
+    uint32_t observation_size;
+    uint32_t ring_stride;
+    uint8_t padding[40];
+} Chip8EnvShmHeader;
+
+typedef struct {
+    uint64_t latest;
+    uint8_t padding[56];
+} Chip8EnvShmRing;
+
+typedef struct {
+    uint64_t sequence;
+    /* Steps since the environment was last reset */
+    uint64_t step;
+    uint64_t cycles;
+    double reward;
+    uint8_t done;
+    uint8_t waiting_for_key;
+    uint8_t display_width;
+    uint8_t display_height;
+    uint16_t register_I;
+    uint16_t program_counter;
+    uint8_t register_V[C8_V_REGISTERS];
+    uint8_t stack_pointer;
+    uint8_t register_delay_timer;
+    uint8_t register_sound_timer;
+    uint8_t padding[69];
+    /* Palette index of each pixel, rows are C8_DISPLAY_MAX_WIDTH apart */
+    uint8_t pixels[C8_DISPLAY_MAX_HEIGHT * C8_DISPLAY_MAX_WIDTH];
+} Chip8Observation;
+
+/* Called after each step, reward may be NULL in which case the reward is
+ * the signed change in the byte at reward_address, or 0 if that is -1 */
+typedef double (*Chip8RewardFn)(const Chip8 *chip8, void *user_data);
+/* done may be NULL in which case an environment is done once the byte at
+ * done_address equals done_value, or never if done_address is -1 */
+typedef bool (*Chip8DoneFn)(const Chip8 *chip8, void *user_data);
+
+typedef struct {
+    const uint8_t *rom;
+    size_t rom_size;
+    Chip8Profile profile;
+    int instr_per_frame;
+    int num_envs;
+    int num_threads;
+    int ring_size;
+    const char *shm_name;
+    Chip8RewardFn reward;
+    Chip8DoneFn done;
+    void *user_data;
+    int reward_address;
+    int done_address;
+    uint8_t done_value;
+} Chip8EnvConfig;
+
+struct Chip8VecEnv;
+typedef struct Chip8VecEnv Chip8VecEnv;
+
+void c8_env_default_config(Chip8EnvConfig *config);
+Chip8VecEnv *c8_env_create(const Chip8EnvConfig *config);
+void c8_env_destroy(Chip8VecEnv *env);
+void c8_env_reset(Chip8VecEnv *env, int index, uint64_t seed);
+void c8_env_step(Chip8VecEnv *env, const uint16_t *keys, int frames);
+const Chip8Observation *c8_env_observation(const Chip8VecEnv *env, int index);
+const Chip8 *c8_env_state(const Chip8VecEnv *env, int index);
+
+#endif
@@ -0,0 +1,64 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <string.h>
+#include "chip8_input.h"
+
+#define C8_KEY_QUEUE_MASK (C8_KEY_QUEUE_SIZE - 1)
+
+void c8_key_queue_init(Chip8KeyQueue *queue)
+{
+    memset(queue, 0, sizeof(Chip8KeyQueue));
+}
+
+/* Returns false when the queue is full and the event was dropped */
+bool c8_key_queue_push(Chip8KeyQueue *queue, const Chip8KeyEvent *event)
+{
+    uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+
+    if (tail - head == C8_KEY_QUEUE_SIZE) {
+        return false;
+    }
+
+    queue->events[tail & C8_KEY_QUEUE_MASK] = *event;
+    __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+
+    return true;
+}
+
+/* Apply, in order, every queued event which is due at or
+ * before the number of cycles the interpreter has run */
+void c8_key_queue_apply(Chip8KeyQueue *queue, Chip8 *chip8)
+{
+    uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_RELAXED);
+    uint32_t tail = __atomic_load_n(&queue->tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        const Chip8KeyEvent *event = &queue->events[head & C8_KEY_QUEUE_MASK];
+
+        if (event->cycle > chip8->cycles) {
+            break;
+        }
+
+        c8_key_event(chip8, event->key, event->pressed);
+        head++;
+    }
+
+    __atomic_store_n(&queue->head, head, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,50 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef C8_CHIP8_INPUT_H
+#define C8_CHIP8_INPUT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "chip8_core.h"
+
+/* Must be a power of two */
+#define C8_KEY_QUEUE_SIZE 256
+
+/* A key press or release which takes effect once the
+ * interpreter has executed cycle instructions */
+typedef struct {
+    uint64_t cycle;
+    uint8_t key;
+    bool pressed;
+} Chip8KeyEvent;
+
+/* Single producer, single consumer lock free queue. The producer only
+ * writes tail and the consumer only writes head, so input can be
+ * collected on one thread and applied by the interpreter on another. */
+typedef struct {
+    Chip8KeyEvent events[C8_KEY_QUEUE_SIZE];
+    uint32_t head;
+    uint32_t tail;
+} Chip8KeyQueue;
+
+void c8_key_queue_init(Chip8KeyQueue *queue);
+bool c8_key_queue_push(Chip8KeyQueue *queue, const Chip8KeyEvent *event);
+void c8_key_queue_apply(Chip8KeyQueue *queue, Chip8 *chip8);
+
+#endif
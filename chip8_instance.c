@@ -0,0 +1,357 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "chip8.h"
+#include "chip8_instance.h"
+
+#define C8_INSTANCE_INSTR_PER_FRAME_DEFAULT 10
+
+struct Chip8Instance {
+    Chip8 chip8;
+    /* The block from host.alloc which the instance was placed in */
+    void *allocation;
+    Chip8Host host;
+    Chip8InstanceConfig config;
+    /* NULL unless config.fuse is set */
+    Chip8FusionCache *fusion;
+    /* Copy of the ROM loaded, so the instance can be reset. Space for
+     * the largest ROM is kept so loading one never allocates. */
+    uint8_t rom[C8_PROGRAM_MEMORY_SIZE];
+    size_t rom_size;
+    /* Instructions run since the start of the frame */
+    int frame_cycle;
+    bool sound_on;
+    uint32_t pixels[C8_DISPLAY_MAX_WIDTH * C8_DISPLAY_MAX_HEIGHT];
+};
+
+static void *c8_instance_malloc(size_t, void *);
+static void c8_instance_free(void *, void *);
+static void c8_instance_error(const Chip8Host *, const char *, ...);
+static void c8_instance_report_error(const char *, void *);
+static void c8_instance_end_frame(Chip8Instance *);
+static void c8_instance_poll_keys(Chip8Instance *);
+static bool c8_instance_valid_config(const Chip8InstanceConfig *);
+
+void c8_instance_default_config(Chip8InstanceConfig *config)
+{
+    *config = (Chip8InstanceConfig) {
+        .profile = C8_PROFILE_DEFAULT,
+        .seed = 0,
+        .instr_per_frame = C8_INSTANCE_INSTR_PER_FRAME_DEFAULT,
+        .fuse = false
+    };
+}
+
+/* host may be NULL to use malloc and not be told anything */
+Chip8Instance *c8_instance_create(const Chip8Host *host, const Chip8InstanceConfig *config)
+{
+    Chip8Host instance_host = { 0 };
+
+    if (host != NULL) {
+        instance_host = *host;
+    }
+
+    if ((instance_host.alloc == NULL) != (instance_host.free == NULL)) {
+        c8_instance_error(&instance_host, "Both or neither of alloc and free must be set");
+        return NULL;
+    } else if (instance_host.alloc == NULL) {
+        instance_host.alloc = c8_instance_malloc;
+        instance_host.free = c8_instance_free;
+    }
+
+    if (!c8_instance_valid_config(config)) {
+        c8_instance_error(&instance_host, "Invalid instance configuration");
+        return NULL;
+    }
+
+    /* Chip8 is cache line aligned but the host only has to align memory
+     * as malloc does, so room is left to move the instance up to a line */
+    size_t allocation_size = sizeof(Chip8Instance) + C8_CACHE_LINE_SIZE - 1;
+    void *allocation = instance_host.alloc(allocation_size, instance_host.user_data);
+
+    if (allocation == NULL) {
+        c8_instance_error(&instance_host, "Unable to allocate %zu bytes for instance",
+                          allocation_size);
+        return NULL;
+    }
+
+    Chip8Instance *instance = (Chip8Instance *)(((uintptr_t)allocation + C8_CACHE_LINE_SIZE - 1) &
+                                                ~(uintptr_t)(C8_CACHE_LINE_SIZE - 1));
+
+    memset(instance, 0, sizeof(Chip8Instance));
+    instance->allocation = allocation;
+    instance->host = instance_host;
+    instance->config = *config;
+
+    if (config->fuse) {
+        instance->fusion = instance_host.alloc(sizeof(Chip8FusionCache), instance_host.user_data);
+
+        if (instance->fusion == NULL) {
+            c8_instance_error(&instance_host, "Unable to allocate %zu bytes for fusion cache",
+                              sizeof(Chip8FusionCache));
+            instance_host.free(allocation, instance_host.user_data);
+            return NULL;
+        }
+    }
+
+    c8_instance_reset(instance);
+
+    return instance;
+}
+
+void c8_instance_destroy(Chip8Instance *instance)
+{
+    if (instance == NULL) {
+        return;
+    }
+
+    Chip8Host host = instance->host;
+
+    if (instance->fusion != NULL) {
+        host.free(instance->fusion, host.user_data);
+    }
+
+    host.free(instance->allocation, host.user_data);
+}
+
+/* Replaces the configuration of an existing instance, which is then reset
+ * to run the loaded ROM from the start, so that an instance can be reused
+ * for ROMs needing different settings. On failure nothing is changed. */
+bool c8_instance_configure(Chip8Instance *instance, const Chip8InstanceConfig *config)
+{
+    if (!c8_instance_valid_config(config)) {
+        c8_instance_error(&instance->host, "Invalid instance configuration");
+        return false;
+    }
+
+    if (config->fuse && instance->fusion == NULL) {
+        instance->fusion = instance->host.alloc(sizeof(Chip8FusionCache), instance->host.user_data);
+
+        if (instance->fusion == NULL) {
+            c8_instance_error(&instance->host, "Unable to allocate %zu bytes for fusion cache",
+                              sizeof(Chip8FusionCache));
+            return false;
+        }
+    } else if (!config->fuse && instance->fusion != NULL) {
+        instance->host.free(instance->fusion, instance->host.user_data);
+        instance->fusion = NULL;
+    }
+
+    instance->config = *config;
+    c8_instance_reset(instance);
+
+    return true;
+}
+
+/* The ROM is copied, and the instance reset to run it from the start */
+bool c8_instance_load(Chip8Instance *instance, const uint8_t *rom, size_t rom_size)
+{
+    if (rom_size > C8_PROGRAM_MEMORY_SIZE) {
+        c8_instance_error(&instance->host, "Size of ROM exceeds XO-CHIP program memory space");
+        return false;
+    }
+
+    memcpy(instance->rom, rom, rom_size);
+    instance->rom_size = rom_size;
+    c8_instance_reset(instance);
+
+    return true;
+}
+
+/* Returns the instance to the state it was in straight after
+ * the ROM was loaded, with the random number generator reseeded */
+void c8_instance_reset(Chip8Instance *instance)
+{
+    Chip8 *chip8 = &instance->chip8;
+
+    c8_init(chip8);
+    c8_seed(chip8, instance->config.seed);
+    c8_set_profile(chip8, instance->config.profile);
+
+    if (instance->host.error != NULL) {
+        c8_set_error_handler(chip8, c8_instance_report_error, instance);
+    }
+
+    c8_load_rom(chip8, instance->rom, instance->rom_size);
+
+    if (instance->fusion != NULL) {
+        c8_fusion_init(instance->fusion);
+    }
+
+    if (instance->sound_on && instance->host.sound != NULL) {
+        instance->host.sound(false, instance->host.user_data);
+    }
+
+    instance->frame_cycle = 0;
+    instance->sound_on = false;
+}
+
+/* Fills the fusion cache with the sequence starting at each of the first
+ * length bytes of the ROM, as found by c8_fusion_analyse or read from a
+ * cached analysis, so they needn't be found as the ROM runs. Must be called
+ * straight after the ROM is loaded or the instance reset, and does nothing
+ * when not fusing. */
+void c8_instance_warm_fusion(Chip8Instance *instance, const uint8_t *kinds, size_t length)
+{
+    if (instance->fusion != NULL) {
+        memcpy(instance->fusion->kind + C8_PROGRAM_MEMORY_START, kinds, MIN(length, instance->rom_size));
+    }
+}
+
+/* Runs for cycles instructions, where waiting a cycle for a key press
+ * counts as an instruction. Fused sequences are only run when they can't
+ * cross the end of a frame, so the result doesn't depend on config.fuse.
+ * Returns the number of cycles run, which is always cycles. */
+uint64_t c8_instance_run(Chip8Instance *instance, uint64_t cycles)
+{
+    Chip8 *chip8 = &instance->chip8;
+    uint64_t run = 0;
+
+    while (run < cycles) {
+        if (instance->frame_cycle == 0) {
+            c8_instance_poll_keys(instance);
+        }
+
+        uint64_t remaining = MIN(cycles - run,
+                                 (uint64_t)(instance->config.instr_per_frame - instance->frame_cycle));
+        int executed;
+
+        if (instance->fusion != NULL && remaining >= C8_FUSION_MAX_INSTRUCTIONS) {
+            executed = c8_run_fused(chip8, instance->fusion);
+        } else {
+            executed = c8_run_cycle(chip8);
+
+            if (instance->fusion != NULL) {
+                c8_fusion_note_write(instance->fusion, chip8);
+            }
+        }
+
+        /* Nothing is executed while waiting for a key */
+        if (executed == 0) {
+            executed = 1;
+        }
+
+        chip8->idle = false;
+        run += executed;
+        instance->frame_cycle += executed;
+
+        if (instance->frame_cycle >= instance->config.instr_per_frame) {
+            c8_instance_end_frame(instance);
+        }
+    }
+
+    return run;
+}
+
+/* Read only access to the interpreter state, e.g. for c8_display_hash */
+const Chip8 *c8_instance_state(const Chip8Instance *instance)
+{
+    return &instance->chip8;
+}
+
+static void c8_instance_end_frame(Chip8Instance *instance)
+{
+    Chip8 *chip8 = &instance->chip8;
+    const Chip8Host *host = &instance->host;
+
+    c8_update_timers(chip8);
+    instance->frame_cycle = 0;
+
+    bool sound_on = chip8->register_sound_timer > 0;
+
+    if (sound_on != instance->sound_on) {
+        instance->sound_on = sound_on;
+
+        if (host->sound != NULL) {
+            host->sound(sound_on, host->user_data);
+        }
+    }
+
+    if (chip8->update_display) {
+        chip8->update_display = false;
+
+        if (host->frame != NULL) {
+            c8_display_to_rgb(chip8, instance->pixels);
+            host->frame(instance->pixels, chip8->display_width, chip8->display_height,
+                        host->user_data);
+        }
+    }
+}
+
+static void c8_instance_poll_keys(Chip8Instance *instance)
+{
+    Chip8 *chip8 = &instance->chip8;
+    const Chip8Host *host = &instance->host;
+
+    if (host->key_held == NULL) {
+        return;
+    }
+
+    for (uint8_t key = 0; key < C8_KEY_NUM; key++) {
+        bool pressed = host->key_held(key, host->user_data);
+
+        if (pressed != chip8->input_keys[key]) {
+            c8_key_event(chip8, key, pressed);
+        }
+    }
+}
+
+static bool c8_instance_valid_config(const Chip8InstanceConfig *config)
+{
+    return config->instr_per_frame >= 1 && config->profile >= 0 && config->profile < C8_PROFILE_NUM;
+}
+
+static void *c8_instance_malloc(size_t size, void *user_data)
+{
+    (void)user_data;
+
+    return malloc(size);
+}
+
+static void c8_instance_free(void *ptr, void *user_data)
+{
+    (void)user_data;
+
+    free(ptr);
+}
+
+static void c8_instance_error(const Chip8Host *host, const char *format, ...)
+{
+    char message[128];
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+
+    if (host->error != NULL) {
+        host->error(message, host->user_data);
+    } else {
+        C8_LOG_ERROR("%s", message);
+    }
+}
+
+static void c8_instance_report_error(const char *message, void *user_data)
+{
+    Chip8Instance *instance = user_data;
+
+    instance->host.error(message, instance->host.user_data);
+}
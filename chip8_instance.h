@@ -0,0 +1,74 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef C8_CHIP8_INSTANCE_H
+#define C8_CHIP8_INSTANCE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "chip8_core.h"
+
+/* The interface of libchip8, for embedding interpreters in other programs.
+ *
+ * Each instance is independent and holds no global state, so any number
+ * can be run at once on different threads. An instance itself must only
+ * be used by one thread at a time. Time is measured in instructions:
+ * the timers tick, the host is asked for the keys held and any changed
+ * display is passed to the host every instr_per_frame instructions. */
+
+typedef struct Chip8Instance Chip8Instance;
+
+/* Any callback may be NULL. Callbacks are made from within
+ * c8_instance_run and must not call back into the instance. */
+typedef struct {
+    /* Used for all of an instance's memory, which must be aligned as
+     * malloc aligns it. Either both or neither must be set. */
+    void *(*alloc)(size_t size, void *user_data);
+    void (*free)(void *ptr, void *user_data);
+    /* The display at the end of a frame in which it changed, as width *
+     * height 0xRRGGBB pixels row by row, only valid during the call */
+    void (*frame)(const uint32_t *pixels, int width, int height, void *user_data);
+    /* The sound timer has started or stopped */
+    void (*sound)(bool on, void *user_data);
+    /* Whether CHIP-8 key 0-F is held, asked for each key once a frame */
+    bool (*key_held)(uint8_t key, void *user_data);
+    /* Errors which would otherwise be written to stderr */
+    void (*error)(const char *message, void *user_data);
+    void *user_data;
+} Chip8Host;
+
+typedef struct {
+    Chip8Profile profile;
+    uint64_t seed;
+    int instr_per_frame;
+    /* Execute common instruction sequences with a single dispatch */
+    bool fuse;
+} Chip8InstanceConfig;
+
+void c8_instance_default_config(Chip8InstanceConfig *config);
+Chip8Instance *c8_instance_create(const Chip8Host *host, const Chip8InstanceConfig *config);
+void c8_instance_destroy(Chip8Instance *instance);
+bool c8_instance_configure(Chip8Instance *instance, const Chip8InstanceConfig *config);
+bool c8_instance_load(Chip8Instance *instance, const uint8_t *rom, size_t rom_size);
+void c8_instance_reset(Chip8Instance *instance);
+void c8_instance_warm_fusion(Chip8Instance *instance, const uint8_t *kinds, size_t length);
+uint64_t c8_instance_run(Chip8Instance *instance, uint64_t cycles);
+const Chip8 *c8_instance_state(const Chip8Instance *instance);
+
+#endif
@@ -26,35 +26,89 @@
 #define C8_SAMPLE_FRAMES_FREQUENCY 44100
 #define C8_AUDIO_FREQUENCY 880
 #define C8_PI 3.14159265358979323846
+#define C8_AUDIO_PATTERN_BASE_RATE 4000.0
+#define C8_AUDIO_PATTERN_BITS (C8_AUDIO_PATTERN_SIZE * 8)
 
-static void io_wait_for_keypress(Chip8 *chip8, int *quit);
-static int io_chip8_key_index(uint8_t keyboard_key);
+static SDL_Scancode io_char_scancode(char key);
 static void io_audio_callback(void *user_data, uint8_t *audio_stream, int length);
 static void io_update_audio_state(Chip8IO *io, uint8_t sound_timer);
-
-static const SDL_Scancode io_keyboard_keys[C8_KEY_NUM] = {
-    SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3, SDL_SCANCODE_4,
-    SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_R,
-    SDL_SCANCODE_A, SDL_SCANCODE_S, SDL_SCANCODE_D, SDL_SCANCODE_F,
-    SDL_SCANCODE_Z, SDL_SCANCODE_X, SDL_SCANCODE_C, SDL_SCANCODE_V
-};
-
+static void io_update_audio_pattern(Chip8IO *io, const Chip8 *chip8);
+static void io_tick_timers(Chip8IO *io, Chip8 *chip8);
+static bool io_rom_uses_sound(const Chip8 *chip8);
+static void io_start_audio(Chip8IO *io);
+static int io_open_audio(void *data);
+static uint64_t io_startup_phase(Chip8IO *io, Chip8StartupPhase phase, uint64_t start);
+static void io_report_startup(Chip8IO *io);
+
+/* Audio and window creation are independent, so when the ROM will need
+ * audio the device is opened in the background while the window is made */
 int io_init(Chip8IO *io, Chip8 *chip8, const Chip8Option *opt)
 {
-	if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER | SDL_INIT_AUDIO) < 0) {
+    uint64_t start = SDL_GetPerformanceCounter();
+
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER) < 0) {
         C8_LOG_ERROR("Unable to init SDL %s", SDL_GetError());
         return 0;
     }
 
     memset(io, 0, sizeof(Chip8IO));
 
+    io->startup_times = opt->startup_times;
+    io->startup_start = start;
+    start = io_startup_phase(io, C8_STARTUP_SDL_INIT, start);
+
     io->timer_args = (Chip8TimerArgs) {
         .chip8 = chip8,
         .io = io
     };
 
+    if (!io_parse_keymap(opt->keymap, io->keymap)) {
+        C8_LOG_ERROR("Invalid keymap %s", opt->keymap);
+        io_free(io);
+        return 0;
+    }
+
+    c8_key_queue_init(&io->key_queue);
+
     io->scale_factor = opt->scale_factor;
     io->instr_per_sec = opt->instr_per_sec;
+    io->instr_per_sec_max = opt->instr_per_sec;
+    io->turbo = opt->turbo;
+    io->turbo_always = opt->turbo;
+    io->frame_skip = opt->frame_skip;
+    io->calibrate = opt->calibrate;
+
+    io->timer_lock = SDL_CreateSemaphore(1);
+
+    if (io->timer_lock == NULL) {
+        C8_LOG_ERROR("Unable to create semaphore %s", SDL_GetError());
+        io_free(io);
+        return 0;
+    }
+
+    io->timer_tick = SDL_CreateSemaphore(0);
+
+    if (io->timer_tick == NULL) {
+        C8_LOG_ERROR("Unable to create semaphore %s", SDL_GetError());
+        io_free(io);
+        return 0;
+    }
+
+    io->delay_sound_timer = SDL_AddTimer(C8_CYCLE_TIME_MS, io_update_delay_sound_timers, &io->timer_args);
+
+    if (io->delay_sound_timer == 0) {
+        C8_LOG_ERROR("Unable to create timer %s", SDL_GetError());
+        io_free(io);
+        return 0;
+    }
+
+    start = io_startup_phase(io, C8_STARTUP_TIMERS, start);
+
+    /* Initialising audio counts towards the audio time, not the window's */
+    if (io_rom_uses_sound(chip8)) {
+        io_start_audio(io);
+        start = SDL_GetPerformanceCounter();
+    }
 
     uint16_t pixel_width = chip8->display_width * opt->scale_factor;
     uint16_t pixel_height = chip8->display_height * opt->scale_factor;
@@ -69,6 +123,7 @@ int io_init(Chip8IO *io, Chip8 *chip8, const Chip8Option *opt)
         return 0;
     }
 
+    start = io_startup_phase(io, C8_STARTUP_WINDOW, start);
     io->renderer = SDL_CreateRenderer(io->window, -1, SDL_RENDERER_ACCELERATED);
 
     if (io->renderer == NULL) {
@@ -77,48 +132,35 @@ int io_init(Chip8IO *io, Chip8 *chip8, const Chip8Option *opt)
         return 0;
     }
 
-    io->texture = SDL_CreateTexture(io->renderer, SDL_PIXELFORMAT_ARGB8888,
-                                    SDL_TEXTUREACCESS_STATIC, chip8->display_width,
-                                    chip8->display_height);
+    start = io_startup_phase(io, C8_STARTUP_RENDERER, start);
 
-    if (io->texture == NULL) {
-        C8_LOG_ERROR("Unable to create texture %s", SDL_GetError());
+    if (!c8_scaler_init(&io->scaler, opt->scale_filter, opt->scale_factor,
+                        C8_DISPLAY_MAX_WIDTH, C8_DISPLAY_MAX_HEIGHT)) {
+        C8_LOG_ERROR("Unable to allocate memory for %s scaling",
+                     c8_scale_filter_name(opt->scale_filter));
         io_free(io);
         return 0;
     }
 
-    io->delay_sound_timer = SDL_AddTimer(C8_CYCLE_TIME_MS, io_update_delay_sound_timers, &io->timer_args);
-
-    if (io->delay_sound_timer == 0) {
-        C8_LOG_ERROR("Unable to create timer %s", SDL_GetError());
-        io_free(io);
-        return 0;
+    /* When scaling on the CPU the texture is the size of the window
+     * and is written to directly, otherwise SDL scales it */
+    if (opt->scale_filter == C8_SCALE_SDL) {
+        io->texture = SDL_CreateTexture(io->renderer, SDL_PIXELFORMAT_ARGB8888,
+                                        SDL_TEXTUREACCESS_STATIC, chip8->display_width,
+                                        chip8->display_height);
+    } else {
+        io->texture = SDL_CreateTexture(io->renderer, SDL_PIXELFORMAT_ARGB8888,
+                                        SDL_TEXTUREACCESS_STREAMING, pixel_width,
+                                        pixel_height);
     }
 
-    io->timer_lock = SDL_CreateSemaphore(1);
-
-    if (io->timer_lock == NULL) {
-        C8_LOG_ERROR("Unable to create semaphore %s", SDL_GetError());
+    if (io->texture == NULL) {
+        C8_LOG_ERROR("Unable to create texture %s", SDL_GetError());
         io_free(io);
         return 0;
     }
 
-    SDL_AudioSpec audio_want, audio_have;
-
-    SDL_zero(audio_want);
-    audio_want.freq = C8_SAMPLE_FRAMES_FREQUENCY;
-    audio_want.format = AUDIO_S16SYS;
-    audio_want.channels = 1;
-    audio_want.samples = 2048;
-    audio_want.callback = io_audio_callback;
-
-    io->audio_dev = SDL_OpenAudioDevice(NULL, 0, &audio_want, &audio_have, SDL_AUDIO_ALLOW_FORMAT_CHANGE);
-
-    if (io->audio_dev == 0) {
-        C8_LOG_ERROR("Unable to open audio: %s\n", SDL_GetError());
-        io_free(io);
-        return 0;
-    }
+    io_startup_phase(io, C8_STARTUP_TEXTURE, start);
 
     size_t pixel_bytes = sizeof(uint32_t) * chip8->display_width * chip8->display_height;
     io->pixels = malloc(pixel_bytes);
@@ -131,8 +173,27 @@ int io_init(Chip8IO *io, Chip8 *chip8, const Chip8Option *opt)
 
     memset(io->pixels, 0, pixel_bytes);
 
+    if (opt->record_file_path != NULL) {
+        io->recorder = malloc(sizeof(Chip8Recorder));
+
+        if (io->recorder == NULL) {
+            C8_LOG_ERROR("Unable to allocate %zu bytes for recorder", sizeof(Chip8Recorder));
+            io_free(io);
+            return 0;
+        }
+
+        if (!c8_record_init(io->recorder, opt->record_file_path)) {
+            free(io->recorder);
+            io->recorder = NULL;
+            io_free(io);
+            return 0;
+        }
+    }
+
     io->draw_rect.w = chip8->display_width * opt->scale_factor;
     io->draw_rect.h = chip8->display_height * opt->scale_factor;
+    io_reset_instruction_timer(io);
+    io->calibrate_start = SDL_GetPerformanceCounter();
 
     return 1;
 }
@@ -143,7 +204,18 @@ void io_free(Chip8IO *io)
         return;
     }
 
+    /* The audio thread uses the timer lock, so must finish first */
+    if (io->audio_thread != NULL) {
+        SDL_WaitThread(io->audio_thread, NULL);
+    }
+
     free(io->pixels);
+    c8_scaler_free(&io->scaler);
+
+    if (io->recorder != NULL) {
+        c8_record_free(io->recorder);
+        free(io->recorder);
+    }
 
     if (io->texture != NULL) {
         SDL_DestroyTexture(io->texture);
@@ -165,6 +237,10 @@ void io_free(Chip8IO *io)
         SDL_DestroySemaphore(io->timer_lock);
     }
 
+    if (io->timer_tick != NULL) {
+        SDL_DestroySemaphore(io->timer_tick);
+    }
+
     if (io->audio_dev != 0) {
         SDL_CloseAudioDevice(io->audio_dev);
     }
@@ -176,104 +252,208 @@ uint32_t io_update_delay_sound_timers(uint32_t interval, void *param)
 {
     Chip8TimerArgs *timer_args = param;
     io_lock_timer(timer_args->io);
-    c8_update_timers(timer_args->chip8);
-    uint8_t sound_timer = timer_args->chip8->register_sound_timer;
+
+    /* In turbo mode the main thread ticks the timers instead */
+    if (!timer_args->io->turbo) {
+        io_tick_timers(timer_args->io, timer_args->chip8);
+    }
+
     io_unlock_timer(timer_args->io);
-    io_update_audio_state(timer_args->io, sound_timer);
+    SDL_SemPost(timer_args->io->timer_tick);
     return interval;
 }
 
+/* Called with the timer lock held */
+static void io_tick_timers(Chip8IO *io, Chip8 *chip8)
+{
+    c8_update_timers(chip8);
+
+    if (chip8->update_audio) {
+        io_update_audio_pattern(io, chip8);
+        chip8->update_audio = false;
+    }
+
+    SDL_AtomicAdd(&io->timer_ticks, 1);
+    io_update_audio_state(io, chip8->register_sound_timer);
+}
+
 void io_update_display(Chip8IO *io, Chip8 *chip8)
 {
     if (!chip8->update_display) {
         return;
     }
 
-    for (int k = 0; k < (chip8->display_width * chip8->display_height); k++) {
-        io->pixels[k] = chip8->display[k] ? 0x00FFFFFF : 0;
+    c8_display_to_rgb(chip8, io->pixels);
+
+    if (io->scaler.filter == C8_SCALE_SDL) {
+        SDL_UpdateTexture(io->texture, NULL, io->pixels, chip8->display_width * sizeof(uint32_t));
+    } else {
+        void *texture_pixels;
+        int pitch;
+
+        if (SDL_LockTexture(io->texture, NULL, &texture_pixels, &pitch) == 0) {
+            c8_scaler_run(&io->scaler, io->pixels, chip8->display_width, chip8->display_height,
+                          texture_pixels, pitch / sizeof(uint32_t));
+            SDL_UnlockTexture(io->texture);
+        }
     }
 
-    SDL_UpdateTexture(io->texture, NULL, io->pixels, chip8->display_width * sizeof(uint32_t));
     SDL_RenderClear(io->renderer);
     SDL_RenderCopy(io->renderer, io->texture, NULL, &io->draw_rect);
     SDL_RenderPresent(io->renderer);
 
+    if (io->startup_times && io->startup_ms[C8_STARTUP_FIRST_FRAME] == 0) {
+        io_report_startup(io);
+    }
+
+    if (io->recorder != NULL) {
+        c8_record_frame(io->recorder, chip8, io_timer_ticks(io));
+    }
+
     chip8->update_display = false;
 }
 
-void io_update_key_states(Chip8 *chip8, int *quit)
+/* keys contains one character, a-z or 0-9, for each CHIP-8 key 0-F in turn.
+ * The keymap is filled so any scancode can be translated with one lookup. */
+bool io_parse_keymap(const char *keys, uint8_t keymap[SDL_NUM_SCANCODES])
 {
-    SDL_Event event;
-
-    if (chip8->wait_key_V_reg != -1) {
-        io_wait_for_keypress(chip8, quit);
+    if (strlen(keys) != C8_KEY_NUM) {
+        return false;
     }
 
-    while (SDL_PollEvent(&event) != 0) {
-        if (event.type == SDL_QUIT) {
-            *quit = 1;
-            return;
+    memset(keymap, C8_KEY_UNMAPPED, SDL_NUM_SCANCODES);
+
+    for (int k = 0; k < C8_KEY_NUM; k++) {
+        SDL_Scancode scancode = io_char_scancode(keys[k]);
+
+        if (scancode == SDL_SCANCODE_UNKNOWN) {
+            return false;
         }
+
+        keymap[scancode] = k;
     }
 
-    const uint8_t *key_states = SDL_GetKeyboardState(NULL);
+    return true;
+}
 
-    for (int k = 0; k < C8_KEY_NUM; k++) {
-        chip8->input_keys[k] = key_states[io_keyboard_keys[k]];
+static SDL_Scancode io_char_scancode(char key)
+{
+    if (key >= 'a' && key <= 'z') {
+        return SDL_SCANCODE_A + (key - 'a');
+    } else if (key >= '1' && key <= '9') {
+        return SDL_SCANCODE_1 + (key - '1');
+    } else if (key == '0') {
+        return SDL_SCANCODE_0;
     }
+
+    return SDL_SCANCODE_UNKNOWN;
 }
 
-static void io_wait_for_keypress(Chip8 *chip8, int *quit)
+/* Queue key changes timestamped with the current cycle count,
+ * so they take effect before the next instruction executes */
+void io_poll_events(Chip8IO *io, const Chip8 *chip8, int *quit)
 {
     SDL_Event event;
 
-    while (SDL_WaitEvent(&event) != 0) {
+    while (SDL_PollEvent(&event) != 0) {
         if (event.type == SDL_QUIT) {
             *quit = 1;
             return;
-        } else if (event.type == SDL_KEYDOWN) {
-            int key_index = io_chip8_key_index(event.key.keysym.scancode);
+        } else if ((event.type != SDL_KEYDOWN && event.type != SDL_KEYUP) ||
+                   event.key.repeat) {
+            continue;
+        }
 
-            if (key_index != -1) {
-                chip8->register_V[chip8->wait_key_V_reg] = key_index;
-                chip8->wait_key_V_reg = -1;
-                return;
-            }
+        /* Tab fast-forwards while held */
+        if (event.key.keysym.scancode == SDL_SCANCODE_TAB) {
+            io->fast_forward_held = event.type == SDL_KEYDOWN;
+            continue;
         }
-    }
-}
 
-static int io_chip8_key_index(uint8_t keyboard_key)
-{
-    for (int k = 0; k < C8_KEY_NUM; k++) {
-        if (keyboard_key == io_keyboard_keys[k]) {
-            return k;
+        uint8_t key = io->keymap[event.key.keysym.scancode];
+
+        if (key == C8_KEY_UNMAPPED) {
+            continue;
+        }
+
+        Chip8KeyEvent key_event = {
+            .cycle = chip8->cycles,
+            .key = key,
+            .pressed = event.type == SDL_KEYDOWN
+        };
+
+        if (!c8_key_queue_push(&io->key_queue, &key_event)) {
+            C8_LOG_ERROR("Key queue full, dropping event for key %X", key);
         }
     }
 
-    return -1;
+    bool turbo = io->turbo_always || io->fast_forward_held;
+
+    if (turbo != io->turbo) {
+        io_set_turbo(io, turbo);
+    }
+
+    /* Set by the timer thread the first time a sound is played */
+    io_lock_timer(io);
+    bool start_audio = io->audio_wanted && io->audio_thread == NULL;
+    io_unlock_timer(io);
+
+    if (start_audio) {
+        io_start_audio(io);
+    }
 }
 
 void io_reset_instruction_timer(Chip8IO *io)
 {
-    io->instruction_timer = SDL_GetTicks();
+    io->instruction_timer = SDL_GetPerformanceCounter();
+    io->paced_cycles = 0;
 }
 
-void io_cycle_time_limit(const Chip8IO *io)
+/* Sleep until the time allotted to every instruction executed since the
+ * instruction timer was reset has passed. Sleeps are whole milliseconds,
+ * so any part of one left over is slept off on a later call. When more
+ * than a frame behind, pacing starts again from now rather than
+ * running a burst of instructions to catch up. */
+void io_cycle_time_limit(Chip8IO *io, int executed)
 {
-    uint32_t current_time = SDL_GetTicks();
-    uint32_t cycle_time = 1000 / io->instr_per_sec;
-    uint32_t sleep_time = 0;
+    uint64_t frequency = SDL_GetPerformanceFrequency();
+
+    io->paced_cycles += executed;
 
-    if (current_time - io->instruction_timer < cycle_time) {
-        sleep_time = cycle_time - (current_time - io->instruction_timer); 
+    if (io->paced_cycles >= (uint64_t)io->instr_per_sec) {
+        io->paced_cycles -= io->instr_per_sec;
+        io->instruction_timer += frequency;
     }
 
+    uint64_t deadline = io->instruction_timer + io->paced_cycles * frequency / io->instr_per_sec;
+    uint64_t now = SDL_GetPerformanceCounter();
+
+    if (now > deadline) {
+        if (now - deadline > frequency / C8_TIMER_FREQ_HZ) {
+            io_reset_instruction_timer(io);
+        }
+
+        return;
+    }
+
+    uint32_t sleep_time = (uint32_t)((deadline - now) * 1000 / frequency);
+
     if (sleep_time > 0) {
         SDL_Delay(sleep_time);
+        io->calibrate_slept += SDL_GetPerformanceCounter() - now;
     }
 }
 
+/* Sleep until an event arrives or a frame has passed. The event
+ * is left in the queue for io_poll_events to handle. */
+void io_wait_for_input(Chip8IO *io)
+{
+    uint64_t start = SDL_GetPerformanceCounter();
+    SDL_WaitEventTimeout(NULL, (int)C8_CYCLE_TIME_MS);
+    io->calibrate_slept += SDL_GetPerformanceCounter() - start;
+    io_reset_instruction_timer(io);
+}
+
 void io_lock_timer(Chip8IO *io)
 {
     SDL_SemWait(io->timer_lock);
@@ -284,23 +464,137 @@ void io_unlock_timer(Chip8IO *io)
     SDL_SemPost(io->timer_lock);
 }
 
+uint32_t io_timer_ticks(Chip8IO *io)
+{
+    return SDL_AtomicGet(&io->timer_ticks);
+}
+
+/* Sleep until the timer thread has run since ticks was read.
+ * Surplus posts to timer_tick only cause a spurious wake up. */
+void io_wait_for_timer_tick(Chip8IO *io, uint32_t ticks)
+{
+    uint64_t start = SDL_GetPerformanceCounter();
+
+    while (io_timer_ticks(io) == ticks) {
+        SDL_SemWaitTimeout(io->timer_tick, (uint32_t)C8_CYCLE_TIME_MS + 1);
+    }
+
+    io->calibrate_slept += SDL_GetPerformanceCounter() - start;
+    io_reset_instruction_timer(io);
+}
+
+void io_set_turbo(Chip8IO *io, bool turbo)
+{
+    io_lock_timer(io);
+    io->turbo = turbo;
+    io->turbo_cycles = 0;
+    io_unlock_timer(io);
+
+    /* Time spent in turbo mode says nothing about the rate to run at */
+    io_reset_instruction_timer(io);
+    io->calibrate_start = SDL_GetPerformanceCounter();
+    io->calibrate_slept = 0;
+    io->calibrate_cycles = 0;
+}
+
+/* Counts instructions executed in turbo mode and returns true at the end
+ * of each emulated frame, or straight away when end_frame is set because
+ * nothing more can happen this frame. The timers are ticked at the end of
+ * every frame, and the display presented at the end of every frame_skip. */
+bool io_turbo_advance(Chip8IO *io, Chip8 *chip8, int executed, bool end_frame)
+{
+    io->turbo_cycles += executed;
+
+    if (!end_frame && (int64_t)io->turbo_cycles * C8_TIMER_FREQ_HZ < io->instr_per_sec) {
+        return false;
+    }
+
+    io->turbo_cycles = 0;
+
+    io_lock_timer(io);
+    io_tick_timers(io, chip8);
+    io_unlock_timer(io);
+
+    if (++io->turbo_frames % io->frame_skip == 0) {
+        io_update_display(io, chip8);
+    }
+
+    return true;
+}
+
+/* Once a second, caps instr_per_sec at 90% of the rate instructions were
+ * executed at while not sleeping, so that on a loaded host the rate asked
+ * for is one which can be kept up along with rendering and audio */
+void io_calibrate(Chip8IO *io, int executed)
+{
+    io->calibrate_cycles += executed;
+
+    uint64_t frequency = SDL_GetPerformanceFrequency();
+    uint64_t elapsed = SDL_GetPerformanceCounter() - io->calibrate_start;
+
+    if (elapsed < frequency) {
+        return;
+    }
+
+    uint64_t busy = elapsed > io->calibrate_slept ? elapsed - io->calibrate_slept : 0;
+
+    /* Too little work was done to say anything about the host */
+    if (busy >= frequency / 20 && io->calibrate_cycles > 0) {
+        uint64_t sustainable = (uint64_t)((double)io->calibrate_cycles * frequency / busy * 0.9);
+        int instr_per_sec = MAX(1, (int)MIN(sustainable, (uint64_t)io->instr_per_sec_max));
+
+        if (instr_per_sec < (int64_t)io->instr_per_sec * 19 / 20) {
+            fprintf(stderr, "Instruction rate calibrated to %d per second\n", instr_per_sec);
+        }
+
+        if (instr_per_sec != io->instr_per_sec) {
+            io->instr_per_sec = instr_per_sec;
+            io_reset_instruction_timer(io);
+        }
+    }
+
+    io->calibrate_start += elapsed;
+    io->calibrate_slept = 0;
+    io->calibrate_cycles = 0;
+}
+
 static void io_audio_callback(void *user_data, uint8_t *audio_stream, int length)
 {
-    (void)user_data;
+    Chip8IO *io = user_data;
     static double v = 0;
     int16_t *stream = (int16_t *)audio_stream;
     length /= 2;
 
+    if (io->audio_pattern_set) {
+        double step = io->audio_pattern_rate / C8_SAMPLE_FRAMES_FREQUENCY;
+
+        for (int k = 0; k < length; k++) {
+            int bit = (int)io->audio_pattern_position;
+            bool high = io->audio_pattern[bit / 8] & (0x80 >> (bit % 8));
+            stream[k] = high ? C8_AUDIO_AMPLITUDE : -C8_AUDIO_AMPLITUDE;
+            io->audio_pattern_position += step;
+
+            if (io->audio_pattern_position >= C8_AUDIO_PATTERN_BITS) {
+                io->audio_pattern_position -= C8_AUDIO_PATTERN_BITS;
+            }
+        }
+
+        return;
+    }
+
     for (int k = 0; k < length; k++) {
         stream[k] = C8_AUDIO_AMPLITUDE * sin(v * 2 * C8_PI / C8_SAMPLE_FRAMES_FREQUENCY);
         v += C8_AUDIO_FREQUENCY;
     }
 }
 
+/* Called with the timer lock held */
 static void io_update_audio_state(Chip8IO *io, uint8_t sound_timer)
 {
     if (sound_timer > 0) {
-        if (!io->audio_playing) {
+        if (io->audio_dev == 0) {
+            io->audio_wanted = !io->audio_failed;
+        } else if (!io->audio_playing) {
             SDL_PauseAudioDevice(io->audio_dev, 0);
             io->audio_playing = true;
         }
@@ -309,3 +603,137 @@ static void io_update_audio_state(Chip8IO *io, uint8_t sound_timer)
         io->audio_playing = false;
     }
 }
+
+/* Called with the timer lock held. The pattern is kept before the
+ * device is open, so it is ready once it is. */
+static void io_update_audio_pattern(Chip8IO *io, const Chip8 *chip8)
+{
+    if (io->audio_dev != 0) {
+        SDL_LockAudioDevice(io->audio_dev);
+    }
+
+    memcpy(io->audio_pattern, chip8->audio_pattern, sizeof(io->audio_pattern));
+    io->audio_pattern_rate = C8_AUDIO_PATTERN_BASE_RATE *
+                             pow(2.0, (chip8->audio_pitch - 64) / 48.0);
+    io->audio_pattern_set = chip8->audio_pattern_set;
+
+    if (io->audio_dev != 0) {
+        SDL_UnlockAudioDevice(io->audio_dev);
+    }
+}
+
+/* Whether the ROM contains an Fx18 instruction. Data which happens to
+ * look like one counts too, which only means audio is opened early. */
+static bool io_rom_uses_sound(const Chip8 *chip8)
+{
+    for (size_t k = C8_PROGRAM_MEMORY_START; k + 1 < C8_MEMORY_SIZE; k++) {
+        if ((chip8->memory[k] & 0xF0) == 0xF0 && chip8->memory[k + 1] == 0x18) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* SDL subsystems must be initialised on the main thread, so only opening
+ * the device, which is what takes the time, is left to audio_thread */
+static void io_start_audio(Chip8IO *io)
+{
+    io->audio_start = SDL_GetPerformanceCounter();
+
+    if (SDL_InitSubSystem(SDL_INIT_AUDIO) < 0) {
+        C8_LOG_ERROR("Unable to init audio %s", SDL_GetError());
+    } else {
+        io->audio_thread = SDL_CreateThread(io_open_audio, "chip8-audio", io);
+
+        if (io->audio_thread != NULL) {
+            return;
+        }
+
+        C8_LOG_ERROR("Unable to create audio thread %s", SDL_GetError());
+    }
+
+    io_lock_timer(io);
+    io->audio_failed = true;
+    io->audio_wanted = false;
+    io_unlock_timer(io);
+}
+
+/* Runs on audio_thread. Failing to open audio isn't fatal, the ROM
+ * just runs without sound. */
+static int io_open_audio(void *data)
+{
+    Chip8IO *io = data;
+    SDL_AudioSpec audio_want, audio_have;
+
+    SDL_zero(audio_want);
+    audio_want.freq = C8_SAMPLE_FRAMES_FREQUENCY;
+    audio_want.format = AUDIO_S16SYS;
+    audio_want.channels = 1;
+    audio_want.samples = 2048;
+    audio_want.callback = io_audio_callback;
+    audio_want.userdata = io;
+
+    SDL_AudioDeviceID audio_dev = SDL_OpenAudioDevice(NULL, 0, &audio_want, &audio_have,
+                                                      SDL_AUDIO_ALLOW_FORMAT_CHANGE);
+
+    if (audio_dev == 0) {
+        C8_LOG_ERROR("Unable to open audio: %s", SDL_GetError());
+    }
+
+    /* The next timer tick starts the device if the sound timer is set */
+    io_lock_timer(io);
+    io->audio_dev = audio_dev;
+    io->audio_failed = audio_dev == 0;
+    io->audio_wanted = false;
+    io_startup_phase(io, C8_STARTUP_AUDIO, io->audio_start);
+    io_unlock_timer(io);
+
+    return 0;
+}
+
+/* Records the time since start taken by phase, returning the current
+ * time so the next phase can be timed from it */
+static uint64_t io_startup_phase(Chip8IO *io, Chip8StartupPhase phase, uint64_t start)
+{
+    uint64_t now = SDL_GetPerformanceCounter();
+
+    io->startup_ms[phase] = (now - start) * 1000.0 / SDL_GetPerformanceFrequency();
+
+    return now;
+}
+
+static void io_report_startup(Chip8IO *io)
+{
+    static const char *phase_names[C8_STARTUP_NUM] = {
+        [C8_STARTUP_SDL_INIT] = "SDL init",
+        [C8_STARTUP_TIMERS] = "timers",
+        [C8_STARTUP_WINDOW] = "window",
+        [C8_STARTUP_RENDERER] = "renderer",
+        [C8_STARTUP_TEXTURE] = "texture",
+        [C8_STARTUP_AUDIO] = "audio (background)",
+        [C8_STARTUP_FIRST_FRAME] = "first frame"
+    };
+
+    io_startup_phase(io, C8_STARTUP_FIRST_FRAME, io->startup_start);
+
+    /* Audio times are written by the audio thread */
+    io_lock_timer(io);
+    bool audio_open = io->audio_dev != 0;
+    bool audio_failed = io->audio_failed;
+    double audio_ms = io->startup_ms[C8_STARTUP_AUDIO];
+    io_unlock_timer(io);
+
+    fprintf(stderr, "Startup times (ms):\n");
+
+    for (int k = 0; k < C8_STARTUP_NUM; k++) {
+        if (k != C8_STARTUP_AUDIO) {
+            fprintf(stderr, "  %-20s %8.2f\n", phase_names[k], io->startup_ms[k]);
+        } else if (audio_open) {
+            fprintf(stderr, "  %-20s %8.2f\n", phase_names[k], audio_ms);
+        } else {
+            fprintf(stderr, "  %-20s %8s\n", phase_names[k],
+                    audio_failed ? "failed" : io->audio_thread != NULL ? "opening" : "unused");
+        }
+    }
+}
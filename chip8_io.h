@@ -23,10 +23,29 @@
 #include <SDL2/SDL_audio.h>
 #include "chip8.h"
 #include "chip8_core.h"
+#include "chip8_input.h"
+#include "chip8_record.h"
+#include "chip8_scale.h"
+
+/* Default keyboard layout, see io_parse_keymap */
+#define C8_KEYMAP_DEFAULT "1234qwerasdfzxcv"
+#define C8_KEY_UNMAPPED 0xFF
 
 struct Chip8IO;
 typedef struct Chip8IO Chip8IO;
 
+/* Parts of starting up timed for --startup-times */
+typedef enum {
+    C8_STARTUP_SDL_INIT,
+    C8_STARTUP_TIMERS,
+    C8_STARTUP_WINDOW,
+    C8_STARTUP_RENDERER,
+    C8_STARTUP_TEXTURE,
+    C8_STARTUP_AUDIO,
+    C8_STARTUP_FIRST_FRAME,
+    C8_STARTUP_NUM
+} Chip8StartupPhase;
+
 /* Sound and delay timers are updated in a separate timer thread.
  * This struct is passed as an argument to the timer function. */
 typedef struct {
@@ -40,32 +59,99 @@ struct Chip8IO {
     SDL_Texture *texture;
     /* Used to scale display by scale_factor */
     SDL_Rect draw_rect;
+    Chip8Scaler scaler;
     SDL_TimerID delay_sound_timer;
     /* Binary semaphore used to control access to
      * the display and sound timers, which are accessed
      * from both the main and timer threads. */
     SDL_sem *timer_lock; 
+    /* Posted by the timer thread after every update so the
+     * main thread can sleep through idle loops */
+    SDL_sem *timer_tick;
+    SDL_atomic_t timer_ticks;
+    /* Audio is only initialised when the ROM can make a sound. It is
+     * opened on audio_thread during io_init when the ROM contains Fx18,
+     * otherwise once the sound timer is first set, which sets
+     * audio_wanted. audio_dev is only changed with the timer lock held,
+     * and is 0 until the device is open. The audio subsystem itself is
+     * initialised on the main thread first, at audio_start. */
     SDL_AudioDeviceID audio_dev;
+    SDL_Thread *audio_thread;
+    uint64_t audio_start;
+    bool audio_wanted;
+    bool audio_failed;
     /* The display is converted into pixel representation
      * which is used to update the display */
     uint32_t *pixels;
     uint16_t win_width;
     uint16_t win_height;
     uint8_t scale_factor;
-    uint32_t instruction_timer;
-    uint16_t instr_per_sec;
+    /* Instructions are paced against the performance counter, timing
+     * paced_cycles from instruction_timer, so that the sub-millisecond
+     * time each instruction is allotted adds up rather than being
+     * rounded for every one. Each second paced moves instruction_timer
+     * on and takes instr_per_sec from paced_cycles. */
+    uint64_t instruction_timer;
+    uint64_t paced_cycles;
+    int instr_per_sec;
     Chip8TimerArgs timer_args;
+    /* Maps each scancode directly to a CHIP-8 key or C8_KEY_UNMAPPED */
+    uint8_t keymap[SDL_NUM_SCANCODES];
+    /* Key events are collected once per frame and applied
+     * by the main loop at instruction boundaries */
+    Chip8KeyQueue key_queue;
+    /* Non NULL when presented frames are being recorded */
+    Chip8Recorder *recorder;
     bool audio_playing;
+    /* Copy of the XO-CHIP audio pattern state used by the audio
+     * callback. Only accessed while the audio device is locked. */
+    uint8_t audio_pattern[C8_AUDIO_PATTERN_SIZE];
+    double audio_pattern_rate;
+    double audio_pattern_position;
+    bool audio_pattern_set;
+    /* In turbo mode instructions run as fast as possible. The main thread
+     * ticks the timers every instr_per_sec / 60 instructions, keeping them
+     * in step with emulated time, and presents every frame_skip frames.
+     * turbo is only changed with the timer lock held, as the timer thread
+     * checks it to leave the timers alone. */
+    bool turbo;
+    bool turbo_always;
+    bool fast_forward_held;
+    int frame_skip;
+    int turbo_cycles;
+    uint32_t turbo_frames;
+    /* When calibrating, instr_per_sec is capped at the rate the host has
+     * managed over the last second, and never raised above the rate asked
+     * for. Instructions and time slept, in performance counter ticks,
+     * are counted over each second. */
+    bool calibrate;
+    int instr_per_sec_max;
+    uint64_t calibrate_start;
+    uint64_t calibrate_slept;
+    uint64_t calibrate_cycles;
+    /* Milliseconds taken by each part of starting up, the first frame
+     * being timed from the start of io_init. Printed once the first
+     * frame has been presented when startup_times is set. */
+    bool startup_times;
+    uint64_t startup_start;
+    double startup_ms[C8_STARTUP_NUM];
 };
 
 int io_init(Chip8IO *io, Chip8 *chip8, const Chip8Option *opt);
 void io_free(Chip8IO *io);
 uint32_t io_update_delay_sound_timers(uint32_t interval, void *param);
 void io_update_display(Chip8IO *io, Chip8 *chip8);
-void io_update_key_states(Chip8 *chip8, int *quit);
+bool io_parse_keymap(const char *keys, uint8_t keymap[SDL_NUM_SCANCODES]);
+void io_poll_events(Chip8IO *io, const Chip8 *chip8, int *quit);
 void io_reset_instruction_timer(Chip8IO *io);
-void io_cycle_time_limit(const Chip8IO *io);
+void io_cycle_time_limit(Chip8IO *io, int executed);
+void io_wait_for_input(Chip8IO *io);
 void io_lock_timer(Chip8IO *io);
 void io_unlock_timer(Chip8IO *io);
+uint32_t io_timer_ticks(Chip8IO *io);
+void io_wait_for_timer_tick(Chip8IO *io, uint32_t ticks);
+void io_set_turbo(Chip8IO *io, bool turbo);
+bool io_turbo_advance(Chip8IO *io, Chip8 *chip8, int executed, bool end_frame);
+void io_calibrate(Chip8IO *io, int executed);
 
 #endif
@@ -0,0 +1,982 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <ctype.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "chip8.h"
+#include "chip8_library.h"
+
+#define C8_LIBRARY_LINE_MAX 512
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t num_roms;
+    uint32_t reserved;
+} Chip8ArchiveHeader;
+
+typedef struct {
+    uint64_t hash;
+    uint32_t data_offset;
+    uint32_t size;
+    uint32_t name_offset;
+    /* -1 when not set */
+    int32_t profile;
+    /* 0 when not set */
+    uint32_t instr_per_sec;
+    /* Not NUL terminated, all zero when not set */
+    char keymap[C8_KEY_NUM];
+} Chip8ArchiveEntry;
+
+/* Followed by the fusion kind of each byte of the ROM */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t hash;
+    uint32_t rom_size;
+    uint32_t flags;
+    uint32_t suggested_profile;
+    uint32_t reserved;
+} Chip8AnalysisHeader;
+
+static bool c8_library_open_directory(Chip8Library *, const char *);
+static bool c8_library_open_archive(Chip8Library *, const char *);
+static bool c8_library_map_file(const char *, const uint8_t **, size_t *);
+static bool c8_library_read_metadata(Chip8Library *, const char *);
+static bool c8_library_parse_setting(Chip8RomMetadata *, const char *);
+static bool c8_library_valid_keymap(const char *, size_t);
+static char *c8_library_join(const char *, const char *);
+static int c8_library_compare_roms(const void *, const void *);
+static const Chip8LibraryRom *c8_library_match(const Chip8Library *, const char *, bool);
+static uint32_t c8_library_scan(const uint8_t *, size_t);
+static bool c8_library_read_analysis(const char *, const Chip8LibraryRom *, Chip8RomAnalysis *);
+static bool c8_library_write_analysis(const char *, const Chip8RomAnalysis *);
+static bool c8_library_make_dirs(const char *);
+static char *c8_library_analysis_path(const char *, uint64_t);
+
+bool c8_library_open(Chip8Library *library, const char *path, const char *cache_dir)
+{
+    memset(library, 0, sizeof(Chip8Library));
+
+    if (cache_dir != NULL) {
+        library->cache_dir = strdup(cache_dir);
+
+        if (library->cache_dir == NULL) {
+            C8_LOG_ERROR("Unable to allocate %zu bytes for cache directory", strlen(cache_dir) + 1);
+            return false;
+        }
+    }
+
+    struct stat path_stat;
+
+    if (stat(path, &path_stat) != 0) {
+        fprintf(stderr, "Unable to open ROM library %s - %s\n", path, strerror(errno));
+        c8_library_close(library);
+        return false;
+    }
+
+    bool opened = S_ISDIR(path_stat.st_mode) ? c8_library_open_directory(library, path)
+                                             : c8_library_open_archive(library, path);
+
+    if (!opened) {
+        c8_library_close(library);
+        return false;
+    }
+
+    return true;
+}
+
+void c8_library_close(Chip8Library *library)
+{
+    if (library->archive != NULL) {
+        munmap(library->archive, library->archive_size);
+    } else {
+        for (size_t k = 0; k < library->num_roms; k++) {
+            munmap((void *)library->roms[k].data, library->roms[k].size);
+            free((char *)library->roms[k].name);
+        }
+    }
+
+    free(library->roms);
+    free(library->cache_dir);
+    memset(library, 0, sizeof(Chip8Library));
+}
+
+/* $XDG_CACHE_HOME/chip8, or ~/.cache/chip8 when that isn't set */
+bool c8_library_default_cache_dir(char *buffer, size_t buffer_size)
+{
+    const char *cache_home = getenv("XDG_CACHE_HOME");
+    int length;
+
+    if (cache_home != NULL && *cache_home != '\0') {
+        length = snprintf(buffer, buffer_size, "%s/chip8", cache_home);
+    } else {
+        const char *home = getenv("HOME");
+
+        if (home == NULL || *home == '\0') {
+            return false;
+        }
+
+        length = snprintf(buffer, buffer_size, "%s/.cache/chip8", home);
+    }
+
+    return length > 0 && (size_t)length < buffer_size;
+}
+
+static bool c8_library_open_directory(Chip8Library *library, const char *path)
+{
+    DIR *dir = opendir(path);
+
+    if (dir == NULL) {
+        fprintf(stderr, "Unable to open directory %s - %s\n", path, strerror(errno));
+        return false;
+    }
+
+    size_t capacity = 0;
+    struct dirent *dir_entry;
+    bool success = true;
+
+    while (success && (dir_entry = readdir(dir)) != NULL) {
+        if (dir_entry->d_name[0] == '.' ||
+            strcmp(dir_entry->d_name, C8_LIBRARY_METADATA_FILE) == 0) {
+            continue;
+        }
+
+        char *file_path = c8_library_join(path, dir_entry->d_name);
+        Chip8LibraryRom rom = { 0 };
+
+        if (file_path == NULL) {
+            success = false;
+            break;
+        } else if (!c8_library_map_file(file_path, &rom.data, &rom.size)) {
+            free(file_path);
+            continue;
+        }
+
+        free(file_path);
+        rom.hash = c8_hash(rom.data, rom.size, C8_LIBRARY_HASH_SEED);
+        rom.name = strdup(dir_entry->d_name);
+
+        if (library->num_roms == capacity) {
+            size_t new_capacity = capacity == 0 ? 64 : capacity * 2;
+            Chip8LibraryRom *roms = realloc(library->roms, new_capacity * sizeof(Chip8LibraryRom));
+
+            if (roms == NULL) {
+                C8_LOG_ERROR("Unable to allocate %zu bytes for ROM index",
+                             new_capacity * sizeof(Chip8LibraryRom));
+                success = false;
+            } else {
+                library->roms = roms;
+                capacity = new_capacity;
+            }
+        }
+
+        if (rom.name == NULL || !success) {
+            munmap((void *)rom.data, rom.size);
+            free((char *)rom.name);
+            success = false;
+            break;
+        }
+
+        library->roms[library->num_roms++] = rom;
+    }
+
+    closedir(dir);
+
+    if (!success) {
+        return false;
+    }
+
+    /* readdir order isn't defined, so sort by name too in order that the
+     * same copy of a ROM stored more than once is always kept */
+    qsort(library->roms, library->num_roms, sizeof(Chip8LibraryRom), c8_library_compare_roms);
+
+    size_t kept = 0;
+
+    for (size_t k = 0; k < library->num_roms; k++) {
+        if (kept > 0 && library->roms[kept - 1].hash == library->roms[k].hash) {
+            munmap((void *)library->roms[k].data, library->roms[k].size);
+            free((char *)library->roms[k].name);
+        } else {
+            library->roms[kept++] = library->roms[k];
+        }
+    }
+
+    library->num_roms = kept;
+
+    return c8_library_read_metadata(library, path);
+}
+
+/* Files which are empty or too large to be a ROM are skipped */
+static bool c8_library_map_file(const char *file_path, const uint8_t **data, size_t *size)
+{
+    int fd = open(file_path, O_RDONLY);
+
+    if (fd == -1) {
+        fprintf(stderr, "Unable to open file %s for reading - %s\n", file_path, strerror(errno));
+        return false;
+    }
+
+    struct stat file_stat;
+
+    if (fstat(fd, &file_stat) != 0 || !S_ISREG(file_stat.st_mode) ||
+        file_stat.st_size == 0 || file_stat.st_size > C8_PROGRAM_MEMORY_SIZE) {
+        close(fd);
+        return false;
+    }
+
+    void *mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Unable to map file %s - %s\n", file_path, strerror(errno));
+        return false;
+    }
+
+    *data = mapping;
+    *size = file_stat.st_size;
+
+    return true;
+}
+
+static bool c8_library_read_metadata(Chip8Library *library, const char *path)
+{
+    char *metadata_path = c8_library_join(path, C8_LIBRARY_METADATA_FILE);
+
+    if (metadata_path == NULL) {
+        return false;
+    }
+
+    FILE *metadata_file = fopen(metadata_path, "r");
+
+    if (metadata_file == NULL) {
+        bool missing = errno == ENOENT;
+
+        if (!missing) {
+            fprintf(stderr, "Unable to open file %s for reading - %s\n",
+                    metadata_path, strerror(errno));
+        }
+
+        free(metadata_path);
+        return missing;
+    }
+
+    char line[C8_LIBRARY_LINE_MAX];
+    int line_number = 0;
+    bool success = true;
+
+    while (success && fgets(line, sizeof(line), metadata_file) != NULL) {
+        line_number++;
+
+        char *comment = strchr(line, '#');
+
+        if (comment != NULL) {
+            *comment = '\0';
+        }
+
+        char *save_ptr;
+        char *token = strtok_r(line, " \t\r\n", &save_ptr);
+
+        if (token == NULL) {
+            continue;
+        }
+
+        char *end_ptr;
+        errno = 0;
+        uint64_t hash = strtoull(token, &end_ptr, 16);
+
+        if (errno != 0 || *end_ptr != '\0') {
+            fprintf(stderr, "%s:%d: Invalid ROM hash %s\n", metadata_path, line_number, token);
+            success = false;
+            break;
+        }
+
+        /* Settings for ROMs which aren't in the directory are ignored */
+        Chip8LibraryRom *rom = (Chip8LibraryRom *)c8_library_find(library, hash);
+        Chip8RomMetadata metadata = { 0 };
+
+        while ((token = strtok_r(NULL, " \t\r\n", &save_ptr)) != NULL) {
+            if (!c8_library_parse_setting(&metadata, token)) {
+                fprintf(stderr, "%s:%d: Invalid setting %s\n", metadata_path, line_number, token);
+                success = false;
+                break;
+            }
+        }
+
+        if (success && rom != NULL) {
+            rom->metadata = metadata;
+        }
+    }
+
+    if (ferror(metadata_file)) {
+        fprintf(stderr, "Error when reading file %s - %s\n", metadata_path, strerror(errno));
+        success = false;
+    }
+
+    fclose(metadata_file);
+    free(metadata_path);
+
+    return success;
+}
+
+static bool c8_library_parse_setting(Chip8RomMetadata *metadata, const char *setting)
+{
+    const char *value = strchr(setting, '=');
+
+    if (value == NULL) {
+        return false;
+    }
+
+    char name[16];
+    size_t name_length = value++ - setting;
+
+    if (name_length >= sizeof(name)) {
+        return false;
+    }
+
+    memcpy(name, setting, name_length);
+    name[name_length] = '\0';
+
+    if (strcmp(name, "profile") == 0) {
+        metadata->has_profile = c8_parse_profile(value, &metadata->profile);
+        return metadata->has_profile;
+    } else if (strcmp(name, "rate") == 0) {
+        char *end_ptr;
+        errno = 0;
+        long rate = strtol(value, &end_ptr, 10);
+
+        if (errno != 0 || *end_ptr != '\0' || rate < 1 || rate > INT32_MAX) {
+            return false;
+        }
+
+        metadata->instr_per_sec = rate;
+        return true;
+    } else if (strcmp(name, "keymap") == 0) {
+        if (!c8_library_valid_keymap(value, strlen(value))) {
+            return false;
+        }
+
+        memcpy(metadata->keymap, value, C8_KEY_NUM);
+        metadata->keymap[C8_KEY_NUM] = '\0';
+        return true;
+    }
+
+    return false;
+}
+
+/* The same characters the interpreter accepts for --keymap */
+static bool c8_library_valid_keymap(const char *keymap, size_t length)
+{
+    if (length != C8_KEY_NUM) {
+        return false;
+    }
+
+    for (size_t k = 0; k < length; k++) {
+        if (!((keymap[k] >= 'a' && keymap[k] <= 'z') || (keymap[k] >= '0' && keymap[k] <= '9'))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static bool c8_library_open_archive(Chip8Library *library, const char *path)
+{
+    int fd = open(path, O_RDONLY);
+
+    if (fd == -1) {
+        fprintf(stderr, "Unable to open file %s for reading - %s\n", path, strerror(errno));
+        return false;
+    }
+
+    struct stat file_stat;
+
+    if (fstat(fd, &file_stat) != 0) {
+        fprintf(stderr, "Unable to determine size of file %s - %s\n", path, strerror(errno));
+        close(fd);
+        return false;
+    } else if ((size_t)file_stat.st_size < sizeof(Chip8ArchiveHeader)) {
+        fprintf(stderr, "%s is not a ROM archive\n", path);
+        close(fd);
+        return false;
+    }
+
+    void *mapping = mmap(NULL, file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "Unable to map file %s - %s\n", path, strerror(errno));
+        return false;
+    }
+
+    library->archive = mapping;
+    library->archive_size = file_stat.st_size;
+
+    const uint8_t *archive = mapping;
+    const Chip8ArchiveHeader *header = mapping;
+
+    if (header->magic != C8_ARCHIVE_MAGIC) {
+        fprintf(stderr, "%s is not a ROM archive\n", path);
+        return false;
+    } else if (header->version != C8_ARCHIVE_VERSION) {
+        fprintf(stderr, "ROM archive %s has unsupported version %" PRIu32 "\n",
+                path, header->version);
+        return false;
+    } else if (header->num_roms > (library->archive_size - sizeof(Chip8ArchiveHeader)) /
+                                  sizeof(Chip8ArchiveEntry)) {
+        fprintf(stderr, "ROM archive %s is truncated\n", path);
+        return false;
+    }
+
+    const Chip8ArchiveEntry *entries = (const Chip8ArchiveEntry *)(archive + sizeof(Chip8ArchiveHeader));
+
+    library->roms = calloc(header->num_roms > 0 ? header->num_roms : 1, sizeof(Chip8LibraryRom));
+
+    if (library->roms == NULL) {
+        C8_LOG_ERROR("Unable to allocate %zu bytes for ROM index",
+                     header->num_roms * sizeof(Chip8LibraryRom));
+        return false;
+    }
+
+    /* Entries are checked as far as is needed to use them safely. The ROM
+     * data isn't hashed again, so that only the ROMs used are read in. */
+    for (uint32_t k = 0; k < header->num_roms; k++) {
+        const Chip8ArchiveEntry *entry = &entries[k];
+        Chip8LibraryRom *rom = &library->roms[k];
+
+        if ((uint64_t)entry->data_offset + entry->size > library->archive_size ||
+            entry->size > C8_PROGRAM_MEMORY_SIZE ||
+            entry->name_offset >= library->archive_size ||
+            memchr(archive + entry->name_offset, '\0',
+                   library->archive_size - entry->name_offset) == NULL ||
+            entry->profile < -1 || entry->profile >= C8_PROFILE_NUM ||
+            entry->instr_per_sec > INT32_MAX ||
+            (entry->keymap[0] != '\0' && !c8_library_valid_keymap(entry->keymap, C8_KEY_NUM)) ||
+            (k > 0 && entries[k - 1].hash >= entry->hash)) {
+
+            fprintf(stderr, "ROM archive %s entry %" PRIu32 " is invalid\n", path, k);
+            return false;
+        }
+
+        rom->hash = entry->hash;
+        rom->name = (const char *)archive + entry->name_offset;
+        rom->data = archive + entry->data_offset;
+        rom->size = entry->size;
+        rom->metadata.has_profile = entry->profile != -1;
+        rom->metadata.profile = entry->profile != -1 ? (Chip8Profile)entry->profile
+                                                     : C8_PROFILE_DEFAULT;
+        rom->metadata.instr_per_sec = entry->instr_per_sec;
+
+        if (entry->keymap[0] != '\0') {
+            memcpy(rom->metadata.keymap, entry->keymap, C8_KEY_NUM);
+        }
+
+        library->num_roms++;
+    }
+
+    return true;
+}
+
+const Chip8LibraryRom *c8_library_find(const Chip8Library *library, uint64_t hash)
+{
+    size_t low = 0;
+    size_t high = library->num_roms;
+
+    while (low < high) {
+        size_t mid = low + (high - low) / 2;
+
+        if (library->roms[mid].hash < hash) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+
+    if (low < library->num_roms && library->roms[low].hash == hash) {
+        return &library->roms[low];
+    }
+
+    return NULL;
+}
+
+/* Finds a ROM by name, or by a unique prefix of its hash in hex */
+const Chip8LibraryRom *c8_library_lookup(const Chip8Library *library, const char *key)
+{
+    return c8_library_match(library, key, true);
+}
+
+/* As c8_library_lookup, but leaves reporting a missing ROM to the caller */
+const Chip8LibraryRom *c8_library_lookup_quiet(const Chip8Library *library, const char *key)
+{
+    return c8_library_match(library, key, false);
+}
+
+static const Chip8LibraryRom *c8_library_match(const Chip8Library *library, const char *key,
+                                               bool report)
+{
+    for (size_t k = 0; k < library->num_roms; k++) {
+        if (strcmp(library->roms[k].name, key) == 0) {
+            return &library->roms[k];
+        }
+    }
+
+    const char *digits = key;
+
+    if (digits[0] == '0' && (digits[1] == 'x' || digits[1] == 'X')) {
+        digits += 2;
+    }
+
+    size_t num_digits = strlen(digits);
+    uint64_t prefix = 0;
+
+    for (size_t k = 0; k < num_digits; k++) {
+        if (!isxdigit((unsigned char)digits[k])) {
+            num_digits = 0;
+            break;
+        }
+
+        int digit = isdigit((unsigned char)digits[k]) ? digits[k] - '0'
+                                                      : tolower((unsigned char)digits[k]) - 'a' + 10;
+        prefix = prefix << 4 | digit;
+    }
+
+    if (num_digits == 0 || num_digits > 16) {
+        if (report) {
+            fprintf(stderr, "No ROM named %s in library\n", key);
+        }
+
+        return NULL;
+    }
+
+    int shift = 64 - 4 * num_digits;
+    const Chip8LibraryRom *found = NULL;
+
+    for (size_t k = 0; k < library->num_roms; k++) {
+        if ((library->roms[k].hash >> shift) != prefix) {
+            continue;
+        } else if (found != NULL) {
+            if (report) {
+                fprintf(stderr, "More than one ROM in library has a hash starting %s\n", key);
+            }
+
+            return NULL;
+        }
+
+        found = &library->roms[k];
+    }
+
+    if (found == NULL && report) {
+        fprintf(stderr, "No ROM named %s in library\n", key);
+    }
+
+    return found;
+}
+
+bool c8_library_load(const Chip8LibraryRom *rom, Chip8 *chip8)
+{
+    if (!c8_load_rom(chip8, rom->data, rom->size)) {
+        fprintf(stderr, "Size of ROM %s exceeds XO-CHIP program memory space\n", rom->name);
+        return false;
+    }
+
+    return true;
+}
+
+/* Written to a temporary file first so an existing archive, possibly the
+ * one library was opened from, is only replaced once complete */
+bool c8_library_pack(const Chip8Library *library, const char *archive_path)
+{
+    uint64_t offset = sizeof(Chip8ArchiveHeader) + library->num_roms * sizeof(Chip8ArchiveEntry);
+    uint64_t name_offset = offset;
+
+    for (size_t k = 0; k < library->num_roms; k++) {
+        name_offset += library->roms[k].size;
+    }
+
+    uint64_t end = name_offset;
+
+    for (size_t k = 0; k < library->num_roms; k++) {
+        end += strlen(library->roms[k].name) + 1;
+    }
+
+    if (end > UINT32_MAX || library->num_roms > UINT32_MAX) {
+        fprintf(stderr, "ROM library is too large to pack into an archive\n");
+        return false;
+    }
+
+    size_t temp_length = strlen(archive_path) + 32;
+    char *temp_name = malloc(temp_length);
+
+    if (temp_name == NULL) {
+        C8_LOG_ERROR("Unable to allocate %zu bytes for file name", temp_length);
+        return false;
+    }
+
+    snprintf(temp_name, temp_length, "%s.tmp.%ld", archive_path, (long)getpid());
+
+    FILE *archive_file = fopen(temp_name, "wb");
+
+    if (archive_file == NULL) {
+        fprintf(stderr, "Unable to open file %s for writing - %s\n", temp_name, strerror(errno));
+        free(temp_name);
+        return false;
+    }
+
+    Chip8ArchiveHeader header = {
+        .magic = C8_ARCHIVE_MAGIC,
+        .version = C8_ARCHIVE_VERSION,
+        .num_roms = library->num_roms,
+        .reserved = 0
+    };
+
+    fwrite(&header, sizeof(header), 1, archive_file);
+
+    for (size_t k = 0; k < library->num_roms; k++) {
+        const Chip8LibraryRom *rom = &library->roms[k];
+        Chip8ArchiveEntry entry;
+
+        /* Zeroes the padding too, so archives of the same ROMs are identical */
+        memset(&entry, 0, sizeof(entry));
+        entry.hash = rom->hash;
+        entry.data_offset = offset;
+        entry.size = rom->size;
+        entry.name_offset = name_offset;
+        entry.profile = rom->metadata.has_profile ? (int32_t)rom->metadata.profile : -1;
+        entry.instr_per_sec = rom->metadata.instr_per_sec;
+        memcpy(entry.keymap, rom->metadata.keymap, C8_KEY_NUM);
+
+        fwrite(&entry, sizeof(entry), 1, archive_file);
+        offset += rom->size;
+        name_offset += strlen(rom->name) + 1;
+    }
+
+    for (size_t k = 0; k < library->num_roms; k++) {
+        fwrite(library->roms[k].data, 1, library->roms[k].size, archive_file);
+    }
+
+    for (size_t k = 0; k < library->num_roms; k++) {
+        fwrite(library->roms[k].name, 1, strlen(library->roms[k].name) + 1, archive_file);
+    }
+
+    bool error = ferror(archive_file);
+
+    if (fclose(archive_file) != 0 || error) {
+        fprintf(stderr, "Error when writing file %s - %s\n", temp_name, strerror(errno));
+        remove(temp_name);
+        free(temp_name);
+        return false;
+    } else if (rename(temp_name, archive_path) != 0) {
+        fprintf(stderr, "Unable to rename %s to %s - %s\n", temp_name, archive_path, strerror(errno));
+        remove(temp_name);
+        free(temp_name);
+        return false;
+    }
+
+    free(temp_name);
+
+    return true;
+}
+
+/* Loaded from the cache when possible, otherwise worked out and then
+ * cached. Failing to write the cache isn't treated as an error. */
+bool c8_library_analyse(const Chip8Library *library, const Chip8LibraryRom *rom,
+                        Chip8RomAnalysis *analysis)
+{
+    memset(analysis, 0, sizeof(Chip8RomAnalysis));
+
+    if (library->cache_dir != NULL && c8_library_read_analysis(library->cache_dir, rom, analysis)) {
+        return true;
+    }
+
+    uint8_t *fusion = malloc(rom->size > 0 ? rom->size : 1);
+    Chip8 *chip8 = c8_alloc_aligned(sizeof(Chip8));
+
+    if (fusion == NULL || chip8 == NULL) {
+        C8_LOG_ERROR("Unable to allocate %zu bytes for ROM analysis", rom->size + sizeof(Chip8));
+        free(fusion);
+        free(chip8);
+        return false;
+    }
+
+    /* Sequences near the end of the ROM run into the memory after it,
+     * so the analysis is of the ROM as it is when loaded */
+    c8_init(chip8);
+    c8_load_rom(chip8, rom->data, rom->size);
+    c8_fusion_analyse(chip8, C8_PROGRAM_MEMORY_START, rom->size, fusion);
+    free(chip8);
+
+    analysis->hash = rom->hash;
+    analysis->flags = c8_library_scan(rom->data, rom->size);
+    analysis->suggested_profile = (analysis->flags & C8_ANALYSIS_XOCHIP_OPCODES) ? C8_PROFILE_XOCHIP
+                                                                                 : C8_PROFILE_DEFAULT;
+    analysis->rom_size = rom->size;
+    analysis->fusion = fusion;
+    analysis->mapping = fusion;
+    analysis->mapping_size = 0;
+
+    if (library->cache_dir != NULL) {
+        c8_library_write_analysis(library->cache_dir, analysis);
+    }
+
+    return true;
+}
+
+void c8_library_analysis_free(Chip8RomAnalysis *analysis)
+{
+    if (analysis->mapping_size > 0) {
+        munmap(analysis->mapping, analysis->mapping_size);
+    } else {
+        free(analysis->mapping);
+    }
+
+    memset(analysis, 0, sizeof(Chip8RomAnalysis));
+}
+
+/* Must be called straight after the ROM is loaded, before any
+ * instruction has had the chance to modify memory */
+void c8_library_warm_fusion(const Chip8RomAnalysis *analysis, Chip8FusionCache *cache)
+{
+    memcpy(cache->kind + C8_PROGRAM_MEMORY_START, analysis->fusion, analysis->rom_size);
+}
+
+static uint32_t c8_library_scan(const uint8_t *data, size_t size)
+{
+    uint32_t flags = 0;
+
+    for (size_t k = 0; k < size; k += 2) {
+        uint16_t instr = data[k] << 8 | (k + 1 < size ? data[k + 1] : 0);
+
+        if ((instr & 0xF00F) == 0x5002) {
+            flags |= C8_ANALYSIS_XOCHIP_OPCODES | C8_ANALYSIS_MEMORY_WRITES;
+        } else if ((instr & 0xF00F) == 0x5003 || instr == 0xF000 || instr == 0xF002 ||
+                   (instr & 0xF0FF) == 0xF001 || (instr & 0xF0FF) == 0xF03A) {
+            flags |= C8_ANALYSIS_XOCHIP_OPCODES;
+        } else if ((instr & 0xFFF0) == 0x00C0 || (instr >= 0x00FB && instr <= 0x00FF) ||
+                   (instr & 0xF0FF) == 0xF030 || (instr & 0xF0FF) == 0xF075 ||
+                   (instr & 0xF0FF) == 0xF085) {
+            flags |= C8_ANALYSIS_SCHIP_OPCODES;
+        } else if ((instr & 0xF0FF) == 0xF00A) {
+            flags |= C8_ANALYSIS_KEY_WAIT;
+        } else if ((instr & 0xF0FF) == 0xF018) {
+            flags |= C8_ANALYSIS_SOUND;
+        } else if ((instr & 0xF0FF) == 0xF033 || (instr & 0xF0FF) == 0xF055) {
+            flags |= C8_ANALYSIS_MEMORY_WRITES;
+        }
+    }
+
+    return flags;
+}
+
+/* The fusion table is used straight from the mapped cache file. A file
+ * which doesn't match the ROM is ignored, and replaced by the caller. */
+static bool c8_library_read_analysis(const char *cache_dir, const Chip8LibraryRom *rom,
+                                     Chip8RomAnalysis *analysis)
+{
+    char *cache_path = c8_library_analysis_path(cache_dir, rom->hash);
+
+    if (cache_path == NULL) {
+        return false;
+    }
+
+    int fd = open(cache_path, O_RDONLY);
+    free(cache_path);
+
+    if (fd == -1) {
+        return false;
+    }
+
+    struct stat file_stat;
+    size_t expected_size = sizeof(Chip8AnalysisHeader) + rom->size;
+
+    if (fstat(fd, &file_stat) != 0 || (size_t)file_stat.st_size != expected_size) {
+        close(fd);
+        return false;
+    }
+
+    void *mapping = mmap(NULL, expected_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+
+    if (mapping == MAP_FAILED) {
+        return false;
+    }
+
+    const Chip8AnalysisHeader *header = mapping;
+    const uint8_t *fusion = (const uint8_t *)mapping + sizeof(Chip8AnalysisHeader);
+    bool valid = header->magic == C8_ANALYSIS_MAGIC && header->version == C8_ANALYSIS_VERSION &&
+                 header->hash == rom->hash && header->rom_size == rom->size &&
+                 header->suggested_profile < C8_PROFILE_NUM;
+
+    /* Kinds index the fusion statistics, so must be in range */
+    for (size_t k = 0; valid && k < rom->size; k++) {
+        valid = fusion[k] < C8_FUSION_NUM;
+    }
+
+    if (!valid) {
+        munmap(mapping, expected_size);
+        return false;
+    }
+
+    analysis->hash = header->hash;
+    analysis->flags = header->flags;
+    analysis->suggested_profile = header->suggested_profile;
+    analysis->rom_size = rom->size;
+    analysis->fusion = fusion;
+    analysis->mapping = mapping;
+    analysis->mapping_size = expected_size;
+
+    return true;
+}
+
+/* Other processes may be reading the cache, so the file is
+ * written under a temporary name and then renamed into place */
+static bool c8_library_write_analysis(const char *cache_dir, const Chip8RomAnalysis *analysis)
+{
+    if (!c8_library_make_dirs(cache_dir)) {
+        return false;
+    }
+
+    char *cache_path = c8_library_analysis_path(cache_dir, analysis->hash);
+
+    if (cache_path == NULL) {
+        return false;
+    }
+
+    size_t temp_length = strlen(cache_path) + 32;
+    char *temp_path = malloc(temp_length);
+
+    if (temp_path == NULL) {
+        C8_LOG_ERROR("Unable to allocate %zu bytes for file name", temp_length);
+        free(cache_path);
+        return false;
+    }
+
+    snprintf(temp_path, temp_length, "%s.tmp.%ld", cache_path, (long)getpid());
+
+    FILE *cache_file = fopen(temp_path, "wb");
+
+    if (cache_file == NULL) {
+        fprintf(stderr, "Unable to open file %s for writing - %s\n", temp_path, strerror(errno));
+        free(temp_path);
+        free(cache_path);
+        return false;
+    }
+
+    Chip8AnalysisHeader header = {
+        .magic = C8_ANALYSIS_MAGIC,
+        .version = C8_ANALYSIS_VERSION,
+        .hash = analysis->hash,
+        .rom_size = analysis->rom_size,
+        .flags = analysis->flags,
+        .suggested_profile = analysis->suggested_profile,
+        .reserved = 0
+    };
+
+    fwrite(&header, sizeof(header), 1, cache_file);
+    fwrite(analysis->fusion, 1, analysis->rom_size, cache_file);
+
+    bool error = ferror(cache_file);
+    bool success = fclose(cache_file) == 0 && !error && rename(temp_path, cache_path) == 0;
+
+    if (!success) {
+        fprintf(stderr, "Unable to write file %s - %s\n", cache_path, strerror(errno));
+        remove(temp_path);
+    }
+
+    free(temp_path);
+    free(cache_path);
+
+    return success;
+}
+
+static bool c8_library_make_dirs(const char *path)
+{
+    char *dir_path = strdup(path);
+
+    if (dir_path == NULL) {
+        C8_LOG_ERROR("Unable to allocate %zu bytes for directory name", strlen(path) + 1);
+        return false;
+    }
+
+    for (char *separator = strchr(dir_path + 1, '/'); ; separator = strchr(separator + 1, '/')) {
+        if (separator != NULL) {
+            *separator = '\0';
+        }
+
+        if (mkdir(dir_path, 0755) != 0 && errno != EEXIST) {
+            fprintf(stderr, "Unable to create directory %s - %s\n", dir_path, strerror(errno));
+            free(dir_path);
+            return false;
+        }
+
+        if (separator == NULL) {
+            break;
+        }
+
+        *separator = '/';
+    }
+
+    free(dir_path);
+
+    return true;
+}
+
+static char *c8_library_analysis_path(const char *cache_dir, uint64_t hash)
+{
+    char file_name[32];
+
+    snprintf(file_name, sizeof(file_name), "%016" PRIx64 ".c8a", hash);
+
+    return c8_library_join(cache_dir, file_name);
+}
+
+static char *c8_library_join(const char *dir, const char *name)
+{
+    size_t length = strlen(dir) + strlen(name) + 2;
+    char *path = malloc(length);
+
+    if (path == NULL) {
+        C8_LOG_ERROR("Unable to allocate %zu bytes for file name", length);
+        return NULL;
+    }
+
+    snprintf(path, length, "%s/%s", dir, name);
+
+    return path;
+}
+
+static int c8_library_compare_roms(const void *first, const void *second)
+{
+    const Chip8LibraryRom *rom1 = first;
+    const Chip8LibraryRom *rom2 = second;
+
+    if (rom1->hash != rom2->hash) {
+        return rom1->hash < rom2->hash ? -1 : 1;
+    }
+
+    return strcmp(rom1->name, rom2->name);
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef C8_CHIP8_LIBRARY_H
+#define C8_CHIP8_LIBRARY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "chip8_core.h"
+
+/* A collection of ROMs memory mapped from either a directory or a packed
+ * archive and indexed by a hash of their contents. ROM data is used in
+ * place, so loading a ROM copies it only into the interpreter's memory.
+ *
+ * A directory may contain a metadata file, library.txt, with a line for
+ * any ROM which needs settings other than the defaults:
+ *
+ *     # HASH, then optional settings
+ *     0x1f3e8b2c9d4a7560 profile=chip8 rate=700 keymap=x123qweasdzc4rfv
+ *
+ * An archive, written by c8_library_pack, holds the metadata itself. All
+ * archive fields are stored in host byte order:
+ *
+ *     header: magic, version, number of ROMs
+ *     an entry for each ROM, sorted by hash
+ *     ROM data and NUL terminated names, at the offsets in each entry
+ *
+ * The static analysis of each ROM is kept in a cache directory, one file
+ * per ROM named by its hash, so it is only worked out on first use. */
+
+#define C8_LIBRARY_METADATA_FILE "library.txt"
+#define C8_LIBRARY_HASH_SEED 0
+#define C8_ARCHIVE_MAGIC 0x424C3843 /* "C8LB" */
+#define C8_ARCHIVE_VERSION 1
+#define C8_ANALYSIS_MAGIC 0x4E413843 /* "C8AN" */
+#define C8_ANALYSIS_VERSION 2
+
+/* Instructions found by c8_library_analyse. As the whole ROM is
+ * scanned, data which happens to look like an instruction counts too. */
+#define C8_ANALYSIS_XOCHIP_OPCODES  0x01 /* 5xy2, 5xy3, F000, Fn01, F002, Fx3A */
+#define C8_ANALYSIS_SCHIP_OPCODES   0x02 /* 00Cn, 00FB-00FF, Fx30, Fx75, Fx85 */
+#define C8_ANALYSIS_KEY_WAIT        0x04 /* Fx0A */
+#define C8_ANALYSIS_SOUND           0x08 /* Fx18 */
+#define C8_ANALYSIS_MEMORY_WRITES   0x10 /* Fx33, Fx55, 5xy2 */
+
+/* Settings to run a ROM with, any of which may be unset */
+typedef struct {
+    bool has_profile;
+    Chip8Profile profile;
+    /* 0 when not set */
+    int instr_per_sec;
+    /* Empty when not set */
+    char keymap[C8_KEY_NUM + 1];
+} Chip8RomMetadata;
+
+typedef struct {
+    uint64_t hash;
+    const char *name;
+    const uint8_t *data;
+    size_t size;
+    Chip8RomMetadata metadata;
+} Chip8LibraryRom;
+
+typedef struct {
+    /* Sorted by hash */
+    Chip8LibraryRom *roms;
+    size_t num_roms;
+    /* The archive mapping when opened from one, otherwise each ROM's data
+     * is its own mapping and its name is allocated separately */
+    void *archive;
+    size_t archive_size;
+    /* NULL when analysis isn't cached */
+    char *cache_dir;
+} Chip8Library;
+
+typedef struct {
+    uint64_t hash;
+    uint32_t flags;
+    /* XO-CHIP when XO-CHIP instructions were found, otherwise the default */
+    Chip8Profile suggested_profile;
+    size_t rom_size;
+    /* The fused sequence starting at each byte of the ROM when loaded */
+    const uint8_t *fusion;
+    /* The cache file mapped, or the allocation holding fusion when the
+     * analysis was worked out and mapping_size is 0 */
+    void *mapping;
+    size_t mapping_size;
+} Chip8RomAnalysis;
+
+bool c8_library_open(Chip8Library *library, const char *path, const char *cache_dir);
+void c8_library_close(Chip8Library *library);
+bool c8_library_default_cache_dir(char *buffer, size_t buffer_size);
+const Chip8LibraryRom *c8_library_find(const Chip8Library *library, uint64_t hash);
+const Chip8LibraryRom *c8_library_lookup(const Chip8Library *library, const char *key);
+const Chip8LibraryRom *c8_library_lookup_quiet(const Chip8Library *library, const char *key);
+bool c8_library_load(const Chip8LibraryRom *rom, Chip8 *chip8);
+bool c8_library_pack(const Chip8Library *library, const char *archive_path);
+bool c8_library_analyse(const Chip8Library *library, const Chip8LibraryRom *rom,
+                        Chip8RomAnalysis *analysis);
+void c8_library_analysis_free(Chip8RomAnalysis *analysis);
+void c8_library_warm_fusion(const Chip8RomAnalysis *analysis, Chip8FusionCache *cache);
+
+#endif
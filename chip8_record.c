@@ -0,0 +1,331 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include "chip8_record.h"
+#include "chip8.h"
+
+#define C8_RECORD_QUEUE_MASK (C8_RECORD_QUEUE_SIZE - 1)
+#define C8_RECORD_HEADER_SIZE 8
+#define C8_RECORD_FRAME_HEADER_SIZE 10
+#define C8_RECORD_RUN_MAX 128
+/* Worst case is alternating zero and non-zero bytes, each pair taking a
+ * control byte for the zero and a control byte and literal for the other */
+#define C8_RECORD_PAYLOAD_MAX (C8_RECORD_FRAME_BYTES + (C8_RECORD_FRAME_BYTES / 2) + 1)
+
+static void *c8_record_encoder(void *arg);
+static void c8_record_encode_frame(Chip8Recorder *recorder, const Chip8RecordFrame *frame);
+static size_t c8_record_rle_encode(const uint8_t *data, size_t length, uint8_t *out);
+static bool c8_record_rle_decode(const uint8_t *data, size_t length, uint8_t *out, size_t out_length);
+static void c8_record_put_u32(uint8_t *buffer, uint32_t value);
+static uint32_t c8_record_get_u32(const uint8_t *buffer);
+
+bool c8_record_init(Chip8Recorder *recorder, const char *path)
+{
+    memset(recorder, 0, sizeof(Chip8Recorder));
+
+    recorder->file = fopen(path, "wb");
+
+    if (recorder->file == NULL) {
+        C8_LOG_ERROR("Unable to open %s for writing - %s", path, strerror(errno));
+        return false;
+    }
+
+    uint8_t header[C8_RECORD_HEADER_SIZE] = {
+        'C', '8', 'R', 'V', C8_RECORD_VERSION, C8_DISPLAY_PLANES,
+        C8_DISPLAY_MAX_WIDTH, C8_DISPLAY_MAX_HEIGHT
+    };
+
+    if (fwrite(header, 1, sizeof(header), recorder->file) != sizeof(header)) {
+        C8_LOG_ERROR("Unable to write to %s - %s", path, strerror(errno));
+        fclose(recorder->file);
+        return false;
+    }
+
+    recorder->bytes_written = sizeof(header);
+
+    if (sem_init(&recorder->frames_ready, 0, 0) != 0) {
+        C8_LOG_ERROR("Unable to create semaphore - %s", strerror(errno));
+        fclose(recorder->file);
+        return false;
+    }
+
+    if (pthread_create(&recorder->encoder, NULL, c8_record_encoder, recorder) != 0) {
+        C8_LOG_ERROR("Unable to create encoder thread for %s", path);
+        sem_destroy(&recorder->frames_ready);
+        fclose(recorder->file);
+        return false;
+    }
+
+    return true;
+}
+
+/* Never blocks, the frame is dropped if the encoder has fallen behind */
+void c8_record_frame(Chip8Recorder *recorder, const Chip8 *chip8, uint32_t tick)
+{
+    uint32_t tail = __atomic_load_n(&recorder->tail, __ATOMIC_RELAXED);
+    uint32_t head = __atomic_load_n(&recorder->head, __ATOMIC_ACQUIRE);
+
+    if (tail - head == C8_RECORD_QUEUE_SIZE) {
+        recorder->frames_dropped++;
+        return;
+    }
+
+    Chip8RecordFrame *frame = &recorder->queue[tail & C8_RECORD_QUEUE_MASK];
+
+    frame->tick = tick;
+    frame->width = chip8->display_width;
+    frame->height = chip8->display_height;
+    memcpy(frame->display, chip8->display, sizeof(frame->display));
+
+    __atomic_store_n(&recorder->tail, tail + 1, __ATOMIC_RELEASE);
+    sem_post(&recorder->frames_ready);
+}
+
+void c8_record_free(Chip8Recorder *recorder)
+{
+    __atomic_store_n(&recorder->stop, true, __ATOMIC_RELEASE);
+    sem_post(&recorder->frames_ready);
+    pthread_join(recorder->encoder, NULL);
+    sem_destroy(&recorder->frames_ready);
+
+    if (fclose(recorder->file) != 0) {
+        recorder->write_error = true;
+    }
+
+    if (recorder->write_error) {
+        C8_LOG_ERROR("Error writing recording - %s", strerror(errno));
+    }
+
+    fprintf(stderr, "Recorded %" PRIu32 " frames, dropped %" PRIu32 " frames, "
+                    "wrote %" PRIu64 " bytes\n", recorder->frames_written,
+                    recorder->frames_dropped, recorder->bytes_written);
+}
+
+static void *c8_record_encoder(void *arg)
+{
+    Chip8Recorder *recorder = arg;
+    bool stop = false;
+
+    /* stop is read before draining so every frame queued
+     * before c8_record_free was called is written */
+    while (!stop) {
+        sem_wait(&recorder->frames_ready);
+
+        stop = __atomic_load_n(&recorder->stop, __ATOMIC_ACQUIRE);
+        uint32_t head = __atomic_load_n(&recorder->head, __ATOMIC_RELAXED);
+        uint32_t tail = __atomic_load_n(&recorder->tail, __ATOMIC_ACQUIRE);
+
+        while (head != tail) {
+            c8_record_encode_frame(recorder, &recorder->queue[head & C8_RECORD_QUEUE_MASK]);
+            __atomic_store_n(&recorder->head, ++head, __ATOMIC_RELEASE);
+        }
+    }
+
+    return NULL;
+}
+
+static void c8_record_encode_frame(Chip8Recorder *recorder, const Chip8RecordFrame *frame)
+{
+    uint8_t current[C8_RECORD_FRAME_BYTES];
+    uint8_t delta[C8_RECORD_FRAME_BYTES];
+    uint8_t output[C8_RECORD_FRAME_HEADER_SIZE + C8_RECORD_PAYLOAD_MAX];
+    const uint64_t *words = &frame->display[0][0][0];
+
+    /* Serialise the packed display most significant byte first,
+     * which keeps pixels in left to right order in the file */
+    for (size_t k = 0; k < C8_RECORD_FRAME_BYTES / 8; k++) {
+        for (int byte = 0; byte < 8; byte++) {
+            current[(k * 8) + byte] = (uint8_t)(words[k] >> (56 - (byte * 8)));
+        }
+    }
+
+    for (size_t k = 0; k < C8_RECORD_FRAME_BYTES; k++) {
+        delta[k] = current[k] ^ recorder->previous[k];
+    }
+
+    memcpy(recorder->previous, current, sizeof(current));
+
+    size_t payload_length = c8_record_rle_encode(delta, sizeof(delta),
+                                                 output + C8_RECORD_FRAME_HEADER_SIZE);
+
+    c8_record_put_u32(output, frame->tick);
+    output[4] = frame->width;
+    output[5] = frame->height;
+    c8_record_put_u32(output + 6, (uint32_t)payload_length);
+
+    size_t length = C8_RECORD_FRAME_HEADER_SIZE + payload_length;
+
+    if (fwrite(output, 1, length, recorder->file) != length) {
+        recorder->write_error = true;
+        return;
+    }
+
+    recorder->bytes_written += length;
+    recorder->frames_written++;
+}
+
+static size_t c8_record_rle_encode(const uint8_t *data, size_t length, uint8_t *out)
+{
+    size_t out_length = 0;
+    size_t k = 0;
+
+    while (k < length) {
+        size_t start = k;
+        bool zero = data[k] == 0;
+
+        while (k < length && k - start < C8_RECORD_RUN_MAX && (data[k] == 0) == zero) {
+            k++;
+        }
+
+        size_t run = k - start;
+
+        if (zero) {
+            out[out_length++] = (uint8_t)(run - 1);
+        } else {
+            out[out_length++] = (uint8_t)(0x80 | (run - 1));
+            memcpy(out + out_length, data + start, run);
+            out_length += run;
+        }
+    }
+
+    return out_length;
+}
+
+static bool c8_record_rle_decode(const uint8_t *data, size_t length, uint8_t *out, size_t out_length)
+{
+    size_t in = 0;
+    size_t k = 0;
+
+    while (in < length) {
+        uint8_t control = data[in++];
+        size_t run = (control & 0x7F) + 1;
+
+        if (k + run > out_length) {
+            return false;
+        }
+
+        if (control & 0x80) {
+            if (in + run > length) {
+                return false;
+            }
+
+            memcpy(out + k, data + in, run);
+            in += run;
+        } else {
+            memset(out + k, 0, run);
+        }
+
+        k += run;
+    }
+
+    return k == out_length;
+}
+
+bool c8_record_reader_init(Chip8RecordReader *reader, const char *path)
+{
+    memset(reader, 0, sizeof(Chip8RecordReader));
+
+    reader->file = fopen(path, "rb");
+
+    if (reader->file == NULL) {
+        C8_LOG_ERROR("Unable to open %s for reading - %s", path, strerror(errno));
+        return false;
+    }
+
+    uint8_t header[C8_RECORD_HEADER_SIZE];
+
+    if (fread(header, 1, sizeof(header), reader->file) != sizeof(header) ||
+        memcmp(header, C8_RECORD_MAGIC, 4) != 0 ||
+        header[4] != C8_RECORD_VERSION || header[5] != C8_DISPLAY_PLANES ||
+        header[6] != C8_DISPLAY_MAX_WIDTH || header[7] != C8_DISPLAY_MAX_HEIGHT) {
+        C8_LOG_ERROR("%s is not a supported recording", path);
+        fclose(reader->file);
+        return false;
+    }
+
+    return true;
+}
+
+/* Returns 1 when a frame was read, 0 at the end of the file and -1 on error */
+int c8_record_read_frame(Chip8RecordReader *reader)
+{
+    uint8_t header[C8_RECORD_FRAME_HEADER_SIZE];
+    uint8_t payload[C8_RECORD_PAYLOAD_MAX];
+    uint8_t delta[C8_RECORD_FRAME_BYTES];
+
+    size_t read = fread(header, 1, sizeof(header), reader->file);
+
+    if (read == 0 && feof(reader->file)) {
+        return 0;
+    } else if (read != sizeof(header)) {
+        return -1;
+    }
+
+    uint32_t payload_length = c8_record_get_u32(header + 6);
+
+    if (payload_length > sizeof(payload) ||
+        fread(payload, 1, payload_length, reader->file) != payload_length ||
+        !c8_record_rle_decode(payload, payload_length, delta, sizeof(delta))) {
+        return -1;
+    }
+
+    reader->tick = c8_record_get_u32(header);
+    reader->width = MIN(header[4], C8_DISPLAY_MAX_WIDTH);
+    reader->height = MIN(header[5], C8_DISPLAY_MAX_HEIGHT);
+
+    for (size_t k = 0; k < C8_RECORD_FRAME_BYTES; k++) {
+        reader->display[k] ^= delta[k];
+    }
+
+    return 1;
+}
+
+uint8_t c8_record_pixel(const Chip8RecordReader *reader, int x, int y)
+{
+    uint8_t value = 0;
+
+    for (int plane = 0; plane < C8_DISPLAY_PLANES; plane++) {
+        size_t row = ((size_t)plane * C8_DISPLAY_MAX_HEIGHT + y) * C8_DISPLAY_ROW_WORDS * 8;
+        value |= ((reader->display[row + (x / 8)] >> (7 - (x % 8))) & 0x1) << plane;
+    }
+
+    return value;
+}
+
+void c8_record_reader_free(Chip8RecordReader *reader)
+{
+    fclose(reader->file);
+}
+
+static void c8_record_put_u32(uint8_t *buffer, uint32_t value)
+{
+    buffer[0] = (uint8_t)(value >> 24);
+    buffer[1] = (uint8_t)(value >> 16);
+    buffer[2] = (uint8_t)(value >> 8);
+    buffer[3] = (uint8_t)value;
+}
+
+static uint32_t c8_record_get_u32(const uint8_t *buffer)
+{
+    return (uint32_t)buffer[0] << 24 | (uint32_t)buffer[1] << 16 |
+           (uint32_t)buffer[2] << 8 | buffer[3];
+}
@@ -0,0 +1,93 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef C8_CHIP8_RECORD_H
+#define C8_CHIP8_RECORD_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include "chip8_core.h"
+
+/* Recording file format, all integers big endian:
+ *
+ * Header: "C8RV", version (1 byte), planes (1 byte),
+ *         maximum width (1 byte), maximum height (1 byte)
+ *
+ * Frame:  timer tick the frame was presented at (4 bytes),
+ *         width (1 byte), height (1 byte), payload length (4 bytes),
+ *         payload
+ *
+ * The payload is the packed display, plane by plane and row by row,
+ * XORed with the previous frame in the file and run length encoded.
+ * Each run starts with a control byte c. When c < 0x80 it is followed
+ * by nothing and stands for c + 1 zero bytes, otherwise it is followed
+ * by (c & 0x7F) + 1 literal bytes. */
+#define C8_RECORD_MAGIC "C8RV"
+#define C8_RECORD_VERSION 1
+#define C8_RECORD_FRAME_BYTES (C8_DISPLAY_PLANES * C8_DISPLAY_MAX_HEIGHT * C8_DISPLAY_ROW_WORDS * 8)
+/* Must be a power of two */
+#define C8_RECORD_QUEUE_SIZE 64
+
+typedef struct {
+    uint32_t tick;
+    uint8_t width;
+    uint8_t height;
+    uint64_t display[C8_DISPLAY_PLANES][C8_DISPLAY_MAX_HEIGHT][C8_DISPLAY_ROW_WORDS];
+} Chip8RecordFrame;
+
+/* Frames are passed from the emulator thread to the encoder thread
+ * through a single producer, single consumer lock free queue. When the
+ * encoder falls behind and the queue is full, frames are dropped and
+ * counted rather than blocking the emulator. */
+typedef struct {
+    FILE *file;
+    pthread_t encoder;
+    sem_t frames_ready;
+    Chip8RecordFrame queue[C8_RECORD_QUEUE_SIZE];
+    uint32_t head;
+    uint32_t tail;
+    bool stop;
+    /* Only accessed by the encoder thread */
+    uint8_t previous[C8_RECORD_FRAME_BYTES];
+    uint64_t bytes_written;
+    uint32_t frames_written;
+    bool write_error;
+    /* Only accessed by the emulator thread */
+    uint32_t frames_dropped;
+} Chip8Recorder;
+
+typedef struct {
+    FILE *file;
+    uint8_t display[C8_RECORD_FRAME_BYTES];
+    uint32_t tick;
+    uint8_t width;
+    uint8_t height;
+} Chip8RecordReader;
+
+bool c8_record_init(Chip8Recorder *recorder, const char *path);
+void c8_record_frame(Chip8Recorder *recorder, const Chip8 *chip8, uint32_t tick);
+void c8_record_free(Chip8Recorder *recorder);
+bool c8_record_reader_init(Chip8RecordReader *reader, const char *path);
+int c8_record_read_frame(Chip8RecordReader *reader);
+uint8_t c8_record_pixel(const Chip8RecordReader *reader, int x, int y);
+void c8_record_reader_free(Chip8RecordReader *reader);
+
+#endif
@@ -0,0 +1,412 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "chip8_scale.h"
+
+/* Vector versions of the row functions are selected at run time,
+ * AVX2 when the CPU supports it and SSE2 otherwise */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define C8_SCALE_X86 1
+#include <immintrin.h>
+#endif
+
+#define C8_SCALE_DIM_MASK 0x7F7F7F7F
+
+typedef void (*Chip8ScaleRowFn)(const uint32_t *src, int width, uint32_t *dst, int factor);
+typedef void (*Chip8DimRowFn)(const uint32_t *src, uint32_t *dst, int length);
+
+static void c8_scale_nearest(const uint32_t *src, int width, int height, uint32_t *dst,
+                             int dst_pitch, int factor, bool scanlines);
+static void c8_scale2x(const uint32_t *src, int width, int height, uint32_t *dst);
+static void c8_scale3x(const uint32_t *src, int width, int height, uint32_t *dst);
+static void c8_scale_pad_row(const uint32_t *row, int width, uint32_t *padded);
+static void c8_scale_row_nearest_scalar(const uint32_t *src, int width, uint32_t *dst, int factor);
+static void c8_dim_row_scalar(const uint32_t *src, uint32_t *dst, int length);
+
+static const char *c8_scale_filter_names[C8_SCALE_NUM] = {
+    [C8_SCALE_SDL] = "sdl",
+    [C8_SCALE_NEAREST] = "nearest",
+    [C8_SCALE_SCALEX] = "scalex",
+    [C8_SCALE_SCANLINE] = "scanline"
+};
+
+#ifdef C8_SCALE_X86
+/* Triples four pixels a b c d into aaab bbcc cddd. Returns the
+ * number of source pixels scaled, leaving any remainder. */
+__attribute__((target("sse2")))
+static int c8_scale_row_triple_sse2(const uint32_t *src, int width, uint32_t *dst)
+{
+    int x = 0;
+
+    for (; x + 4 <= width; x += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i *)(src + x));
+        _mm_storeu_si128((__m128i *)dst, _mm_shuffle_epi32(pixels, _MM_SHUFFLE(1, 0, 0, 0)));
+        _mm_storeu_si128((__m128i *)(dst + 4), _mm_shuffle_epi32(pixels, _MM_SHUFFLE(2, 2, 1, 1)));
+        _mm_storeu_si128((__m128i *)(dst + 8), _mm_shuffle_epi32(pixels, _MM_SHUFFLE(3, 3, 3, 2)));
+        dst += 12;
+    }
+
+    return x;
+}
+
+__attribute__((target("sse2")))
+static void c8_scale_row_nearest_sse2(const uint32_t *src, int width, uint32_t *dst, int factor)
+{
+    int x = 0;
+
+    if (factor == 3) {
+        x = c8_scale_row_triple_sse2(src, width, dst);
+        dst += x * 3;
+    } else if (factor == 2) {
+        for (; x + 4 <= width; x += 4) {
+            __m128i pixels = _mm_loadu_si128((const __m128i *)(src + x));
+            _mm_storeu_si128((__m128i *)dst, _mm_unpacklo_epi32(pixels, pixels));
+            _mm_storeu_si128((__m128i *)(dst + 4), _mm_unpackhi_epi32(pixels, pixels));
+            dst += 8;
+        }
+    }
+
+    for (; x < width; x++) {
+        __m128i pixel = _mm_set1_epi32((int)src[x]);
+        int k = 0;
+
+        for (; k + 4 <= factor; k += 4) {
+            _mm_storeu_si128((__m128i *)(dst + k), pixel);
+        }
+
+        for (; k < factor; k++) {
+            dst[k] = src[x];
+        }
+
+        dst += factor;
+    }
+}
+
+__attribute__((target("avx2")))
+static void c8_scale_row_nearest_avx2(const uint32_t *src, int width, uint32_t *dst, int factor)
+{
+    int x = 0;
+
+    if (factor == 3) {
+        x = c8_scale_row_triple_sse2(src, width, dst);
+        dst += x * 3;
+    } else if (factor == 2) {
+        const __m256i duplicate = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+
+        for (; x + 4 <= width; x += 4) {
+            __m128i pixels = _mm_loadu_si128((const __m128i *)(src + x));
+            _mm256_storeu_si256((__m256i *)dst,
+                                _mm256_permutevar8x32_epi32(_mm256_castsi128_si256(pixels), duplicate));
+            dst += 8;
+        }
+    }
+
+    for (; x < width; x++) {
+        __m256i pixel = _mm256_set1_epi32((int)src[x]);
+        int k = 0;
+
+        for (; k + 8 <= factor; k += 8) {
+            _mm256_storeu_si256((__m256i *)(dst + k), pixel);
+        }
+
+        if (k + 4 <= factor) {
+            _mm_storeu_si128((__m128i *)(dst + k), _mm256_castsi256_si128(pixel));
+            k += 4;
+        }
+
+        for (; k < factor; k++) {
+            dst[k] = src[x];
+        }
+
+        dst += factor;
+    }
+}
+
+__attribute__((target("sse2")))
+static void c8_dim_row_sse2(const uint32_t *src, uint32_t *dst, int length)
+{
+    const __m128i mask = _mm_set1_epi32(C8_SCALE_DIM_MASK);
+    int k = 0;
+
+    for (; k + 4 <= length; k += 4) {
+        __m128i pixels = _mm_loadu_si128((const __m128i *)(src + k));
+        _mm_storeu_si128((__m128i *)(dst + k), _mm_and_si128(_mm_srli_epi32(pixels, 1), mask));
+    }
+
+    c8_dim_row_scalar(src + k, dst + k, length - k);
+}
+
+__attribute__((target("avx2")))
+static void c8_dim_row_avx2(const uint32_t *src, uint32_t *dst, int length)
+{
+    const __m256i mask = _mm256_set1_epi32(C8_SCALE_DIM_MASK);
+    int k = 0;
+
+    for (; k + 8 <= length; k += 8) {
+        __m256i pixels = _mm256_loadu_si256((const __m256i *)(src + k));
+        _mm256_storeu_si256((__m256i *)(dst + k), _mm256_and_si256(_mm256_srli_epi32(pixels, 1), mask));
+    }
+
+    c8_dim_row_scalar(src + k, dst + k, length - k);
+}
+
+/* Selects a where mask is set and b elsewhere */
+__attribute__((target("sse2")))
+static inline __m128i c8_select_sse2(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+/* Scale2x four pixels at a time. Each row is padded by one pixel
+ * either side, so D and F are the left and right neighbours of E. */
+__attribute__((target("sse2")))
+static int c8_scale2x_row_sse2(const uint32_t *up, const uint32_t *row, const uint32_t *down,
+                               int width, uint32_t *top, uint32_t *bottom)
+{
+    int x = 0;
+
+    for (; x + 4 <= width; x += 4) {
+        __m128i B = _mm_loadu_si128((const __m128i *)(up + x + 1));
+        __m128i D = _mm_loadu_si128((const __m128i *)(row + x));
+        __m128i E = _mm_loadu_si128((const __m128i *)(row + x + 1));
+        __m128i F = _mm_loadu_si128((const __m128i *)(row + x + 2));
+        __m128i H = _mm_loadu_si128((const __m128i *)(down + x + 1));
+
+        __m128i BF = _mm_cmpeq_epi32(B, F);
+        __m128i DB = _mm_cmpeq_epi32(D, B);
+        __m128i DH = _mm_cmpeq_epi32(D, H);
+        __m128i HF = _mm_cmpeq_epi32(H, F);
+
+        __m128i E0 = c8_select_sse2(_mm_andnot_si128(BF, _mm_andnot_si128(DH, DB)), D, E);
+        __m128i E1 = c8_select_sse2(_mm_andnot_si128(DB, _mm_andnot_si128(HF, BF)), F, E);
+        __m128i E2 = c8_select_sse2(_mm_andnot_si128(DB, _mm_andnot_si128(HF, DH)), D, E);
+        __m128i E3 = c8_select_sse2(_mm_andnot_si128(DH, _mm_andnot_si128(BF, HF)), F, E);
+
+        _mm_storeu_si128((__m128i *)(top + (x * 2)), _mm_unpacklo_epi32(E0, E1));
+        _mm_storeu_si128((__m128i *)(top + (x * 2) + 4), _mm_unpackhi_epi32(E0, E1));
+        _mm_storeu_si128((__m128i *)(bottom + (x * 2)), _mm_unpacklo_epi32(E2, E3));
+        _mm_storeu_si128((__m128i *)(bottom + (x * 2) + 4), _mm_unpackhi_epi32(E2, E3));
+    }
+
+    return x;
+}
+#endif
+
+bool c8_scale_parse_filter(const char *name, Chip8ScaleFilter *filter)
+{
+    for (int k = 0; k < C8_SCALE_NUM; k++) {
+        if (strcmp(name, c8_scale_filter_names[k]) == 0) {
+            *filter = k;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+const char *c8_scale_filter_name(Chip8ScaleFilter filter)
+{
+    return c8_scale_filter_names[filter];
+}
+
+bool c8_scaler_init(Chip8Scaler *scaler, Chip8ScaleFilter filter, int factor,
+                    int max_width, int max_height)
+{
+    memset(scaler, 0, sizeof(Chip8Scaler));
+
+    scaler->filter = filter;
+    scaler->factor = factor;
+
+    if (filter == C8_SCALE_SCALEX && (factor % 2 == 0 || factor % 3 == 0)) {
+        scaler->scratch = malloc(sizeof(uint32_t) * max_width * 3 * max_height * 3);
+
+        if (scaler->scratch == NULL) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/* Scales width x height pixels from src into dst, which must have room for
+ * height * factor rows of dst_pitch pixels, each at least width * factor */
+void c8_scaler_run(const Chip8Scaler *scaler, const uint32_t *src, int width, int height,
+                   uint32_t *dst, int dst_pitch)
+{
+    int factor = scaler->factor;
+
+    if (scaler->filter == C8_SCALE_SCALEX && factor % 2 == 0) {
+        c8_scale2x(src, width, height, scaler->scratch);
+        src = scaler->scratch;
+        width *= 2;
+        height *= 2;
+        factor /= 2;
+    } else if (scaler->filter == C8_SCALE_SCALEX && factor % 3 == 0) {
+        c8_scale3x(src, width, height, scaler->scratch);
+        src = scaler->scratch;
+        width *= 3;
+        height *= 3;
+        factor /= 3;
+    }
+
+    c8_scale_nearest(src, width, height, dst, dst_pitch, factor,
+                     scaler->filter == C8_SCALE_SCANLINE);
+}
+
+void c8_scaler_free(Chip8Scaler *scaler)
+{
+    free(scaler->scratch);
+    scaler->scratch = NULL;
+}
+
+static void c8_scale_nearest(const uint32_t *src, int width, int height, uint32_t *dst,
+                             int dst_pitch, int factor, bool scanlines)
+{
+    Chip8ScaleRowFn scale_row = c8_scale_row_nearest_scalar;
+    Chip8DimRowFn dim_row = c8_dim_row_scalar;
+    int dst_width = width * factor;
+
+#ifdef C8_SCALE_X86
+    if (__builtin_cpu_supports("avx2")) {
+        scale_row = c8_scale_row_nearest_avx2;
+        dim_row = c8_dim_row_avx2;
+    } else if (__builtin_cpu_supports("sse2")) {
+        scale_row = c8_scale_row_nearest_sse2;
+        dim_row = c8_dim_row_sse2;
+    }
+#endif
+
+    for (int y = 0; y < height; y++) {
+        uint32_t *first = dst + ((size_t)y * factor * dst_pitch);
+
+        if (factor == 1) {
+            memcpy(first, src + ((size_t)y * width), sizeof(uint32_t) * width);
+            continue;
+        }
+
+        scale_row(src + ((size_t)y * width), width, first, factor);
+
+        /* Remaining rows are copies of the first, or darkened copies in the
+         * lower half when drawing scanlines */
+        for (int k = 1; k < factor; k++) {
+            uint32_t *row = first + ((size_t)k * dst_pitch);
+
+            if (scanlines && k >= (factor + 1) / 2) {
+                dim_row(first, row, dst_width);
+            } else {
+                memcpy(row, first, sizeof(uint32_t) * dst_width);
+            }
+        }
+    }
+}
+
+static void c8_scale2x(const uint32_t *src, int width, int height, uint32_t *dst)
+{
+    uint32_t padded[3][width + 2];
+
+    for (int y = 0; y < height; y++) {
+        c8_scale_pad_row(src + ((size_t)(y > 0 ? y - 1 : y) * width), width, padded[0]);
+        c8_scale_pad_row(src + ((size_t)y * width), width, padded[1]);
+        c8_scale_pad_row(src + ((size_t)(y + 1 < height ? y + 1 : y) * width), width, padded[2]);
+
+        uint32_t *top = dst + ((size_t)y * 2 * width * 2);
+        uint32_t *bottom = top + (width * 2);
+        int x = 0;
+
+#ifdef C8_SCALE_X86
+        if (__builtin_cpu_supports("sse2")) {
+            x = c8_scale2x_row_sse2(padded[0], padded[1], padded[2], width, top, bottom);
+        }
+#endif
+
+        for (; x < width; x++) {
+            uint32_t B = padded[0][x + 1];
+            uint32_t D = padded[1][x];
+            uint32_t E = padded[1][x + 1];
+            uint32_t F = padded[1][x + 2];
+            uint32_t H = padded[2][x + 1];
+
+            top[x * 2] = D == B && B != F && D != H ? D : E;
+            top[(x * 2) + 1] = B == F && B != D && F != H ? F : E;
+            bottom[x * 2] = D == H && D != B && H != F ? D : E;
+            bottom[(x * 2) + 1] = H == F && D != H && B != F ? F : E;
+        }
+    }
+}
+
+static void c8_scale3x(const uint32_t *src, int width, int height, uint32_t *dst)
+{
+    uint32_t padded[3][width + 2];
+    int dst_width = width * 3;
+
+    for (int y = 0; y < height; y++) {
+        c8_scale_pad_row(src + ((size_t)(y > 0 ? y - 1 : y) * width), width, padded[0]);
+        c8_scale_pad_row(src + ((size_t)y * width), width, padded[1]);
+        c8_scale_pad_row(src + ((size_t)(y + 1 < height ? y + 1 : y) * width), width, padded[2]);
+
+        uint32_t *out = dst + ((size_t)y * 3 * dst_width);
+
+        for (int x = 0; x < width; x++) {
+            uint32_t A = padded[0][x], B = padded[0][x + 1], C = padded[0][x + 2];
+            uint32_t D = padded[1][x], E = padded[1][x + 1], F = padded[1][x + 2];
+            uint32_t G = padded[2][x], H = padded[2][x + 1], I = padded[2][x + 2];
+            uint32_t *o = out + (x * 3);
+
+            bool db = D == B && B != F && D != H;
+            bool bf = B == F && B != D && F != H;
+            bool dh = D == H && D != B && H != F;
+            bool hf = H == F && D != H && B != F;
+
+            o[0] = db ? D : E;
+            o[1] = (db && E != C) || (bf && E != A) ? B : E;
+            o[2] = bf ? F : E;
+            o[dst_width] = (db && E != G) || (dh && E != A) ? D : E;
+            o[dst_width + 1] = E;
+            o[dst_width + 2] = (bf && E != I) || (hf && E != C) ? F : E;
+            o[(2 * dst_width)] = dh ? D : E;
+            o[(2 * dst_width) + 1] = (dh && E != I) || (hf && E != G) ? H : E;
+            o[(2 * dst_width) + 2] = hf ? F : E;
+        }
+    }
+}
+
+/* Edge pixels are repeated so every pixel has neighbours */
+static void c8_scale_pad_row(const uint32_t *row, int width, uint32_t *padded)
+{
+    padded[0] = row[0];
+    memcpy(padded + 1, row, sizeof(uint32_t) * width);
+    padded[width + 1] = row[width - 1];
+}
+
+static void c8_scale_row_nearest_scalar(const uint32_t *src, int width, uint32_t *dst, int factor)
+{
+    for (int x = 0; x < width; x++) {
+        for (int k = 0; k < factor; k++) {
+            *dst++ = src[x];
+        }
+    }
+}
+
+static void c8_dim_row_scalar(const uint32_t *src, uint32_t *dst, int length)
+{
+    for (int k = 0; k < length; k++) {
+        dst[k] = (src[k] >> 1) & C8_SCALE_DIM_MASK;
+    }
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef C8_CHIP8_SCALE_H
+#define C8_CHIP8_SCALE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/* C8_SCALE_SDL leaves scaling to SDL_RenderCopy, the others
+ * scale on the CPU into a texture of the final size */
+typedef enum {
+    C8_SCALE_SDL,
+    C8_SCALE_NEAREST,
+    /* Scale2x for even factors and Scale3x for multiples of three,
+     * followed by nearest neighbour scaling for the remainder */
+    C8_SCALE_SCALEX,
+    /* Nearest neighbour with the lower half of each row of output
+     * pixels darkened, when the factor is at least 2 */
+    C8_SCALE_SCANLINE,
+    C8_SCALE_NUM
+} Chip8ScaleFilter;
+
+typedef struct {
+    Chip8ScaleFilter filter;
+    int factor;
+    /* Holds the Scale2x or Scale3x output before it is scaled further */
+    uint32_t *scratch;
+} Chip8Scaler;
+
+bool c8_scale_parse_filter(const char *name, Chip8ScaleFilter *filter);
+const char *c8_scale_filter_name(Chip8ScaleFilter filter);
+bool c8_scaler_init(Chip8Scaler *scaler, Chip8ScaleFilter filter, int factor,
+                    int max_width, int max_height);
+void c8_scaler_run(const Chip8Scaler *scaler, const uint32_t *src, int width, int height,
+                   uint32_t *dst, int dst_pitch);
+void c8_scaler_free(Chip8Scaler *scaler);
+
+#endif
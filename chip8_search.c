@@ -0,0 +1,821 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include "chip8_search.h"
+#include "chip8.h"
+
+/* A node's key orders it within the search: its depth, the index of its
+ * parent in the previous level and the index of the input applied. Where
+ * several nodes reach the same state the one with the lowest key is kept,
+ * which makes the result independent of how work was split. */
+#define C8_SEARCH_KEY(depth, parent, input) \
+    (((uint64_t)(depth) << 48) | ((uint64_t)(parent) << 16) | (uint64_t)(input))
+#define C8_SEARCH_KEY_PARENT(key) ((uint32_t)((key) >> 16))
+#define C8_SEARCH_KEY_INPUT(key) ((uint16_t)(key))
+#define C8_SEARCH_RANGE(begin, end) (((uint64_t)(begin) << 32) | (uint32_t)(end))
+#define C8_SEARCH_RANGE_BEGIN(range) ((uint32_t)((range) >> 32))
+#define C8_SEARCH_RANGE_END(range) ((uint32_t)(range))
+/* Memory and the display are stored separately, leaving three ranges */
+#define C8_SEARCH_REGISTER_RANGES 3
+
+typedef struct {
+    size_t offset;
+    size_t size;
+} Chip8SearchBytes;
+
+typedef struct {
+    /* Registers, then visible display words, then the index and contents
+     * of each page of memory which differs from the start state */
+    uint8_t *data;
+    uint64_t key;
+    uint64_t hash;
+    double score;
+    uint32_t slot;
+    uint16_t num_pages;
+    bool goal;
+} Chip8SearchNode;
+
+typedef struct {
+    Chip8SearchNode *nodes;
+    size_t count;
+    size_t capacity;
+} Chip8SearchNodes;
+
+/* Open addressing set of state hashes, each with the lowest key to reach
+ * it. A hash of 0 marks an empty slot. */
+typedef struct {
+    uint64_t *hashes;
+    uint64_t *keys;
+    size_t mask;
+    size_t count;
+    size_t limit;
+    bool full;
+} Chip8SearchVisited;
+
+struct Chip8Search;
+
+typedef struct {
+    struct Chip8Search *search;
+    int index;
+    /* Packed [begin, end) range of the frontier still to be expanded by
+     * this worker, the back half of which can be stolen by others */
+    uint64_t range;
+    Chip8 chip8;
+    /* Pages of chip8.memory which may differ from the start state */
+    bool dirty[C8_SEARCH_PAGES];
+    Chip8SearchNodes children;
+    uint64_t expanded;
+    uint64_t duplicates;
+    bool failed;
+} Chip8SearchWorker;
+
+typedef struct Chip8Search {
+    const Chip8SearchConfig *config;
+    const Chip8 *start;
+    const uint16_t *inputs;
+    int num_inputs;
+    Chip8SearchBytes registers[C8_SEARCH_REGISTER_RANGES];
+    size_t registers_size;
+    Chip8SearchVisited visited;
+    Chip8SearchNodes frontier;
+    int depth;
+    Chip8SearchWorker *workers;
+    int num_workers;
+} Chip8Search;
+
+static bool c8_search_validate(const Chip8SearchConfig *config);
+static void c8_search_init_registers(Chip8Search *search);
+static bool c8_search_visited_init(Chip8SearchVisited *visited, size_t limit);
+static void c8_search_visited_free(Chip8SearchVisited *visited);
+static bool c8_search_visit(Chip8SearchVisited *visited, Chip8SearchNode *node);
+static void c8_search_expand_level(Chip8Search *search);
+static void *c8_search_worker_run(void *arg);
+static bool c8_search_take(uint64_t *range, uint32_t *index);
+static bool c8_search_steal(Chip8SearchWorker *worker);
+static void c8_search_expand(Chip8SearchWorker *worker, uint32_t index);
+static void c8_search_load(Chip8SearchWorker *worker, const Chip8SearchNode *node);
+static void c8_search_run(Chip8SearchWorker *worker, uint16_t keys);
+static bool c8_search_save(Chip8SearchWorker *worker, uint64_t key, Chip8SearchNode *node);
+static bool c8_search_gather(Chip8Search *search, Chip8SearchNodes *next);
+static bool c8_search_nodes_add(Chip8SearchNodes *nodes, const Chip8SearchNode *node);
+static void c8_search_nodes_free(Chip8SearchNodes *nodes);
+static int c8_search_compare_key(const void *a, const void *b);
+static int c8_search_compare_score(const void *a, const void *b);
+
+static const uint16_t c8_search_default_inputs[C8_KEY_NUM + 1] = {
+    0x0000,
+    0x0001, 0x0002, 0x0004, 0x0008, 0x0010, 0x0020, 0x0040, 0x0080,
+    0x0100, 0x0200, 0x0400, 0x0800, 0x1000, 0x2000, 0x4000, 0x8000
+};
+
+void c8_search_default_config(Chip8SearchConfig *config)
+{
+    memset(config, 0, sizeof(Chip8SearchConfig));
+
+    config->strategy = C8_SEARCH_BFS;
+    config->beam_width = 256;
+    config->max_depth = 32;
+    config->frames_per_input = 4;
+    config->instr_per_frame = 10;
+    config->num_threads = 1;
+    config->max_states = C8_SEARCH_MAX_STATES_DEFAULT;
+    config->goal_address = -1;
+    config->score_address = -1;
+}
+
+bool c8_search(const Chip8 *start, const Chip8SearchConfig *config, Chip8SearchResult *result)
+{
+    memset(result, 0, sizeof(Chip8SearchResult));
+
+    if (!c8_search_validate(config)) {
+        return false;
+    }
+
+    Chip8Search search;
+    memset(&search, 0, sizeof(Chip8Search));
+
+    search.config = config;
+    search.start = start;
+    search.inputs = config->inputs != NULL ? config->inputs : c8_search_default_inputs;
+    search.num_inputs = config->inputs != NULL ? config->num_inputs : C8_KEY_NUM + 1;
+    search.num_workers = config->num_threads;
+    c8_search_init_registers(&search);
+
+    /* Keys of the nodes at each depth, used to follow a goal back to the start */
+    uint64_t **level_keys = calloc(config->max_depth + 1, sizeof(uint64_t *));
+    search.workers = c8_alloc_aligned(search.num_workers * sizeof(Chip8SearchWorker));
+    bool success = false;
+
+    if (search.workers != NULL) {
+        memset(search.workers, 0, search.num_workers * sizeof(Chip8SearchWorker));
+    }
+
+    if (level_keys == NULL || search.workers == NULL ||
+        !c8_search_visited_init(&search.visited, config->max_states)) {
+        C8_LOG_ERROR("%s", "Unable to allocate search state");
+        goto cleanup;
+    }
+
+    for (int k = 0; k < search.num_workers; k++) {
+        search.workers[k].search = &search;
+        search.workers[k].index = k;
+        search.workers[k].chip8 = *start;
+    }
+
+    Chip8SearchNode root;
+
+    if (!c8_search_save(&search.workers[0], 0, &root) ||
+        !c8_search_nodes_add(&search.frontier, &root)) {
+        C8_LOG_ERROR("%s", "Unable to allocate search state");
+        goto cleanup;
+    }
+
+    c8_search_visit(&search.visited, &root);
+
+    level_keys[0] = malloc(sizeof(uint64_t));
+
+    if (level_keys[0] == NULL) {
+        C8_LOG_ERROR("%s", "Unable to allocate search state");
+        goto cleanup;
+    }
+
+    level_keys[0][0] = root.key;
+    const Chip8SearchNode *goal = root.goal ? &search.frontier.nodes[0] : NULL;
+
+    while (goal == NULL && search.depth < config->max_depth &&
+           search.frontier.count > 0 && !search.visited.full) {
+        c8_search_expand_level(&search);
+
+        Chip8SearchNodes next = { NULL, 0, 0 };
+
+        if (!c8_search_gather(&search, &next)) {
+            C8_LOG_ERROR("%s", "Unable to allocate search state");
+            c8_search_nodes_free(&next);
+            goto cleanup;
+        }
+
+        c8_search_nodes_free(&search.frontier);
+        search.frontier = next;
+        search.depth++;
+
+        if (next.count == 0) {
+            break;
+        }
+
+        qsort(next.nodes, next.count, sizeof(Chip8SearchNode), c8_search_compare_key);
+
+        for (size_t k = 0; k < next.count; k++) {
+            if (next.nodes[k].goal) {
+                goal = &search.frontier.nodes[k];
+                break;
+            }
+        }
+
+        if (goal == NULL && config->strategy == C8_SEARCH_BEAM &&
+            next.count > (size_t)config->beam_width) {
+            qsort(next.nodes, next.count, sizeof(Chip8SearchNode), c8_search_compare_score);
+
+            for (size_t k = config->beam_width; k < next.count; k++) {
+                free(next.nodes[k].data);
+            }
+
+            search.frontier.count = config->beam_width;
+            qsort(next.nodes, search.frontier.count, sizeof(Chip8SearchNode),
+                  c8_search_compare_key);
+        }
+
+        level_keys[search.depth] = malloc(search.frontier.count * sizeof(uint64_t));
+
+        if (level_keys[search.depth] == NULL) {
+            C8_LOG_ERROR("%s", "Unable to allocate search state");
+            goto cleanup;
+        }
+
+        for (size_t k = 0; k < search.frontier.count; k++) {
+            level_keys[search.depth][k] = search.frontier.nodes[k].key;
+        }
+    }
+
+    for (int k = 0; k < search.num_workers; k++) {
+        result->expanded += search.workers[k].expanded;
+        result->duplicates += search.workers[k].duplicates;
+    }
+
+    result->state_limit = search.visited.full;
+
+    if (goal != NULL) {
+        result->found = true;
+        result->depth = search.depth;
+        result->inputs = malloc((search.depth + 1) * sizeof(uint16_t));
+
+        if (result->inputs == NULL) {
+            C8_LOG_ERROR("%s", "Unable to allocate search result");
+            goto cleanup;
+        }
+
+        uint64_t key = goal->key;
+
+        for (int depth = search.depth; depth > 0; depth--) {
+            result->inputs[depth - 1] = search.inputs[C8_SEARCH_KEY_INPUT(key)];
+            key = level_keys[depth - 1][C8_SEARCH_KEY_PARENT(key)];
+        }
+    }
+
+    success = true;
+
+cleanup:
+    if (level_keys != NULL) {
+        for (int k = 0; k <= config->max_depth; k++) {
+            free(level_keys[k]);
+        }
+    }
+
+    if (search.workers != NULL) {
+        for (int k = 0; k < search.num_workers; k++) {
+            c8_search_nodes_free(&search.workers[k].children);
+        }
+    }
+
+    free(level_keys);
+    free(search.workers);
+    c8_search_nodes_free(&search.frontier);
+    c8_search_visited_free(&search.visited);
+
+    if (!success) {
+        c8_search_result_free(result);
+    }
+
+    return success;
+}
+
+void c8_search_result_free(Chip8SearchResult *result)
+{
+    free(result->inputs);
+    result->inputs = NULL;
+}
+
+static bool c8_search_validate(const Chip8SearchConfig *config)
+{
+    if (config->max_depth < 0 || config->frames_per_input < 1 ||
+        config->instr_per_frame < 1 || config->num_threads < 1 ||
+        config->max_states < 1 || config->max_depth >= 0xFFFF) {
+        C8_LOG_ERROR("%s", "Invalid search configuration");
+        return false;
+    }
+
+    if (config->strategy == C8_SEARCH_BEAM && config->beam_width < 1) {
+        C8_LOG_ERROR("%s", "Beam width must be at least 1");
+        return false;
+    }
+
+    if (config->inputs != NULL &&
+        (config->num_inputs < 1 || config->num_inputs > 0xFFFF)) {
+        C8_LOG_ERROR("%s", "Invalid number of search inputs");
+        return false;
+    }
+
+    if (config->goal == NULL && !config->goal_display &&
+        (config->goal_address < 0 || config->goal_address >= C8_MEMORY_SIZE)) {
+        C8_LOG_ERROR("%s", "No search objective");
+        return false;
+    }
+
+    if (config->score_address >= C8_MEMORY_SIZE) {
+        C8_LOG_ERROR("%s", "Score address must be within memory");
+        return false;
+    }
+
+    return true;
+}
+
+/* Finds the parts of Chip8 either side of memory and the display */
+static void c8_search_init_registers(Chip8Search *search)
+{
+    Chip8SearchBytes skip[2] = {
+        { offsetof(Chip8, memory), sizeof(((Chip8 *)0)->memory) },
+        { offsetof(Chip8, display), sizeof(((Chip8 *)0)->display) }
+    };
+
+    if (skip[0].offset > skip[1].offset) {
+        Chip8SearchBytes first = skip[1];
+        skip[1] = skip[0];
+        skip[0] = first;
+    }
+
+    search->registers[0].offset = 0;
+    search->registers[0].size = skip[0].offset;
+    search->registers[1].offset = skip[0].offset + skip[0].size;
+    search->registers[1].size = skip[1].offset - search->registers[1].offset;
+    search->registers[2].offset = skip[1].offset + skip[1].size;
+    search->registers[2].size = sizeof(Chip8) - search->registers[2].offset;
+    search->registers_size = search->registers[0].size +
+                             search->registers[1].size +
+                             search->registers[2].size;
+}
+
+static bool c8_search_visited_init(Chip8SearchVisited *visited, size_t limit)
+{
+    size_t capacity = 1024;
+
+    while (capacity < limit * 2) {
+        capacity *= 2;
+    }
+
+    visited->hashes = calloc(capacity, sizeof(uint64_t));
+    visited->keys = malloc(capacity * sizeof(uint64_t));
+
+    if (visited->hashes == NULL || visited->keys == NULL) {
+        return false;
+    }
+
+    memset(visited->keys, 0xFF, capacity * sizeof(uint64_t));
+    visited->mask = capacity - 1;
+    visited->limit = limit;
+
+    return true;
+}
+
+static void c8_search_visited_free(Chip8SearchVisited *visited)
+{
+    free(visited->hashes);
+    free(visited->keys);
+}
+
+/* Records that node's state has been reached, returning false if it had
+ * already been reached by a node with a lower key or the set is full */
+static bool c8_search_visit(Chip8SearchVisited *visited, Chip8SearchNode *node)
+{
+    size_t slot = node->hash & visited->mask;
+
+    for (;;) {
+        uint64_t hash = __atomic_load_n(&visited->hashes[slot], __ATOMIC_ACQUIRE);
+
+        if (hash == 0) {
+            if (__atomic_load_n(&visited->count, __ATOMIC_RELAXED) >= visited->limit) {
+                __atomic_store_n(&visited->full, true, __ATOMIC_RELAXED);
+                return false;
+            }
+
+            if (__atomic_compare_exchange_n(&visited->hashes[slot], &hash, node->hash, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                __atomic_fetch_add(&visited->count, 1, __ATOMIC_RELAXED);
+                break;
+            }
+        }
+
+        if (hash == node->hash) {
+            break;
+        }
+
+        slot = (slot + 1) & visited->mask;
+    }
+
+    node->slot = slot;
+    uint64_t key = __atomic_load_n(&visited->keys[slot], __ATOMIC_RELAXED);
+
+    while (node->key < key) {
+        if (__atomic_compare_exchange_n(&visited->keys[slot], &key, node->key, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/* The frontier starts split evenly between workers. The calling thread is
+ * the first worker, the others are started for each level. */
+static void c8_search_expand_level(Chip8Search *search)
+{
+    size_t count = search->frontier.count;
+    int num_workers = search->num_workers;
+    pthread_t threads[num_workers];
+    bool started[num_workers];
+
+    for (int k = 0; k < num_workers; k++) {
+        Chip8SearchWorker *worker = &search->workers[k];
+        worker->range = C8_SEARCH_RANGE(count * k / num_workers,
+                                        count * (k + 1) / num_workers);
+        worker->children.count = 0;
+    }
+
+    for (int k = 1; k < num_workers; k++) {
+        /* Work given to a thread that fails to start is stolen by the others */
+        started[k] = pthread_create(&threads[k], NULL, c8_search_worker_run,
+                                    &search->workers[k]) == 0;
+    }
+
+    c8_search_worker_run(&search->workers[0]);
+
+    for (int k = 1; k < num_workers; k++) {
+        if (started[k]) {
+            pthread_join(threads[k], NULL);
+        }
+    }
+}
+
+static void *c8_search_worker_run(void *arg)
+{
+    Chip8SearchWorker *worker = arg;
+    uint32_t index;
+
+    for (;;) {
+        if (c8_search_take(&worker->range, &index)) {
+            c8_search_expand(worker, index);
+        } else if (!c8_search_steal(worker)) {
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+static bool c8_search_take(uint64_t *range, uint32_t *index)
+{
+    uint64_t current = __atomic_load_n(range, __ATOMIC_ACQUIRE);
+
+    for (;;) {
+        uint32_t begin = C8_SEARCH_RANGE_BEGIN(current);
+        uint32_t end = C8_SEARCH_RANGE_END(current);
+
+        if (begin >= end) {
+            return false;
+        }
+
+        if (__atomic_compare_exchange_n(range, &current, C8_SEARCH_RANGE(begin + 1, end),
+                                        false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+            *index = begin;
+            return true;
+        }
+    }
+}
+
+/* Takes the back half of the first other worker's range with work left */
+static bool c8_search_steal(Chip8SearchWorker *worker)
+{
+    Chip8Search *search = worker->search;
+
+    for (int k = 1; k < search->num_workers; k++) {
+        Chip8SearchWorker *victim = &search->workers[(worker->index + k) % search->num_workers];
+        uint64_t current = __atomic_load_n(&victim->range, __ATOMIC_ACQUIRE);
+
+        for (;;) {
+            uint32_t begin = C8_SEARCH_RANGE_BEGIN(current);
+            uint32_t end = C8_SEARCH_RANGE_END(current);
+
+            if (begin >= end) {
+                break;
+            }
+
+            uint32_t middle = begin + (end - begin) / 2;
+
+            if (__atomic_compare_exchange_n(&victim->range, &current, C8_SEARCH_RANGE(begin, middle),
+                                            false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+                __atomic_store_n(&worker->range, C8_SEARCH_RANGE(middle, end), __ATOMIC_RELEASE);
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+static void c8_search_expand(Chip8SearchWorker *worker, uint32_t index)
+{
+    Chip8Search *search = worker->search;
+    const Chip8SearchNode *node = &search->frontier.nodes[index];
+
+    if (worker->failed) {
+        return;
+    }
+
+    for (int input = 0; input < search->num_inputs; input++) {
+        Chip8SearchNode child;
+
+        c8_search_load(worker, node);
+        c8_search_run(worker, search->inputs[input]);
+
+        if (!c8_search_save(worker, C8_SEARCH_KEY(search->depth + 1, index, input), &child)) {
+            worker->failed = true;
+            return;
+        }
+
+        worker->expanded++;
+
+        if (!c8_search_visit(&search->visited, &child)) {
+            worker->duplicates++;
+            free(child.data);
+        } else if (!c8_search_nodes_add(&worker->children, &child)) {
+            worker->failed = true;
+            free(child.data);
+            return;
+        }
+    }
+}
+
+static void c8_search_load(Chip8SearchWorker *worker, const Chip8SearchNode *node)
+{
+    const Chip8Search *search = worker->search;
+    Chip8 *chip8 = &worker->chip8;
+    uint8_t *bytes = (uint8_t *)chip8;
+    const uint8_t *data = node->data;
+
+    for (int k = 0; k < C8_SEARCH_REGISTER_RANGES; k++) {
+        memcpy(bytes + search->registers[k].offset, data, search->registers[k].size);
+        data += search->registers[k].size;
+    }
+
+    /* Pixels outside the current display dimensions are always clear */
+    int row_words = (chip8->display_width + 63) / 64;
+    size_t row_size = row_words * sizeof(uint64_t);
+
+    for (int plane = 0; plane < C8_DISPLAY_PLANES; plane++) {
+        for (int y = 0; y < chip8->display_height; y++) {
+            memcpy(chip8->display[plane][y], data, row_size);
+            data += row_size;
+        }
+    }
+
+    for (int page = 0; page < C8_SEARCH_PAGES; page++) {
+        if (worker->dirty[page]) {
+            memcpy(chip8->memory + page * C8_SEARCH_PAGE_SIZE,
+                   search->start->memory + page * C8_SEARCH_PAGE_SIZE,
+                   C8_SEARCH_PAGE_SIZE);
+            worker->dirty[page] = false;
+        }
+    }
+
+    const uint8_t *pages = data + node->num_pages;
+
+    for (int k = 0; k < node->num_pages; k++) {
+        memcpy(chip8->memory + data[k] * C8_SEARCH_PAGE_SIZE,
+               pages + k * C8_SEARCH_PAGE_SIZE, C8_SEARCH_PAGE_SIZE);
+        worker->dirty[data[k]] = true;
+    }
+}
+
+/* Holds keys for frames_per_input frames, noting which pages are written */
+static void c8_search_run(Chip8SearchWorker *worker, uint16_t keys)
+{
+    const Chip8SearchConfig *config = worker->search->config;
+    Chip8 *chip8 = &worker->chip8;
+
+    for (uint8_t key = 0; key < C8_KEY_NUM; key++) {
+        bool pressed = (keys >> key) & 0x1;
+
+        if (pressed != chip8->input_keys[key]) {
+            c8_key_event(chip8, key, pressed);
+        }
+    }
+
+    for (int frame = 0; frame < config->frames_per_input; frame++) {
+        for (int k = 0; k < config->instr_per_frame; k++) {
+            if (c8_run_cycle(chip8) == 0) {
+                break;
+            }
+
+            if (chip8->write_length != 0) {
+                for (int b = 0; b < chip8->write_length; b++) {
+                    uint16_t address = chip8->write_address + b;
+                    worker->dirty[address / C8_SEARCH_PAGE_SIZE] = true;
+                }
+
+                chip8->write_length = 0;
+            }
+        }
+
+        c8_update_timers(chip8);
+    }
+}
+
+static bool c8_search_save(Chip8SearchWorker *worker, uint64_t key, Chip8SearchNode *node)
+{
+    const Chip8Search *search = worker->search;
+    const Chip8SearchConfig *config = search->config;
+    Chip8 *chip8 = &worker->chip8;
+    const uint8_t *bytes = (const uint8_t *)chip8;
+
+    /* Cleared so the same state reached by different paths hashes the same */
+    chip8->cycles = 0;
+    chip8->idle = false;
+    chip8->update_display = false;
+    chip8->update_audio = false;
+    chip8->write_address = 0;
+
+    int num_pages = 0;
+
+    for (int page = 0; page < C8_SEARCH_PAGES; page++) {
+        if (worker->dirty[page]) {
+            worker->dirty[page] = memcmp(chip8->memory + page * C8_SEARCH_PAGE_SIZE,
+                                         search->start->memory + page * C8_SEARCH_PAGE_SIZE,
+                                         C8_SEARCH_PAGE_SIZE) != 0;
+            num_pages += worker->dirty[page];
+        }
+    }
+
+    int row_words = (chip8->display_width + 63) / 64;
+    size_t row_size = row_words * sizeof(uint64_t);
+    size_t display_size = C8_DISPLAY_PLANES * chip8->display_height * row_size;
+    size_t state_size = search->registers_size + display_size;
+
+    node->data = malloc(state_size + num_pages * (1 + C8_SEARCH_PAGE_SIZE));
+
+    if (node->data == NULL) {
+        return false;
+    }
+
+    uint8_t *data = node->data;
+
+    for (int k = 0; k < C8_SEARCH_REGISTER_RANGES; k++) {
+        memcpy(data, bytes + search->registers[k].offset, search->registers[k].size);
+        data += search->registers[k].size;
+    }
+
+    for (int plane = 0; plane < C8_DISPLAY_PLANES; plane++) {
+        for (int y = 0; y < chip8->display_height; y++) {
+            memcpy(data, chip8->display[plane][y], row_size);
+            data += row_size;
+        }
+    }
+
+    uint64_t hash = c8_hash(node->data, state_size, 0);
+    uint8_t *pages = data + num_pages;
+
+    for (int page = 0, k = 0; page < C8_SEARCH_PAGES; page++) {
+        if (worker->dirty[page]) {
+            data[k] = page;
+            memcpy(pages + k * C8_SEARCH_PAGE_SIZE,
+                   chip8->memory + page * C8_SEARCH_PAGE_SIZE, C8_SEARCH_PAGE_SIZE);
+            hash = c8_hash_word(hash, c8_hash(pages + k * C8_SEARCH_PAGE_SIZE,
+                                              C8_SEARCH_PAGE_SIZE, page));
+            k++;
+        }
+    }
+
+    node->key = key;
+    node->hash = hash != 0 ? hash : 1;
+    node->num_pages = num_pages;
+
+    if (config->goal != NULL) {
+        node->goal = config->goal(chip8, config->user_data);
+    } else if (config->goal_display) {
+        node->goal = c8_display_hash(chip8) == config->goal_display_hash;
+    } else {
+        node->goal = chip8->memory[config->goal_address] == config->goal_value;
+    }
+
+    if (config->score != NULL) {
+        node->score = config->score(chip8, config->user_data);
+    } else if (config->score_address >= 0) {
+        node->score = chip8->memory[config->score_address];
+    } else {
+        node->score = 0;
+    }
+
+    return true;
+}
+
+/* Collects the children which are the lowest keyed node to reach their state */
+static bool c8_search_gather(Chip8Search *search, Chip8SearchNodes *next)
+{
+    bool success = true;
+
+    for (int k = 0; k < search->num_workers; k++) {
+        Chip8SearchWorker *worker = &search->workers[k];
+
+        success = success && !worker->failed;
+
+        for (size_t c = 0; c < worker->children.count; c++) {
+            Chip8SearchNode *child = &worker->children.nodes[c];
+
+            if (success && search->visited.keys[child->slot] == child->key &&
+                c8_search_nodes_add(next, child)) {
+                continue;
+            }
+
+            if (search->visited.keys[child->slot] != child->key) {
+                worker->duplicates++;
+            } else {
+                success = false;
+            }
+
+            free(child->data);
+        }
+
+        worker->children.count = 0;
+    }
+
+    return success;
+}
+
+static bool c8_search_nodes_add(Chip8SearchNodes *nodes, const Chip8SearchNode *node)
+{
+    if (nodes->count == nodes->capacity) {
+        size_t capacity = nodes->capacity == 0 ? 64 : nodes->capacity * 2;
+        Chip8SearchNode *resized = realloc(nodes->nodes, capacity * sizeof(Chip8SearchNode));
+
+        if (resized == NULL) {
+            return false;
+        }
+
+        nodes->nodes = resized;
+        nodes->capacity = capacity;
+    }
+
+    nodes->nodes[nodes->count++] = *node;
+
+    return true;
+}
+
+static void c8_search_nodes_free(Chip8SearchNodes *nodes)
+{
+    for (size_t k = 0; k < nodes->count; k++) {
+        free(nodes->nodes[k].data);
+    }
+
+    free(nodes->nodes);
+    nodes->nodes = NULL;
+    nodes->count = 0;
+    nodes->capacity = 0;
+}
+
+static int c8_search_compare_key(const void *a, const void *b)
+{
+    uint64_t key_a = ((const Chip8SearchNode *)a)->key;
+    uint64_t key_b = ((const Chip8SearchNode *)b)->key;
+
+    return (key_a > key_b) - (key_a < key_b);
+}
+
+/* Highest score first, ties broken by key */
+static int c8_search_compare_score(const void *a, const void *b)
+{
+    const Chip8SearchNode *node_a = a;
+    const Chip8SearchNode *node_b = b;
+
+    if (node_a->score != node_b->score) {
+        return node_a->score < node_b->score ? 1 : -1;
+    }
+
+    return c8_search_compare_key(a, b);
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+#ifndef C8_CHIP8_SEARCH_H
+#define C8_CHIP8_SEARCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "chip8_core.h"
+
+/* Searches for a sequence of inputs which takes a start state to one that
+ * satisfies an objective. Each input is a bitmask of held keys which is
+ * applied for frames_per_input frames before the next is chosen.
+ *
+ * States are explored a level at a time, breadth first or keeping only the
+ * beam_width best scoring states of each level. Nodes are stored compactly
+ * as the non-memory part of Chip8 plus the pages of memory which differ
+ * from the start state, and states already seen are skipped using a hash
+ * of both. Levels are expanded by num_threads threads which steal work
+ * from each other. Results don't depend on the number of threads. */
+
+#define C8_SEARCH_PAGE_SIZE 256
+#define C8_SEARCH_PAGES (C8_MEMORY_SIZE / C8_SEARCH_PAGE_SIZE)
+#define C8_SEARCH_MAX_STATES_DEFAULT (1 << 20)
+
+typedef enum {
+    C8_SEARCH_BFS,
+    C8_SEARCH_BEAM
+} Chip8SearchStrategy;
+
+typedef bool (*Chip8SearchGoalFn)(const Chip8 *chip8, void *user_data);
+/* Higher scores are kept when beam searching */
+typedef double (*Chip8SearchScoreFn)(const Chip8 *chip8, void *user_data);
+
+typedef struct {
+    Chip8SearchStrategy strategy;
+    int beam_width;
+    int max_depth;
+    int frames_per_input;
+    int instr_per_frame;
+    /* Key bitmasks tried from each state. When NULL no keys and each
+     * key on its own are tried. */
+    const uint16_t *inputs;
+    int num_inputs;
+    int num_threads;
+    /* The search stops once this many distinct states have been seen */
+    size_t max_states;
+    /* The objective is goal when set, otherwise the byte at goal_address
+     * equalling goal_value, or the display hash equalling
+     * goal_display_hash when goal_display is set */
+    Chip8SearchGoalFn goal;
+    int goal_address;
+    uint8_t goal_value;
+    bool goal_display;
+    uint64_t goal_display_hash;
+    /* Beam search scores with score when set, otherwise by the byte at
+     * score_address, or in breadth first order if that is -1 */
+    Chip8SearchScoreFn score;
+    int score_address;
+    void *user_data;
+} Chip8SearchConfig;
+
+typedef struct {
+    bool found;
+    /* Set when the search ended because max_states was reached */
+    bool state_limit;
+    int depth;
+    /* The depth inputs leading to the goal */
+    uint16_t *inputs;
+    uint64_t expanded;
+    uint64_t duplicates;
+} Chip8SearchResult;
+
+void c8_search_default_config(Chip8SearchConfig *config);
+bool c8_search(const Chip8 *start, const Chip8SearchConfig *config, Chip8SearchResult *result);
+void c8_search_result_free(Chip8SearchResult *result);
+
+#endif
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* Records frames and reads them back, checking every pixel survives.
+ * Vertical stripes 8 pixels wide alternate zero and non-zero bytes,
+ * the frame which encodes to the longest payload. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "chip8.h"
+#include "chip8_record.h"
+
+static bool c8_test_round_trip(Chip8 *chip8, uint64_t pattern, int num_frames);
+
+int main(void)
+{
+    Chip8 *chip8 = c8_alloc_aligned(sizeof(Chip8));
+
+    if (chip8 == NULL) {
+        C8_LOG_ERROR("%s", "Unable to allocate memory");
+        return EXIT_FAILURE;
+    }
+
+    c8_init(chip8);
+
+    bool passed = c8_test_round_trip(chip8, 0xFF00FF00FF00FF00ULL, 1) &&
+                  c8_test_round_trip(chip8, 0x00FF00FF00FF00FFULL, 2);
+
+    free(chip8);
+    printf("%s\n", passed ? "Record round trip passed" : "Record round trip FAILED");
+
+    return passed ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Records num_frames frames, the last filled with pattern and any before
+ * it with the inverse, so later frames are encoded as a delta */
+static bool c8_test_round_trip(Chip8 *chip8, uint64_t pattern, int num_frames)
+{
+    char path[] = "/tmp/c8-test-record-XXXXXX";
+    int fd = mkstemp(path);
+
+    if (fd == -1) {
+        C8_LOG_ERROR("%s", "Unable to create temporary file");
+        return false;
+    }
+
+    close(fd);
+
+    Chip8Recorder *recorder = malloc(sizeof(Chip8Recorder));
+    Chip8RecordReader *reader = malloc(sizeof(Chip8RecordReader));
+    bool passed = recorder != NULL && reader != NULL && c8_record_init(recorder, path);
+
+    if (passed) {
+        for (int frame = 0; frame < num_frames; frame++) {
+            uint64_t word = frame == num_frames - 1 ? pattern : ~pattern;
+
+            for (size_t k = 0; k < C8_DISPLAY_PLANES * C8_DISPLAY_MAX_HEIGHT * C8_DISPLAY_ROW_WORDS; k++) {
+                (&chip8->display[0][0][0])[k] = word;
+            }
+
+            c8_record_frame(recorder, chip8, (uint32_t)frame);
+        }
+
+        c8_record_free(recorder);
+        passed = !recorder->write_error && recorder->frames_written == (uint32_t)num_frames &&
+                 c8_record_reader_init(reader, path);
+    }
+
+    if (passed) {
+        for (int frame = 0; frame < num_frames && passed; frame++) {
+            passed = c8_record_read_frame(reader) == 1;
+        }
+
+        for (int y = 0; y < C8_DISPLAY_MAX_HEIGHT && passed; y++) {
+            for (int x = 0; x < C8_DISPLAY_MAX_WIDTH && passed; x++) {
+                passed = c8_record_pixel(reader, x, y) == c8_display_pixel(chip8, x, y);
+            }
+        }
+
+        passed = passed && c8_record_read_frame(reader) == 0;
+        c8_record_reader_free(reader);
+    }
+
+    unlink(path);
+    free(recorder);
+    free(reader);
+
+    return passed;
+}
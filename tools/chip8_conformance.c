@@ -0,0 +1,727 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* Runs each ROM in a manifest with scripted input, hashing the display and
+ * registers at checkpoints and comparing them with golden values. Every
+ * ROM is run with each engine, in parallel across cores. The manifest is
+ * line based, paths being relative to the manifest:
+ *
+ *   # comment
+ *   rom NAME PATH [profile=PROFILE] [ipf=INSTRUCTIONS] [seed=SEED]
+ *   keys CYCLE MASK
+ *   check CYCLE [DISPLAY_HASH REGISTER_HASH]
+ *
+ * keys holds the keys in MASK, bit n being key n, from CYCLE onwards and
+ * check hashes the state once CYCLE instructions have run. Timers are
+ * updated every ipf instructions. Cycles spent waiting on Fx0A are counted
+ * so scripted input can arrive. With --generate the manifest is printed
+ * with the hashes from the interpreter engine filled in. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+#include "chip8.h"
+
+#define C8_CONF_LINE_MAX 4096
+#define C8_CONF_IPF_DEFAULT 10
+#define C8_CONF_THREADS_MAX 256
+
+typedef enum {
+    C8_CONF_ENGINE_INTERP,
+    C8_CONF_ENGINE_FUSED,
+    C8_CONF_ENGINE_TIERED,
+    C8_CONF_ENGINE_NUM
+} Chip8ConfEngine;
+
+typedef struct {
+    uint64_t cycle;
+    uint16_t keys;
+} Chip8ConfInput;
+
+typedef struct {
+    uint64_t cycle;
+    bool has_golden;
+    uint64_t display_hash;
+    uint64_t register_hash;
+    /* Line of the manifest the check came from */
+    int line;
+} Chip8ConfCheck;
+
+typedef struct {
+    char *name;
+    char *path;
+    Chip8Profile profile;
+    int instr_per_frame;
+    uint64_t seed;
+    Chip8ConfInput *inputs;
+    int num_inputs;
+    Chip8ConfCheck *checks;
+    int num_checks;
+} Chip8ConfTest;
+
+/* The hashes produced by one test run with one engine */
+typedef struct {
+    const Chip8ConfTest *test;
+    Chip8ConfEngine engine;
+    bool error;
+    uint64_t *display_hashes;
+    uint64_t *register_hashes;
+} Chip8ConfRun;
+
+typedef struct {
+    Chip8ConfRun *runs;
+    int num_runs;
+    int next_run;
+} Chip8ConfQueue;
+
+typedef struct {
+    char **lines;
+    int num_lines;
+    Chip8ConfTest *tests;
+    int num_tests;
+} Chip8ConfManifest;
+
+static const char *c8_conf_engine_names[C8_CONF_ENGINE_NUM] = { "interp", "fused", "tiered" };
+
+static bool c8_conf_parse_manifest(const char *path, Chip8ConfManifest *manifest);
+static bool c8_conf_parse_line(Chip8ConfManifest *manifest, char *line, int line_num,
+                               const char *dir, size_t dir_length);
+static bool c8_conf_parse_u64(const char *string, uint64_t *value);
+static void *c8_conf_grow(void *array, int count, size_t size);
+static void c8_conf_free_manifest(Chip8ConfManifest *manifest);
+static void *c8_conf_worker(void *arg);
+static void c8_conf_run(Chip8ConfRun *run);
+static int c8_conf_report(const Chip8ConfManifest *manifest, const Chip8ConfRun *runs, int num_runs);
+static void c8_conf_generate(const Chip8ConfManifest *manifest, const Chip8ConfRun *runs, int num_runs);
+static void c8_conf_print_usage(void);
+
+int main(int argc, char *argv[])
+{
+    struct option conformance_options[] = {
+        { "engine"  , required_argument, 0, 'e' },
+        { "generate", no_argument      , 0, 'g' },
+        { "help"    , no_argument      , 0, 'h' },
+        { "jobs"    , required_argument, 0, 'j' },
+        { 0, 0, 0, 0 }
+    };
+
+    bool engines[C8_CONF_ENGINE_NUM] = { true, true, true };
+    bool generate = false;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int num_threads = cores > 0 ? cores : 1;
+    int ch;
+
+    while ((ch = getopt_long(argc, argv, "e:ghj:", conformance_options, NULL)) != -1) {
+        switch (ch) {
+            case 'e': {
+                int engine = 0;
+
+                while (engine < C8_CONF_ENGINE_NUM &&
+                       strcmp(optarg, c8_conf_engine_names[engine]) != 0) {
+                    engine++;
+                }
+
+                if (engine == C8_CONF_ENGINE_NUM) {
+                    fprintf(stderr, "Invalid value passed for engine: %s, "
+                                    "engine must be one of interp, fused or tiered\n", optarg);
+                    return 1;
+                }
+
+                memset(engines, 0, sizeof(engines));
+                engines[engine] = true;
+                break;
+            }
+            case 'g': {
+                generate = true;
+                break;
+            }
+            case 'h': {
+                c8_conf_print_usage();
+                return 0;
+            }
+            case 'j': {
+                num_threads = atoi(optarg);
+
+                if (num_threads < 1 || num_threads > C8_CONF_THREADS_MAX) {
+                    fprintf(stderr, "Invalid value passed for jobs: %s\n", optarg);
+                    return 1;
+                }
+
+                break;
+            }
+            default: {
+                c8_conf_print_usage();
+                return 1;
+            }
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "No manifest file path provided\n");
+        c8_conf_print_usage();
+        return 1;
+    }
+
+    if (generate) {
+        /* Golden values always come from the reference interpreter */
+        memset(engines, 0, sizeof(engines));
+        engines[C8_CONF_ENGINE_INTERP] = true;
+    }
+
+    Chip8ConfManifest manifest;
+
+    if (!c8_conf_parse_manifest(argv[optind], &manifest)) {
+        return 1;
+    }
+
+    Chip8ConfQueue queue = { NULL, 0, 0 };
+    queue.runs = calloc((size_t)manifest.num_tests * C8_CONF_ENGINE_NUM, sizeof(Chip8ConfRun));
+
+    if (queue.runs == NULL && manifest.num_tests > 0) {
+        C8_LOG_ERROR("%s", "Unable to allocate test runs");
+        c8_conf_free_manifest(&manifest);
+        return 1;
+    }
+
+    for (int t = 0; t < manifest.num_tests; t++) {
+        for (int engine = 0; engine < C8_CONF_ENGINE_NUM; engine++) {
+            if (engines[engine]) {
+                queue.runs[queue.num_runs].test = &manifest.tests[t];
+                queue.runs[queue.num_runs].engine = engine;
+                queue.num_runs++;
+            }
+        }
+    }
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    pthread_t threads[C8_CONF_THREADS_MAX];
+    int started = 0;
+
+    num_threads = MIN(num_threads, MAX(queue.num_runs, 1));
+
+    /* The main thread is a worker too, so any thread that fails to start
+     * only makes the run slower */
+    while (started < num_threads - 1 &&
+           pthread_create(&threads[started], NULL, c8_conf_worker, &queue) == 0) {
+        started++;
+    }
+
+    c8_conf_worker(&queue);
+
+    for (int k = 0; k < started; k++) {
+        pthread_join(threads[k], NULL);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    int status = 0;
+
+    if (generate) {
+        c8_conf_generate(&manifest, queue.runs, queue.num_runs);
+    } else {
+        status = c8_conf_report(&manifest, queue.runs, queue.num_runs);
+        fprintf(stderr, "%d runs on %d threads in %.3f seconds\n", queue.num_runs, num_threads,
+                (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9);
+    }
+
+    for (int k = 0; k < queue.num_runs; k++) {
+        free(queue.runs[k].display_hashes);
+        free(queue.runs[k].register_hashes);
+        status |= queue.runs[k].error;
+    }
+
+    free(queue.runs);
+    c8_conf_free_manifest(&manifest);
+
+    return status;
+}
+
+static bool c8_conf_parse_manifest(const char *path, Chip8ConfManifest *manifest)
+{
+    memset(manifest, 0, sizeof(Chip8ConfManifest));
+
+    FILE *file = fopen(path, "r");
+
+    if (file == NULL) {
+        fprintf(stderr, "Unable to open manifest %s - %s\n", path, strerror(errno));
+        return false;
+    }
+
+    const char *separator = strrchr(path, '/');
+    size_t dir_length = separator != NULL ? (size_t)(separator - path) + 1 : 0;
+    char buffer[C8_CONF_LINE_MAX];
+    bool success = true;
+
+    while (success && fgets(buffer, sizeof(buffer), file) != NULL) {
+        char **lines = c8_conf_grow(manifest->lines, manifest->num_lines, sizeof(char *));
+
+        if (lines == NULL) {
+            C8_LOG_ERROR("%s", "Unable to allocate manifest");
+            success = false;
+            break;
+        }
+
+        manifest->lines = lines;
+
+        if ((lines[manifest->num_lines++] = strdup(buffer)) == NULL) {
+            C8_LOG_ERROR("%s", "Unable to allocate manifest");
+            success = false;
+            break;
+        }
+
+        success = c8_conf_parse_line(manifest, buffer, manifest->num_lines, path, dir_length);
+    }
+
+    fclose(file);
+
+    if (!success) {
+        c8_conf_free_manifest(manifest);
+    }
+
+    return success;
+}
+
+static bool c8_conf_parse_line(Chip8ConfManifest *manifest, char *line, int line_num,
+                               const char *dir, size_t dir_length)
+{
+    const char *whitespace = " \t\r\n";
+    char *save_ptr;
+    char *command = strtok_r(line, whitespace, &save_ptr);
+    Chip8ConfTest *test = manifest->num_tests > 0 ? &manifest->tests[manifest->num_tests - 1] : NULL;
+
+    if (command == NULL || command[0] == '#') {
+        return true;
+    }
+
+    if (strcmp(command, "rom") == 0) {
+        char *name = strtok_r(NULL, whitespace, &save_ptr);
+        char *path = strtok_r(NULL, whitespace, &save_ptr);
+
+        if (name == NULL || path == NULL) {
+            fprintf(stderr, "%d: rom requires a name and path\n", line_num);
+            return false;
+        }
+
+        Chip8ConfTest *tests = c8_conf_grow(manifest->tests, manifest->num_tests, sizeof(Chip8ConfTest));
+
+        if (tests == NULL) {
+            C8_LOG_ERROR("%s", "Unable to allocate manifest");
+            return false;
+        }
+
+        manifest->tests = tests;
+        test = &tests[manifest->num_tests++];
+        memset(test, 0, sizeof(Chip8ConfTest));
+        test->profile = C8_PROFILE_DEFAULT;
+        test->instr_per_frame = C8_CONF_IPF_DEFAULT;
+        test->name = strdup(name);
+        test->path = malloc(dir_length + strlen(path) + 1);
+
+        if (test->name == NULL || test->path == NULL) {
+            C8_LOG_ERROR("%s", "Unable to allocate manifest");
+            return false;
+        }
+
+        if (path[0] == '/') {
+            strcpy(test->path, path);
+        } else {
+            memcpy(test->path, dir, dir_length);
+            strcpy(test->path + dir_length, path);
+        }
+
+        char *option;
+
+        while ((option = strtok_r(NULL, whitespace, &save_ptr)) != NULL) {
+            uint64_t value;
+
+            if (strncmp(option, "profile=", 8) == 0 &&
+                c8_parse_profile(option + 8, &test->profile)) {
+                /* Parsed into test */
+            } else if (strncmp(option, "ipf=", 4) == 0 &&
+                       c8_conf_parse_u64(option + 4, &value) && value > 0 && value <= INT32_MAX) {
+                test->instr_per_frame = value;
+            } else if (strncmp(option, "seed=", 5) == 0 &&
+                       c8_conf_parse_u64(option + 5, &test->seed)) {
+                /* Parsed into test */
+            } else {
+                fprintf(stderr, "%d: invalid rom option %s\n", line_num, option);
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    if (test == NULL) {
+        fprintf(stderr, "%d: %s must follow a rom line\n", line_num, command);
+        return false;
+    }
+
+    uint64_t cycle;
+    char *cycle_string = strtok_r(NULL, whitespace, &save_ptr);
+
+    if (cycle_string == NULL || !c8_conf_parse_u64(cycle_string, &cycle)) {
+        fprintf(stderr, "%d: %s requires a cycle\n", line_num, command);
+        return false;
+    }
+
+    if (strcmp(command, "keys") == 0) {
+        uint64_t keys;
+        char *keys_string = strtok_r(NULL, whitespace, &save_ptr);
+
+        if (keys_string == NULL || !c8_conf_parse_u64(keys_string, &keys) || keys > UINT16_MAX) {
+            fprintf(stderr, "%d: keys requires a 16 bit mask\n", line_num);
+            return false;
+        }
+
+        if (test->num_inputs > 0 && test->inputs[test->num_inputs - 1].cycle > cycle) {
+            fprintf(stderr, "%d: keys must be in cycle order\n", line_num);
+            return false;
+        }
+
+        Chip8ConfInput *inputs = c8_conf_grow(test->inputs, test->num_inputs, sizeof(Chip8ConfInput));
+
+        if (inputs == NULL) {
+            C8_LOG_ERROR("%s", "Unable to allocate manifest");
+            return false;
+        }
+
+        test->inputs = inputs;
+        inputs[test->num_inputs].cycle = cycle;
+        inputs[test->num_inputs].keys = keys;
+        test->num_inputs++;
+
+        return true;
+    }
+
+    if (strcmp(command, "check") == 0) {
+        char *display_string = strtok_r(NULL, whitespace, &save_ptr);
+        char *register_string = strtok_r(NULL, whitespace, &save_ptr);
+        Chip8ConfCheck check = { cycle, false, 0, 0, line_num };
+
+        if (display_string != NULL) {
+            if (register_string == NULL ||
+                !c8_conf_parse_u64(display_string, &check.display_hash) ||
+                !c8_conf_parse_u64(register_string, &check.register_hash)) {
+                fprintf(stderr, "%d: check requires both a display and register hash\n", line_num);
+                return false;
+            }
+
+            check.has_golden = true;
+        }
+
+        if (test->num_checks > 0 && test->checks[test->num_checks - 1].cycle > cycle) {
+            fprintf(stderr, "%d: checks must be in cycle order\n", line_num);
+            return false;
+        }
+
+        Chip8ConfCheck *checks = c8_conf_grow(test->checks, test->num_checks, sizeof(Chip8ConfCheck));
+
+        if (checks == NULL) {
+            C8_LOG_ERROR("%s", "Unable to allocate manifest");
+            return false;
+        }
+
+        test->checks = checks;
+        checks[test->num_checks++] = check;
+
+        return true;
+    }
+
+    fprintf(stderr, "%d: unknown command %s\n", line_num, command);
+    return false;
+}
+
+/* Accepts decimal, or hex with a 0x prefix */
+static bool c8_conf_parse_u64(const char *string, uint64_t *value)
+{
+    char *end_ptr;
+
+    if (*string == '\0' || *string == '-') {
+        return false;
+    }
+
+    errno = 0;
+    unsigned long long parsed = strtoull(string, &end_ptr, 0);
+
+    if (errno != 0 || *end_ptr != '\0') {
+        return false;
+    }
+
+    *value = parsed;
+
+    return true;
+}
+
+/* Makes room for one more element, returning NULL and leaving array
+ * untouched if that isn't possible */
+static void *c8_conf_grow(void *array, int count, size_t size)
+{
+    return realloc(array, (count + 1) * size);
+}
+
+static void c8_conf_free_manifest(Chip8ConfManifest *manifest)
+{
+    for (int k = 0; k < manifest->num_lines; k++) {
+        free(manifest->lines[k]);
+    }
+
+    for (int k = 0; k < manifest->num_tests; k++) {
+        free(manifest->tests[k].name);
+        free(manifest->tests[k].path);
+        free(manifest->tests[k].inputs);
+        free(manifest->tests[k].checks);
+    }
+
+    free(manifest->lines);
+    free(manifest->tests);
+    memset(manifest, 0, sizeof(Chip8ConfManifest));
+}
+
+static void *c8_conf_worker(void *arg)
+{
+    Chip8ConfQueue *queue = arg;
+    int index;
+
+    while ((index = __atomic_fetch_add(&queue->next_run, 1, __ATOMIC_RELAXED)) < queue->num_runs) {
+        c8_conf_run(&queue->runs[index]);
+    }
+
+    return NULL;
+}
+
+/* Fused sequences and blocks are only run when they can't step over a timer
+ * update, input or checkpoint, so every engine sees events at the same cycle.
+ * Blocks are promoted after a single run so short tests reach every tier. */
+static void c8_conf_run(Chip8ConfRun *run)
+{
+    const Chip8ConfTest *test = run->test;
+    Chip8 *chip8 = c8_alloc_aligned(sizeof(Chip8));
+    Chip8FusionCache *fusion = NULL;
+    Chip8TierCache *tier = NULL;
+
+    run->display_hashes = calloc(MAX(test->num_checks, 1), sizeof(uint64_t));
+    run->register_hashes = calloc(MAX(test->num_checks, 1), sizeof(uint64_t));
+
+    if (run->engine == C8_CONF_ENGINE_FUSED) {
+        fusion = malloc(sizeof(Chip8FusionCache));
+    } else if (run->engine == C8_CONF_ENGINE_TIERED) {
+        tier = malloc(sizeof(Chip8TierCache));
+    }
+
+    if (chip8 == NULL || run->display_hashes == NULL || run->register_hashes == NULL ||
+        (run->engine == C8_CONF_ENGINE_FUSED && fusion == NULL) ||
+        (run->engine == C8_CONF_ENGINE_TIERED && tier == NULL)) {
+        C8_LOG_ERROR("Unable to allocate run of %s", test->name);
+        run->error = true;
+        free(chip8);
+        free(fusion);
+        free(tier);
+        return;
+    }
+
+    c8_init(chip8);
+    c8_seed(chip8, test->seed);
+    c8_set_profile(chip8, test->profile);
+
+    if (fusion != NULL) {
+        c8_fusion_init(fusion);
+    } else if (tier != NULL) {
+        c8_tier_init(tier, 1);
+    }
+
+    if (!c8_load_rom_file(chip8, test->path)) {
+        run->error = true;
+        free(chip8);
+        free(fusion);
+        free(tier);
+        return;
+    }
+
+    uint64_t next_frame = test->instr_per_frame;
+    int input = 0;
+    int check = 0;
+
+    while (check < test->num_checks) {
+        uint64_t cycles = chip8->cycles;
+
+        if (input < test->num_inputs && test->inputs[input].cycle <= cycles) {
+            for (uint8_t key = 0; key < C8_KEY_NUM; key++) {
+                bool pressed = (test->inputs[input].keys >> key) & 0x1;
+
+                if (pressed != chip8->input_keys[key]) {
+                    c8_key_event(chip8, key, pressed);
+                }
+            }
+
+            input++;
+            continue;
+        }
+
+        if (test->checks[check].cycle <= cycles) {
+            run->display_hashes[check] = c8_display_hash(chip8);
+            run->register_hashes[check] = c8_register_hash(chip8);
+            check++;
+            continue;
+        }
+
+        if (next_frame <= cycles) {
+            c8_update_timers(chip8);
+            next_frame += test->instr_per_frame;
+            continue;
+        }
+
+        uint64_t next_event = MIN(next_frame, test->checks[check].cycle);
+
+        if (input < test->num_inputs) {
+            next_event = MIN(next_event, test->inputs[input].cycle);
+        }
+
+        int executed;
+
+        if (fusion != NULL && next_event - cycles >= C8_FUSION_MAX_INSTRUCTIONS) {
+            executed = c8_run_fused(chip8, fusion);
+        } else if (tier != NULL) {
+            executed = c8_run_tiered(chip8, tier, (int)MIN(next_event - cycles, INT_MAX));
+        } else {
+            executed = c8_run_cycle(chip8);
+
+            if (fusion != NULL) {
+                c8_fusion_note_write(fusion, chip8);
+            }
+        }
+
+        if (executed == 0) {
+            chip8->cycles++;
+        }
+    }
+
+    free(chip8);
+    free(fusion);
+    free(tier);
+}
+
+/* Prints a line for each run, returning non-zero if any failed */
+static int c8_conf_report(const Chip8ConfManifest *manifest, const Chip8ConfRun *runs, int num_runs)
+{
+    int passed = 0;
+    int failed = 0;
+    int missing = 0;
+
+    for (int k = 0; k < num_runs; k++) {
+        const Chip8ConfRun *run = &runs[k];
+        const Chip8ConfTest *test = run->test;
+        const char *engine = c8_conf_engine_names[run->engine];
+        bool pass = !run->error;
+
+        for (int c = 0; c < test->num_checks && pass; c++) {
+            const Chip8ConfCheck *check = &test->checks[c];
+
+            if (!check->has_golden) {
+                missing++;
+                continue;
+            }
+
+            if (run->display_hashes[c] != check->display_hash ||
+                run->register_hashes[c] != check->register_hash) {
+                printf("FAIL %s %s: cycle %" PRIu64 " (line %d) display 0x%016" PRIx64
+                       " expected 0x%016" PRIx64 ", registers 0x%016" PRIx64
+                       " expected 0x%016" PRIx64 "\n",
+                       test->name, engine, check->cycle, check->line,
+                       run->display_hashes[c], check->display_hash,
+                       run->register_hashes[c], check->register_hash);
+                pass = false;
+            }
+        }
+
+        if (run->error) {
+            printf("FAIL %s %s: unable to run\n", test->name, engine);
+        } else if (pass) {
+            printf("PASS %s %s\n", test->name, engine);
+        }
+
+        passed += pass;
+        failed += !pass;
+    }
+
+    printf("%d passed, %d failed", passed, failed);
+
+    if (missing > 0) {
+        printf(", %d checks without golden values, see --generate", missing);
+    }
+
+    printf(" (%d ROMs)\n", manifest->num_tests);
+
+    return failed > 0 ? 1 : 0;
+}
+
+static void c8_conf_generate(const Chip8ConfManifest *manifest, const Chip8ConfRun *runs, int num_runs)
+{
+    int line = 1;
+
+    for (int k = 0; k < num_runs; k++) {
+        const Chip8ConfRun *run = &runs[k];
+        const Chip8ConfTest *test = run->test;
+
+        for (int c = 0; c < test->num_checks; c++) {
+            const Chip8ConfCheck *check = &test->checks[c];
+
+            for (; line < check->line; line++) {
+                fputs(manifest->lines[line - 1], stdout);
+            }
+
+            printf("check %" PRIu64 " 0x%016" PRIx64 " 0x%016" PRIx64 "\n", check->cycle,
+                   run->display_hashes[c], run->register_hashes[c]);
+            line++;
+        }
+    }
+
+    for (; line <= manifest->num_lines; line++) {
+        fputs(manifest->lines[line - 1], stdout);
+    }
+}
+
+static void c8_conf_print_usage(void)
+{
+    const char *help_msg =
+"\n\
+Usage:\n\
+chip8-conformance [OPTIONS] MANIFEST\n\
+\n\
+OPTIONS:\n\
+-e, --engine=ENGINE      Only run ENGINE, one of interp, fused or tiered.\n\
+                         Default: all of them.\n\
+-g, --generate           Print MANIFEST with the hashes from the interp\n\
+                         engine filled in, rather than checking them.\n\
+-h, --help               Print this message.\n\
+-j, --jobs=COUNT         Run COUNT ROMs at once. Default: one a core.\n\
+\n\
+";
+
+    printf("%s", help_msg);
+}
@@ -0,0 +1,975 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* Differential fuzzing of the fused and tiered engines against the
+ * reference interpreter. Each input is a ROM and the keys held each frame,
+ * which are run in lockstep on c8_run_cycle and one of the faster engines,
+ * comparing the whole interpreter state after each engine call. Inputs are
+ * laid out as:
+ *
+ *   byte 0       profile, modulo the number of profiles
+ *   byte 1       bit 0 engine, fused or tiered, bits 1-2 the tier
+ *                threshold - 1 and bits 4-7 instructions per frame - 1
+ *   bytes 2-3    seed
+ *   byte 4       number of frames of input
+ *   then         a 16 bit little endian key mask for each frame
+ *   then         the ROM
+ *
+ * The program area up to 8 KB is filled once with generated code, which
+ * each ROM is loaded over, so that jumps out of the ROM land in code
+ * rather than in zeroed memory. Besides random instructions it holds the
+ * sequences the engines treat specially, calls and returns, long jumps
+ * with Bnnn and writes into the code ahead.
+ *
+ * The reference run is also checked for things the core allows by wrapping
+ * around rather than treating as errors: calls deeper than the stack,
+ * returns with nothing on it, I reaching past the address space of the
+ * profile, which is 4 KB other than for XO-CHIP, and sprites drawn past
+ * the edge of the display. These are only counted while running the ROM
+ * itself, not the generated code, and are only failures when asked for.
+ *
+ * Runs are reset by copying back the parts of a pristine interpreter and
+ * caches which the last run changed, tracked in 256 byte pages, rather
+ * than reinitialising everything.
+ *
+ * Built with -DC8_FUZZ_LIBFUZZER this is a libFuzzer target, which aborts
+ * on a mismatch, or on a hazard when CHIP8_FUZZ_FATAL_HAZARDS is set.
+ * Otherwise it is a standalone program which runs files given to it, or
+ * random inputs when there are none. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <stddef.h>
+#include <inttypes.h>
+#include "chip8.h"
+
+#define C8_FUZZ_HEADER_SIZE 5
+#define C8_FUZZ_CYCLES_DEFAULT 1000
+/* Address space of the profiles before XO-CHIP */
+#define C8_FUZZ_CLASSIC_MEMORY_SIZE 0x1000
+/* End of the generated code. Code above 4 KB can only be reached
+ * through Bnnn, which reaches 0x10FE, or by running on from below. */
+#define C8_FUZZ_FILL_END (2 * C8_FUZZ_CLASSIC_MEMORY_SIZE)
+#define C8_FUZZ_PAGE_SHIFT 8
+#define C8_FUZZ_PAGE_SIZE (1 << C8_FUZZ_PAGE_SHIFT)
+#define C8_FUZZ_NUM_PAGES (C8_MEMORY_SIZE / C8_FUZZ_PAGE_SIZE)
+#define C8_FUZZ_PAGE_WORDS (C8_FUZZ_NUM_PAGES / 64)
+/* Furthest past its start a compiled block can reach */
+#define C8_FUZZ_BLOCK_REACH (C8_TIER_BLOCK_MAX_INSTRUCTIONS * 4)
+
+typedef enum {
+    C8_FUZZ_ENGINE_FUSED,
+    C8_FUZZ_ENGINE_TIERED,
+    C8_FUZZ_ENGINE_NUM
+} Chip8FuzzEngine;
+
+typedef enum {
+    C8_FUZZ_HAZARD_STACK_OVERFLOW,
+    C8_FUZZ_HAZARD_STACK_UNDERFLOW,
+    C8_FUZZ_HAZARD_I_RANGE,
+    C8_FUZZ_HAZARD_DISPLAY_OVERRUN,
+    C8_FUZZ_HAZARD_NUM
+} Chip8FuzzHazard;
+
+static const char *c8_fuzz_engine_names[C8_FUZZ_ENGINE_NUM] = { "fused", "tiered" };
+
+static const char *c8_fuzz_hazard_names[C8_FUZZ_HAZARD_NUM] = {
+    "stack overflow",
+    "stack underflow",
+    "I out of range",
+    "display overrun"
+};
+
+typedef struct {
+    Chip8 reference;
+    Chip8 engine;
+    /* State straight after c8_init with the generated code
+     * in memory, which every run starts from */
+    Chip8 pristine;
+    /* Hazards are only counted below this address */
+    uint32_t rom_end;
+    Chip8FusionCache fusion;
+    Chip8TierCache tier;
+    /* Pages of memory written or loaded since the last reset, and those
+     * written since the last comparison */
+    uint64_t dirty_memory[C8_FUZZ_PAGE_WORDS];
+    uint64_t unchecked_memory[C8_FUZZ_PAGE_WORDS];
+    bool memory_unchecked;
+    /* The reference has drawn since the last comparison */
+    bool display_unchecked;
+    /* Pages of the caches which may have been changed by the engine */
+    uint64_t dirty_code[C8_FUZZ_PAGE_WORDS];
+    uint64_t reference_errors;
+    uint64_t engine_errors;
+    int call_depth;
+    /* Bit for each Chip8FuzzHazard seen in the current run */
+    uint32_t hazards;
+    /* Overrides the engine given by each input when less than NUM */
+    Chip8FuzzEngine engine_override;
+    uint64_t max_cycles;
+} Chip8Fuzz;
+
+static Chip8Fuzz *c8_fuzz_create(void);
+static bool c8_fuzz_run(Chip8Fuzz *fuzz, const uint8_t *data, size_t size);
+static uint64_t c8_fuzz_next(uint64_t *state);
+static void c8_fuzz_generate(uint8_t *memory, uint32_t start, uint32_t end, uint64_t seed);
+static void c8_fuzz_reset(Chip8Fuzz *fuzz);
+static void c8_fuzz_mark(uint64_t *pages, uint32_t address, uint32_t length);
+static bool c8_fuzz_step(Chip8Fuzz *fuzz);
+static void c8_fuzz_check_hazards(Chip8Fuzz *fuzz, const Chip8 *chip8);
+static const char *c8_fuzz_compare(Chip8Fuzz *fuzz, bool full);
+static void c8_fuzz_report(Chip8Fuzz *fuzz, Chip8FuzzEngine engine, const char *field);
+static void c8_fuzz_count_error(const char *message, void *user_data);
+
+static Chip8Fuzz *c8_fuzz_create(void)
+{
+    Chip8Fuzz *fuzz = c8_alloc_aligned(sizeof(Chip8Fuzz));
+
+    if (fuzz == NULL) {
+        C8_LOG_ERROR("%s", "Unable to allocate fuzzing state");
+        return NULL;
+    }
+
+    memset(fuzz, 0, sizeof(Chip8Fuzz));
+    c8_init(&fuzz->pristine);
+    c8_fuzz_generate(fuzz->pristine.memory, C8_PROGRAM_MEMORY_START, C8_FUZZ_FILL_END, 0);
+    memcpy(&fuzz->reference, &fuzz->pristine, sizeof(Chip8));
+    memcpy(&fuzz->engine, &fuzz->pristine, sizeof(Chip8));
+    c8_fusion_init(&fuzz->fusion);
+    c8_tier_init(&fuzz->tier, 1);
+    fuzz->engine_override = C8_FUZZ_ENGINE_NUM;
+    fuzz->max_cycles = C8_FUZZ_CYCLES_DEFAULT;
+
+    return fuzz;
+}
+
+/* Returns false when the engine and reference disagree */
+static bool c8_fuzz_run(Chip8Fuzz *fuzz, const uint8_t *data, size_t size)
+{
+    c8_fuzz_reset(fuzz);
+
+    if (size < C8_FUZZ_HEADER_SIZE) {
+        return true;
+    }
+
+    Chip8Profile profile = data[0] % C8_PROFILE_NUM;
+    Chip8FuzzEngine engine = fuzz->engine_override < C8_FUZZ_ENGINE_NUM ? fuzz->engine_override
+                                                                         : (data[1] & 0x1);
+    int instr_per_frame = (data[1] >> 4) + 1;
+    size_t num_frames = MIN(data[4], (size - C8_FUZZ_HEADER_SIZE) / 2);
+    const uint8_t *keys = data + C8_FUZZ_HEADER_SIZE;
+    const uint8_t *rom = keys + 2 * num_frames;
+    size_t rom_size = MIN(size - C8_FUZZ_HEADER_SIZE - 2 * num_frames, C8_PROGRAM_MEMORY_SIZE);
+    Chip8 *reference = &fuzz->reference;
+    Chip8 *chip8 = &fuzz->engine;
+
+    fuzz->tier.threshold = ((data[1] >> 1) & 0x3) + 1;
+    fuzz->rom_end = C8_PROGRAM_MEMORY_START + rom_size;
+
+    /* Both interpreters are identical from here */
+    for (int k = 0; k < 2; k++) {
+        Chip8 *target = k == 0 ? reference : chip8;
+
+        c8_set_profile(target, profile);
+        c8_seed(target, data[2] | data[3] << 8);
+        c8_load_rom(target, rom, rom_size);
+        c8_set_error_handler(target, c8_fuzz_count_error,
+                             k == 0 ? &fuzz->reference_errors : &fuzz->engine_errors);
+    }
+
+    c8_fuzz_mark(fuzz->dirty_memory, C8_PROGRAM_MEMORY_START, rom_size);
+
+    uint64_t run = 0;
+    int frame_cycle = 0;
+    size_t frame = 0;
+
+    while (run < fuzz->max_cycles) {
+        if (frame_cycle == 0) {
+            uint16_t held = frame < num_frames ? keys[2 * frame] | keys[2 * frame + 1] << 8 : 0;
+
+            for (uint8_t key = 0; key < C8_KEY_NUM; key++) {
+                bool pressed = (held >> key) & 0x1;
+
+                if (pressed != reference->input_keys[key]) {
+                    c8_key_event(reference, key, pressed);
+                    c8_key_event(chip8, key, pressed);
+                }
+            }
+        }
+
+        int remaining = (int)MIN(fuzz->max_cycles - run, (uint64_t)(instr_per_frame - frame_cycle));
+        int executed;
+
+        if (engine == C8_FUZZ_ENGINE_TIERED) {
+            executed = c8_run_tiered(chip8, &fuzz->tier, remaining);
+        } else if (remaining >= C8_FUSION_MAX_INSTRUCTIONS) {
+            executed = c8_run_fused(chip8, &fuzz->fusion);
+        } else {
+            executed = c8_run_cycle(chip8);
+            c8_fusion_note_write(&fuzz->fusion, chip8);
+        }
+
+        chip8->idle = false;
+
+        if (executed == 0) {
+            /* Nothing is executed while waiting for a key */
+            if (!c8_waiting_for_key(reference)) {
+                c8_fuzz_report(fuzz, engine, "key wait");
+                return false;
+            }
+
+            executed = 1;
+        } else {
+            for (int k = 0; k < executed; k++) {
+                if (!c8_fuzz_step(fuzz)) {
+                    c8_fuzz_report(fuzz, engine, "instruction count");
+                    return false;
+                }
+            }
+        }
+
+        const char *field = c8_fuzz_compare(fuzz, false);
+
+        if (field != NULL) {
+            c8_fuzz_report(fuzz, engine, field);
+            return false;
+        }
+
+        run += executed;
+        frame_cycle += executed;
+
+        if (frame_cycle >= instr_per_frame) {
+            c8_update_timers(reference);
+            c8_update_timers(chip8);
+            frame_cycle = 0;
+            frame++;
+        }
+    }
+
+    const char *field = c8_fuzz_compare(fuzz, true);
+
+    if (field != NULL) {
+        c8_fuzz_report(fuzz, engine, field);
+        return false;
+    }
+
+    return true;
+}
+
+/* splitmix64 */
+static uint64_t c8_fuzz_next(uint64_t *state)
+{
+    uint64_t value = (*state += 0x9E3779B97F4A7C15ULL);
+
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBULL;
+
+    return value ^ (value >> 31);
+}
+
+/* Fills the addresses from start to end of memory with code generated
+ * from seed. Jumps back to a sequence's own start are encoded as 1nnn, as
+ * an assembler would, even past 4 KB where they can't get there. Jumps and
+ * calls below the program area are moved into it, and 0nnn becomes a
+ * return. */
+static void c8_fuzz_generate(uint8_t *memory, uint32_t start, uint32_t end, uint64_t seed)
+{
+    uint64_t state = seed;
+    uint32_t address = start;
+
+    while (address + 2 <= end) {
+        uint64_t r = c8_fuzz_next(&state);
+        uint16_t x = (r >> 8) & 0xF;
+        uint16_t y = (r >> 12) & 0xF;
+        uint16_t nn = (r >> 16) & 0xFF;
+        uint16_t nnn = (r >> 24) & 0xFFF;
+        uint16_t code[5];
+        int length;
+
+        switch ((r >> 36) % 8) {
+            case 3: {
+                /* 6xnn; 6ynn; Dxyn */
+                code[0] = 0x6000 | x << 8 | nn;
+                code[1] = 0x6000 | y << 8 | ((r >> 40) & 0xFF);
+                code[2] = 0xD000 | x << 8 | y << 4 | ((r >> 48) & 0xF);
+                length = 3;
+                break;
+            }
+            case 4: {
+                /* Set the delay timer, then wait for it: Fx07; 3x00; 1nnn */
+                uint16_t loop = (address + 4) & 0xFFF;
+
+                code[0] = 0x6000 | x << 8 | (nn & 0xF);
+                code[1] = 0xF015 | x << 8;
+                code[2] = 0xF007 | x << 8;
+                code[3] = 0x3000 | x << 8;
+                code[4] = 0x1000 | loop;
+                length = 5;
+                break;
+            }
+            case 5: {
+                /* Annn; Dxyn or Annn; Fx65 */
+                code[0] = 0xA000 | nnn;
+                code[1] = (r >> 40) & 0x1 ? 0xF065 | (x & 0x3) << 8
+                                          : 0xD000 | x << 8 | y << 4 | ((r >> 48) & 0xF);
+                length = 2;
+                break;
+            }
+            case 6: {
+                /* 7xnn; 3xnn or 4xnn */
+                code[0] = 0x7000 | x << 8 | nn;
+                code[1] = ((r >> 40) & 0x1 ? 0x3000 : 0x4000) | x << 8 | ((r >> 48) & 0xFF);
+                length = 2;
+                break;
+            }
+            case 7: {
+                uint32_t target = C8_PROGRAM_MEMORY_START + (r >> 48) % (end - C8_PROGRAM_MEMORY_START);
+
+                if ((r >> 40) & 0x1) {
+                    /* A long jump, setting both V0 and the Vx which Bxnn
+                     * adds under the jump quirk */
+                    target = MIN(target, 0xFFFU + 0xFF) & ~1U;
+                    uint16_t offset = target > 0xFFF ? target - 0xFFF : 0;
+                    uint16_t base = target - offset;
+
+                    code[0] = 0x6000 | offset;
+                    code[1] = 0x6000 | (base >> 8) << 8 | offset;
+                    code[2] = 0xB000 | base;
+                    length = 3;
+                } else if ((r >> 41) & 0x1) {
+                    /* Overwrite the code just ahead: Annn; Fx55 */
+                    code[0] = 0xA000 | ((address + 4 + ((r >> 42) & 0x7) * 2) & 0xFFF);
+                    code[1] = 0xF055 | (x & 0x3) << 8;
+                    length = 2;
+                } else {
+                    code[0] = 0x2000 | (target & 0xFFE);
+                    length = 1;
+                }
+
+                break;
+            }
+            default: {
+                uint16_t instr = r >> 48;
+                uint16_t op = instr & 0xF000;
+
+                if (op == 0x0000) {
+                    instr = 0x00EE;
+                } else if ((op == 0x1000 || op == 0x2000 || op == 0xB000) &&
+                           (instr & 0xFFF) < C8_PROGRAM_MEMORY_START) {
+                    instr |= C8_PROGRAM_MEMORY_START;
+                }
+
+                code[0] = instr;
+                length = 1;
+                break;
+            }
+        }
+
+        if (address + 2 * length > end) {
+            length = 1;
+            code[0] = 0x00EE;
+        }
+
+        for (int k = 0; k < length; k++) {
+            memory[address] = code[k] >> 8;
+            memory[address + 1] = code[k] & 0xFF;
+            address += 2;
+        }
+    }
+}
+
+/* Copies back everything before memory, which is small, and then only the
+ * pages of memory and the caches which the last run touched. A block can
+ * reach past the page it starts in, so live blocks are cleared one by one. */
+static void c8_fuzz_reset(Chip8Fuzz *fuzz)
+{
+    Chip8TierCache *tier = &fuzz->tier;
+
+    memcpy(&fuzz->reference, &fuzz->pristine, offsetof(Chip8, memory));
+    memcpy(&fuzz->engine, &fuzz->pristine, offsetof(Chip8, memory));
+
+    for (int page = 0; page < C8_FUZZ_NUM_PAGES; page++) {
+        uint32_t start = page << C8_FUZZ_PAGE_SHIFT;
+
+        if (fuzz->dirty_memory[page / 64] & (1ULL << (page % 64))) {
+            memcpy(fuzz->reference.memory + start, fuzz->pristine.memory + start, C8_FUZZ_PAGE_SIZE);
+            memcpy(fuzz->engine.memory + start, fuzz->pristine.memory + start, C8_FUZZ_PAGE_SIZE);
+        }
+
+        if (fuzz->dirty_code[page / 64] & (1ULL << (page % 64))) {
+            memset(fuzz->fusion.kind + start, 0, C8_FUZZ_PAGE_SIZE);
+            memset(tier->heat + start, 0, C8_FUZZ_PAGE_SIZE * sizeof(tier->heat[0]));
+        }
+    }
+
+    for (int k = 0; k < tier->num_blocks; k++) {
+        const Chip8Block *block = &tier->blocks[k];
+
+        tier->block_index[block->start] = 0;
+
+        for (int b = 0; b < block->length; b++) {
+            tier->coverage[(uint16_t)(block->start + b)] = 0;
+        }
+    }
+
+    tier->num_blocks = 0;
+    memset(tier->instructions, 0, sizeof(tier->instructions));
+    memset(tier->promotions, 0, sizeof(tier->promotions));
+    tier->demotions = 0;
+    memset(fuzz->fusion.fired, 0, sizeof(fuzz->fusion.fired));
+
+    memset(fuzz->dirty_memory, 0, sizeof(fuzz->dirty_memory));
+    memset(fuzz->unchecked_memory, 0, sizeof(fuzz->unchecked_memory));
+    memset(fuzz->dirty_code, 0, sizeof(fuzz->dirty_code));
+    fuzz->memory_unchecked = false;
+    fuzz->display_unchecked = false;
+    fuzz->reference_errors = 0;
+    fuzz->engine_errors = 0;
+    fuzz->call_depth = 0;
+    fuzz->hazards = 0;
+}
+
+/* Addresses wrap around the end of memory, as they do in the core */
+static void c8_fuzz_mark(uint64_t *pages, uint32_t address, uint32_t length)
+{
+    if (length == 0) {
+        return;
+    }
+
+    uint32_t first = address >> C8_FUZZ_PAGE_SHIFT;
+    uint32_t last = (address + length - 1) >> C8_FUZZ_PAGE_SHIFT;
+
+    for (uint32_t page = first; page <= last; page++) {
+        uint32_t wrapped = page % C8_FUZZ_NUM_PAGES;
+
+        pages[wrapped / 64] |= 1ULL << (wrapped % 64);
+    }
+}
+
+/* Runs one reference instruction, noting what it touches.
+ * Returns false if the reference was waiting for a key. */
+static bool c8_fuzz_step(Chip8Fuzz *fuzz)
+{
+    Chip8 *reference = &fuzz->reference;
+    uint16_t pc = reference->program_counter;
+
+    c8_fuzz_check_hazards(fuzz, reference);
+    c8_fuzz_mark(fuzz->dirty_code, pc, C8_FUZZ_BLOCK_REACH);
+    reference->write_length = 0;
+
+    if (c8_run_cycle(reference) == 0) {
+        return false;
+    }
+
+    reference->idle = false;
+
+    if (reference->update_display) {
+        reference->update_display = false;
+        fuzz->display_unchecked = true;
+    }
+
+    if (reference->write_length != 0) {
+        c8_fuzz_mark(fuzz->dirty_memory, reference->write_address, reference->write_length);
+        c8_fuzz_mark(fuzz->unchecked_memory, reference->write_address, reference->write_length);
+        fuzz->memory_unchecked = true;
+    }
+
+    return true;
+}
+
+/* Decodes the instruction about to run as execute_instruction would,
+ * including the unknown Exnn falling through to Fxnn */
+static void c8_fuzz_check_hazards(Chip8Fuzz *fuzz, const Chip8 *chip8)
+{
+    uint16_t pc = chip8->program_counter;
+    uint32_t hazards = 0;
+    uint16_t instr = chip8->memory[pc] << 8 | chip8->memory[(pc + 1) & C8_ADDRESS_MASK];
+    uint8_t x = (instr >> 8) & 0xF;
+    uint8_t y = (instr >> 4) & 0xF;
+    bool xo_chip = chip8->profile == C8_PROFILE_XOCHIP;
+    uint32_t limit = xo_chip ? C8_MEMORY_SIZE : C8_FUZZ_CLASSIC_MEMORY_SIZE;
+    uint32_t access = 0;
+
+    if ((instr & 0xF000) == 0xE000 && (instr & 0xFF) != 0x9E && (instr & 0xFF) != 0xA1) {
+        instr |= 0xF000;
+    }
+
+    switch (instr & 0xF000) {
+        case 0x0000: {
+            if (instr == 0x00EE) {
+                if (fuzz->call_depth == 0) {
+                    hazards |= 1 << C8_FUZZ_HAZARD_STACK_UNDERFLOW;
+                } else {
+                    fuzz->call_depth--;
+                }
+            }
+
+            break;
+        }
+        case 0x2000: {
+            if (fuzz->call_depth == C8_STACK_SIZE) {
+                hazards |= 1 << C8_FUZZ_HAZARD_STACK_OVERFLOW;
+            } else {
+                fuzz->call_depth++;
+            }
+
+            break;
+        }
+        case 0x5000: {
+            if (xo_chip && ((instr & 0xF) == 0x2 || (instr & 0xF) == 0x3)) {
+                access = (x <= y ? y - x : x - y) + 1;
+            }
+
+            break;
+        }
+        case 0xD000: {
+            /* SCHIP and XO-CHIP ROMs use Dxy0 for a 16x16 sprite of two
+             * bytes a row, which is checked as such though the core
+             * draws nothing for it */
+            bool large = (instr & 0xF) == 0 && chip8->profile != C8_PROFILE_CHIP8;
+            int rows = large ? 16 : instr & 0xF;
+            int width = large ? 16 : 8;
+            int planes = __builtin_popcount(chip8->plane_mask & ((1 << C8_DISPLAY_PLANES) - 1));
+
+            access = rows * (width / 8) * planes;
+
+            if (access > 0 &&
+                (chip8->register_V[x] % chip8->display_width + width > chip8->display_width ||
+                 chip8->register_V[y] % chip8->display_height + rows > chip8->display_height)) {
+                hazards |= 1 << C8_FUZZ_HAZARD_DISPLAY_OVERRUN;
+            }
+
+            break;
+        }
+        case 0xF000: {
+            switch (instr & 0xFF) {
+                case 0x02: {
+                    access = xo_chip && instr == 0xF002 ? C8_AUDIO_PATTERN_SIZE : 0;
+                    break;
+                }
+                case 0x33: {
+                    access = 3;
+                    break;
+                }
+                case 0x55:
+                case 0x65: {
+                    access = x + 1;
+                    break;
+                }
+            }
+
+            break;
+        }
+    }
+
+    if (access > 0 && (uint32_t)chip8->register_I + access > limit) {
+        hazards |= 1 << C8_FUZZ_HAZARD_I_RANGE;
+    }
+
+    /* The call depth is followed everywhere, but the generated
+     * code is only there to be run, not to be judged */
+    if (pc >= C8_PROGRAM_MEMORY_START && pc < fuzz->rom_end) {
+        fuzz->hazards |= hazards;
+    }
+}
+
+/* Returns the name of the first part of the state which differs, NULL if
+ * none. Flags which only tell the host something has changed are left out,
+ * as the engines clear them at different times. Unless full is set, only
+ * the display and memory the reference has changed since the last
+ * comparison are compared. */
+static const char *c8_fuzz_compare(Chip8Fuzz *fuzz, bool full)
+{
+    const Chip8 *a = &fuzz->reference;
+    const Chip8 *b = &fuzz->engine;
+
+    if (memcmp(a->register_V, b->register_V, sizeof(a->register_V)) != 0) {
+        return "V registers";
+    } else if (a->register_I != b->register_I) {
+        return "I";
+    } else if (a->program_counter != b->program_counter) {
+        return "program counter";
+    } else if (a->stack_pointer != b->stack_pointer ||
+               memcmp(a->stack, b->stack, sizeof(a->stack)) != 0) {
+        return "stack";
+    } else if (a->register_delay_timer != b->register_delay_timer ||
+               a->register_sound_timer != b->register_sound_timer) {
+        return "timers";
+    } else if (a->wait_key_V_reg != b->wait_key_V_reg) {
+        return "key wait";
+    } else if (a->random_state != b->random_state) {
+        return "random state";
+    } else if (a->cycles != b->cycles) {
+        return "cycles";
+    } else if (a->display_width != b->display_width || a->display_height != b->display_height ||
+               a->plane_mask != b->plane_mask ||
+               ((full || fuzz->display_unchecked) &&
+                memcmp(a->display, b->display, sizeof(a->display)) != 0)) {
+        return "display";
+    } else if (a->audio_pitch != b->audio_pitch ||
+               memcmp(a->audio_pattern, b->audio_pattern, sizeof(a->audio_pattern)) != 0) {
+        return "audio";
+    } else if (fuzz->reference_errors != fuzz->engine_errors) {
+        return "errors";
+    }
+
+    fuzz->display_unchecked = false;
+
+    if (!full && !fuzz->memory_unchecked) {
+        return NULL;
+    }
+
+    const uint64_t *pages = full ? fuzz->dirty_memory : fuzz->unchecked_memory;
+
+    for (int page = 0; page < C8_FUZZ_NUM_PAGES; page++) {
+        if (!(pages[page / 64] & (1ULL << (page % 64)))) {
+            continue;
+        }
+
+        uint32_t start = page << C8_FUZZ_PAGE_SHIFT;
+
+        if (memcmp(a->memory + start, b->memory + start, C8_FUZZ_PAGE_SIZE) != 0) {
+            return "memory";
+        }
+    }
+
+    memset(fuzz->unchecked_memory, 0, sizeof(fuzz->unchecked_memory));
+    fuzz->memory_unchecked = false;
+
+    return NULL;
+}
+
+/* Once the engine has gone its own way it may have touched anything,
+ * so the next reset restores everything */
+static void c8_fuzz_report(Chip8Fuzz *fuzz, Chip8FuzzEngine engine, const char *field)
+{
+    memset(fuzz->dirty_memory, 0xFF, sizeof(fuzz->dirty_memory));
+    memset(fuzz->dirty_code, 0xFF, sizeof(fuzz->dirty_code));
+
+    fprintf(stderr, "MISMATCH %s %s: %s differs after cycle %" PRIu64
+                    ", reference PC 0x%04X, engine PC 0x%04X\n",
+            c8_fuzz_engine_names[engine], c8_profile_name(fuzz->reference.profile), field,
+            fuzz->reference.cycles, fuzz->reference.program_counter,
+            fuzz->engine.program_counter);
+}
+
+static void c8_fuzz_count_error(const char *message, void *user_data)
+{
+    uint64_t *errors = user_data;
+
+    (void)message;
+
+    (*errors)++;
+}
+
+#ifdef C8_FUZZ_LIBFUZZER
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size);
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+    static Chip8Fuzz *fuzz = NULL;
+    static bool fatal_hazards = false;
+
+    if (fuzz == NULL) {
+        if ((fuzz = c8_fuzz_create()) == NULL) {
+            abort();
+        }
+
+        fatal_hazards = getenv("CHIP8_FUZZ_FATAL_HAZARDS") != NULL;
+    }
+
+    if (!c8_fuzz_run(fuzz, data, size)) {
+        abort();
+    }
+
+    if (fatal_hazards && fuzz->hazards != 0) {
+        for (int k = 0; k < C8_FUZZ_HAZARD_NUM; k++) {
+            if (fuzz->hazards & (1 << k)) {
+                fprintf(stderr, "HAZARD %s\n", c8_fuzz_hazard_names[k]);
+            }
+        }
+
+        abort();
+    }
+
+    return 0;
+}
+
+#else
+
+#include <errno.h>
+#include <getopt.h>
+#include <time.h>
+
+#define C8_FUZZ_RUNS_DEFAULT 100000
+#define C8_FUZZ_SIZE_DEFAULT 256
+#define C8_FUZZ_SIZE_MAX 0x10000
+
+static bool c8_fuzz_read_file(const char *path, uint8_t *buffer, size_t *size);
+static bool c8_fuzz_save_failure(const uint8_t *data, size_t size);
+static void c8_fuzz_print_usage(void);
+
+int main(int argc, char *argv[])
+{
+    struct option fuzz_options[] = {
+        { "cycles"       , required_argument, 0, 'c' },
+        { "engine"       , required_argument, 0, 'e' },
+        { "fatal-hazards", no_argument      , 0, 'H' },
+        { "help"         , no_argument      , 0, 'h' },
+        { "runs"         , required_argument, 0, 'r' },
+        { "seed"         , required_argument, 0, 's' },
+        { "size"         , required_argument, 0, 'z' },
+        { 0, 0, 0, 0 }
+    };
+
+    Chip8Fuzz *fuzz = c8_fuzz_create();
+
+    if (fuzz == NULL) {
+        return 1;
+    }
+
+    bool fatal_hazards = false;
+    long runs = C8_FUZZ_RUNS_DEFAULT;
+    uint64_t seed = time(NULL);
+    long max_size = C8_FUZZ_SIZE_DEFAULT;
+    int ch;
+
+    while ((ch = getopt_long(argc, argv, "c:e:Hhr:s:z:", fuzz_options, NULL)) != -1) {
+        switch (ch) {
+            case 'c': {
+                long cycles = atol(optarg);
+
+                if (cycles < 1) {
+                    fprintf(stderr, "Invalid value passed for cycles: %s\n", optarg);
+                    return 1;
+                }
+
+                fuzz->max_cycles = cycles;
+                break;
+            }
+            case 'e': {
+                int engine = 0;
+
+                while (engine < C8_FUZZ_ENGINE_NUM && strcmp(optarg, c8_fuzz_engine_names[engine]) != 0) {
+                    engine++;
+                }
+
+                if (engine == C8_FUZZ_ENGINE_NUM) {
+                    fprintf(stderr, "Invalid value passed for engine: %s, "
+                                    "engine must be one of fused or tiered\n", optarg);
+                    return 1;
+                }
+
+                fuzz->engine_override = engine;
+                break;
+            }
+            case 'H': {
+                fatal_hazards = true;
+                break;
+            }
+            case 'h': {
+                c8_fuzz_print_usage();
+                return 0;
+            }
+            case 'r': {
+                runs = atol(optarg);
+
+                if (runs < 1) {
+                    fprintf(stderr, "Invalid value passed for runs: %s\n", optarg);
+                    return 1;
+                }
+
+                break;
+            }
+            case 's': {
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            }
+            case 'z': {
+                max_size = atol(optarg);
+
+                if (max_size < C8_FUZZ_HEADER_SIZE || max_size > C8_FUZZ_SIZE_MAX) {
+                    fprintf(stderr, "Invalid value passed for size: %s\n", optarg);
+                    return 1;
+                }
+
+                break;
+            }
+            default: {
+                c8_fuzz_print_usage();
+                return 1;
+            }
+        }
+    }
+
+    static uint8_t data[C8_FUZZ_SIZE_MAX];
+    bool replay = optind < argc;
+    uint64_t hazard_runs[C8_FUZZ_HAZARD_NUM] = { 0 };
+    uint64_t random_state = seed;
+    long completed = 0;
+    int status = 0;
+
+    if (replay) {
+        runs = argc - optind;
+    } else {
+        fprintf(stderr, "Seed %" PRIu64 "\n", seed);
+    }
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    for (; completed < runs; completed++) {
+        size_t size;
+
+        if (replay) {
+            size = sizeof(data);
+
+            if (!c8_fuzz_read_file(argv[optind + completed], data, &size)) {
+                status = 1;
+                continue;
+            }
+        } else {
+            /* Every byte of the input is random */
+            size = C8_FUZZ_HEADER_SIZE + c8_fuzz_next(&random_state) % (max_size - C8_FUZZ_HEADER_SIZE + 1);
+
+            for (size_t k = 0; k < size; k += 8) {
+                uint64_t value = c8_fuzz_next(&random_state);
+                memcpy(data + k, &value, MIN(sizeof(value), size - k));
+            }
+        }
+
+        bool matched = c8_fuzz_run(fuzz, data, size);
+
+        for (int k = 0; k < C8_FUZZ_HAZARD_NUM; k++) {
+            hazard_runs[k] += (fuzz->hazards >> k) & 0x1;
+        }
+
+        if (replay && (!matched || fuzz->hazards != 0)) {
+            printf("%s:", argv[optind + completed]);
+
+            for (int k = 0; k < C8_FUZZ_HAZARD_NUM; k++) {
+                if (fuzz->hazards & (1 << k)) {
+                    printf(" %s,", c8_fuzz_hazard_names[k]);
+                }
+            }
+
+            printf(" %s\n", matched ? "matched" : "MISMATCH");
+        }
+
+        if (!matched || (fatal_hazards && fuzz->hazards != 0)) {
+            status = 1;
+
+            if (!replay) {
+                c8_fuzz_save_failure(data, size);
+                completed++;
+                break;
+            }
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9;
+
+    printf("%ld runs of up to %" PRIu64 " cycles in %.3f seconds, %.0f runs a second\n",
+           completed, fuzz->max_cycles, seconds, seconds > 0 ? completed / seconds : 0);
+
+    for (int k = 0; k < C8_FUZZ_HAZARD_NUM; k++) {
+        printf("  %-20s %" PRIu64 " runs\n", c8_fuzz_hazard_names[k], hazard_runs[k]);
+    }
+
+    free(fuzz);
+
+    return status;
+}
+
+static bool c8_fuzz_read_file(const char *path, uint8_t *buffer, size_t *size)
+{
+    FILE *file = fopen(path, "rb");
+
+    if (file == NULL) {
+        fprintf(stderr, "Unable to open file %s for reading - %s\n", path, strerror(errno));
+        return false;
+    }
+
+    *size = fread(buffer, 1, *size, file);
+    bool success = !ferror(file);
+
+    if (!success) {
+        fprintf(stderr, "Unable to read file %s\n", path);
+    }
+
+    fclose(file);
+
+    return success;
+}
+
+/* Named as libFuzzer names its crashes, so either can replay the other's */
+static bool c8_fuzz_save_failure(const uint8_t *data, size_t size)
+{
+    char path[32];
+
+    snprintf(path, sizeof(path), "crash-%016" PRIx64, c8_hash(data, size, 0));
+
+    FILE *file = fopen(path, "wb");
+
+    if (file == NULL || fwrite(data, 1, size, file) != size) {
+        fprintf(stderr, "Unable to write failing input to %s\n", path);
+
+        if (file != NULL) {
+            fclose(file);
+        }
+
+        return false;
+    }
+
+    fclose(file);
+    fprintf(stderr, "Failing input written to %s\n", path);
+
+    return true;
+}
+
+static void c8_fuzz_print_usage(void)
+{
+    const char *help_msg =
+"\n\
+Usage:\n\
+chip8-fuzz [OPTIONS] [FILE...]\n\
+\n\
+Runs each FILE as a fuzzing input, or random inputs when none are given,\n\
+writing the first which fails to crash-HASH.\n\
+\n\
+OPTIONS:\n\
+-c, --cycles=COUNT       Run each input for COUNT cycles. Default: 1000.\n\
+-e, --engine=ENGINE      Test ENGINE, fused or tiered, rather than the one\n\
+                         chosen by each input.\n\
+-H, --fatal-hazards      Fail on stack overflow, I out of range and the\n\
+                         like, rather than only counting them.\n\
+-h, --help               Print this message.\n\
+-r, --runs=COUNT         Run COUNT random inputs. Default: 100000.\n\
+-s, --seed=SEED          Seed for random inputs. Default: the time.\n\
+-z, --size=BYTES         Largest random input. Default: 256.\n\
+\n\
+";
+
+    printf("%s", help_msg);
+}
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* Lists the ROMs in a library along with their settings and analysis,
+ * which also fills the analysis cache, or packs a library into an
+ * archive which can be memory mapped as a single file. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include "chip8.h"
+#include "chip8_library.h"
+
+#define C8_CACHE_DIR_MAX 4096
+
+static bool c8_library_list(const Chip8Library *library);
+static void c8_library_print_flags(uint32_t flags);
+static void c8_library_print_usage(void);
+
+int main(int argc, char *argv[])
+{
+    struct option library_options[] = {
+        { "cache-dir", required_argument, 0, 'c' },
+        { "help"     , no_argument      , 0, 'h' },
+        { "no-cache" , no_argument      , 0, 'n' },
+        { 0, 0, 0, 0 }
+    };
+
+    char default_cache_dir[C8_CACHE_DIR_MAX];
+    const char *cache_dir = NULL;
+    bool use_cache = true;
+    int ch;
+
+    if (c8_library_default_cache_dir(default_cache_dir, sizeof(default_cache_dir))) {
+        cache_dir = default_cache_dir;
+    }
+
+    while ((ch = getopt_long(argc, argv, "c:hn", library_options, NULL)) != -1) {
+        switch (ch) {
+            case 'c': {
+                cache_dir = optarg;
+                break;
+            }
+            case 'h': {
+                c8_library_print_usage();
+                return 0;
+            }
+            case 'n': {
+                use_cache = false;
+                break;
+            }
+            default: {
+                c8_library_print_usage();
+                return 1;
+            }
+        }
+    }
+
+    int num_args = argc - optind;
+    const char *command = num_args > 0 ? argv[optind] : NULL;
+
+    if (command == NULL ||
+        !((strcmp(command, "list") == 0 && num_args == 2) ||
+          (strcmp(command, "pack") == 0 && num_args == 3))) {
+        c8_library_print_usage();
+        return 1;
+    }
+
+    Chip8Library library;
+
+    if (!c8_library_open(&library, argv[optind + 1], use_cache ? cache_dir : NULL)) {
+        return 1;
+    }
+
+    bool success = strcmp(command, "list") == 0 ? c8_library_list(&library)
+                                                : c8_library_pack(&library, argv[optind + 2]);
+
+    c8_library_close(&library);
+
+    return success ? 0 : 1;
+}
+
+/* One ROM a line: hash, size, profile, instruction rate, keymap, the
+ * instructions found by analysis and then name. Settings which aren't
+ * given by the library are printed as -. */
+static bool c8_library_list(const Chip8Library *library)
+{
+    for (size_t k = 0; k < library->num_roms; k++) {
+        const Chip8LibraryRom *rom = &library->roms[k];
+        Chip8RomAnalysis analysis;
+
+        if (!c8_library_analyse(library, rom, &analysis)) {
+            return false;
+        }
+
+        printf("%016" PRIx64 " %6zu %-6s ", rom->hash, rom->size,
+               rom->metadata.has_profile ? c8_profile_name(rom->metadata.profile) : "-");
+
+        if (rom->metadata.instr_per_sec > 0) {
+            printf("%6d ", rom->metadata.instr_per_sec);
+        } else {
+            printf("%6s ", "-");
+        }
+
+        printf("%-16s ", rom->metadata.keymap[0] != '\0' ? rom->metadata.keymap : "-");
+        c8_library_print_flags(analysis.flags);
+        printf(" %s\n", rom->name);
+
+        c8_library_analysis_free(&analysis);
+    }
+
+    return true;
+}
+
+static void c8_library_print_flags(uint32_t flags)
+{
+    static const struct {
+        uint32_t flag;
+        const char *name;
+    } flag_names[] = {
+        { C8_ANALYSIS_XOCHIP_OPCODES, "xochip"   },
+        { C8_ANALYSIS_SCHIP_OPCODES , "schip"    },
+        { C8_ANALYSIS_KEY_WAIT      , "key-wait" },
+        { C8_ANALYSIS_SOUND         , "sound"    },
+        { C8_ANALYSIS_MEMORY_WRITES , "writes"   }
+    };
+
+    char names[64] = "";
+
+    for (size_t k = 0; k < sizeof(flag_names) / sizeof(flag_names[0]); k++) {
+        if (flags & flag_names[k].flag) {
+            if (names[0] != '\0') {
+                strcat(names, ",");
+            }
+
+            strcat(names, flag_names[k].name);
+        }
+    }
+
+    printf("%-32s", names[0] != '\0' ? names : "-");
+}
+
+static void c8_library_print_usage(void)
+{
+    const char *help_msg =
+"\n\
+Usage:\n\
+chip8-library [OPTIONS] list LIBRARY\n\
+chip8-library [OPTIONS] pack LIBRARY ARCHIVE\n\
+\n\
+LIBRARY is a directory of ROMs or an archive written by pack.\n\
+\n\
+OPTIONS:\n\
+-c, --cache-dir=DIR    Cache ROM analysis in DIR.\n\
+                       Default: $XDG_CACHE_HOME/chip8 or ~/.cache/chip8.\n\
+-h, --help             Print this message.\n\
+-n, --no-cache         Don't read or write the analysis cache.\n\
+\n\
+";
+
+    printf("%s", help_msg);
+}
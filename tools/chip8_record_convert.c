@@ -0,0 +1,338 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* Converts a recording made with chip8 --record into a sequence of PNG
+ * images, one per recorded frame, or a 60 fps YUV4MPEG2 video in which
+ * each frame is repeated until the timer tick of the next one. */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include "chip8.h"
+#include "chip8_record.h"
+
+#define C8_CONVERT_SCALE_MAX 16
+/* Largest block a stored deflate block can hold */
+#define C8_PNG_STORED_BLOCK_MAX 65535
+
+static bool c8_convert_png(Chip8RecordReader *reader, const char *prefix, int scale);
+static bool c8_convert_y4m(Chip8RecordReader *reader, const char *path, int scale);
+static void c8_render_frame(const Chip8RecordReader *reader, int scale, uint32_t *rgb);
+static bool c8_write_png(const char *path, const uint32_t *rgb, int width, int height);
+static void c8_png_chunk(FILE *file, const char *type, const uint8_t *data, size_t length);
+static uint32_t c8_crc32(uint32_t crc, const uint8_t *data, size_t length);
+static void c8_put_u32(uint8_t *buffer, uint32_t value);
+
+int main(int argc, char *argv[])
+{
+    if (argc < 4 || argc > 5) {
+        fprintf(stderr, "Usage: %s png RECORDING PREFIX [SCALE]\n"
+                        "       %s y4m RECORDING OUTPUT [SCALE]\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    int scale = 1;
+
+    if (argc == 5) {
+        scale = atoi(argv[4]);
+
+        if (scale < 1 || scale > C8_CONVERT_SCALE_MAX) {
+            fprintf(stderr, "SCALE must be between 1 and %d\n", C8_CONVERT_SCALE_MAX);
+            return 1;
+        }
+    }
+
+    Chip8RecordReader reader;
+
+    if (!c8_record_reader_init(&reader, argv[2])) {
+        return 1;
+    }
+
+    bool success;
+
+    if (strcmp(argv[1], "png") == 0) {
+        success = c8_convert_png(&reader, argv[3], scale);
+    } else if (strcmp(argv[1], "y4m") == 0) {
+        success = c8_convert_y4m(&reader, argv[3], scale);
+    } else {
+        fprintf(stderr, "Unknown output format %s\n", argv[1]);
+        success = false;
+    }
+
+    c8_record_reader_free(&reader);
+
+    return success ? 0 : 1;
+}
+
+static bool c8_convert_png(Chip8RecordReader *reader, const char *prefix, int scale)
+{
+    uint32_t *rgb = malloc(sizeof(uint32_t) * C8_DISPLAY_MAX_WIDTH * C8_DISPLAY_MAX_HEIGHT *
+                           scale * scale);
+
+    if (rgb == NULL) {
+        C8_LOG_ERROR("Unable to allocate memory for scale %d", scale);
+        return false;
+    }
+
+    size_t path_length = strlen(prefix) + 16;
+    char *path = malloc(path_length);
+    int status;
+    uint32_t frame = 0;
+
+    while (path != NULL && (status = c8_record_read_frame(reader)) == 1) {
+        c8_render_frame(reader, scale, rgb);
+        snprintf(path, path_length, "%s%06u.png", prefix, (unsigned)frame++);
+
+        if (!c8_write_png(path, rgb, reader->width * scale, reader->height * scale)) {
+            status = -1;
+            break;
+        }
+    }
+
+    if (path == NULL || status == -1) {
+        C8_LOG_ERROR("Conversion failed after %u frames", (unsigned)frame);
+    }
+
+    bool success = path != NULL && status == 0;
+
+    free(path);
+    free(rgb);
+
+    return success;
+}
+
+static bool c8_convert_y4m(Chip8RecordReader *reader, const char *path, int scale)
+{
+    int status = c8_record_read_frame(reader);
+
+    if (status != 1) {
+        fprintf(stderr, "Recording contains no frames\n");
+        return false;
+    }
+
+    /* The display size is fixed by the first frame */
+    int width = reader->width * scale;
+    int height = reader->height * scale;
+    size_t plane_size = (size_t)width * height;
+    uint32_t *rgb = malloc(sizeof(uint32_t) * C8_DISPLAY_MAX_WIDTH * C8_DISPLAY_MAX_HEIGHT *
+                           scale * scale);
+    uint8_t *yuv = malloc(plane_size * 3);
+    FILE *file = fopen(path, "wb");
+
+    if (rgb == NULL || yuv == NULL || file == NULL) {
+        C8_LOG_ERROR("Unable to create %s - %s", path, strerror(errno));
+        free(rgb);
+        free(yuv);
+
+        if (file != NULL) {
+            fclose(file);
+        }
+
+        return false;
+    }
+
+    fprintf(file, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 C444\n", width, height, C8_TIMER_FREQ_HZ);
+
+    while (status == 1) {
+        uint32_t tick = reader->tick;
+
+        c8_render_frame(reader, scale, rgb);
+
+        for (size_t k = 0; k < plane_size; k++) {
+            int r = (rgb[k] >> 16) & 0xFF;
+            int g = (rgb[k] >> 8) & 0xFF;
+            int b = rgb[k] & 0xFF;
+
+            yuv[k] = (uint8_t)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            yuv[plane_size + k] = (uint8_t)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            yuv[(2 * plane_size) + k] = (uint8_t)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+
+        status = c8_record_read_frame(reader);
+
+        /* Hold the frame on screen until the next one was presented */
+        uint32_t repeat = status == 1 && reader->tick > tick ? reader->tick - tick : 1;
+
+        for (uint32_t k = 0; k < repeat; k++) {
+            fputs("FRAME\n", file);
+            fwrite(yuv, 1, plane_size * 3, file);
+        }
+
+        if (status == 1 && (reader->width * scale != width || reader->height * scale != height)) {
+            C8_LOG_ERROR("y4m output doesn't support resolution changes at tick %u",
+                         (unsigned)reader->tick);
+            status = -1;
+        }
+    }
+
+    bool success = status == 0 && !ferror(file);
+
+    if (fclose(file) != 0 || !success) {
+        C8_LOG_ERROR("Error writing %s", path);
+        success = false;
+    }
+
+    free(rgb);
+    free(yuv);
+
+    return success;
+}
+
+static void c8_render_frame(const Chip8RecordReader *reader, int scale, uint32_t *rgb)
+{
+    int width = reader->width * scale;
+
+    for (int y = 0; y < reader->height * scale; y++) {
+        for (int x = 0; x < width; x++) {
+            rgb[(y * width) + x] = c8_palette[c8_record_pixel(reader, x / scale, y / scale)];
+        }
+    }
+}
+
+/* Writes an uncompressed 8 bit RGB PNG, the image data
+ * is stored in a zlib stream of stored deflate blocks */
+static bool c8_write_png(const char *path, const uint32_t *rgb, int width, int height)
+{
+    size_t row_length = 1 + ((size_t)width * 3);
+    size_t raw_length = row_length * height;
+    size_t blocks = (raw_length + C8_PNG_STORED_BLOCK_MAX - 1) / C8_PNG_STORED_BLOCK_MAX;
+    size_t zlib_length = 2 + (blocks * 5) + raw_length + 4;
+    uint8_t *raw = malloc(raw_length);
+    uint8_t *zlib = malloc(zlib_length);
+    FILE *file = fopen(path, "wb");
+
+    if (raw == NULL || zlib == NULL || file == NULL) {
+        C8_LOG_ERROR("Unable to create %s - %s", path, strerror(errno));
+        free(raw);
+        free(zlib);
+
+        if (file != NULL) {
+            fclose(file);
+        }
+
+        return false;
+    }
+
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = raw + (y * row_length);
+        *row++ = 0;
+
+        for (int x = 0; x < width; x++) {
+            uint32_t pixel = rgb[(y * width) + x];
+            *row++ = (uint8_t)(pixel >> 16);
+            *row++ = (uint8_t)(pixel >> 8);
+            *row++ = (uint8_t)pixel;
+        }
+    }
+
+    uint8_t *out = zlib;
+    uint32_t adler_a = 1, adler_b = 0;
+
+    *out++ = 0x78;
+    *out++ = 0x01;
+
+    for (size_t offset = 0; offset < raw_length; offset += C8_PNG_STORED_BLOCK_MAX) {
+        size_t length = MIN(raw_length - offset, C8_PNG_STORED_BLOCK_MAX);
+
+        *out++ = offset + length == raw_length ? 1 : 0;
+        *out++ = (uint8_t)length;
+        *out++ = (uint8_t)(length >> 8);
+        *out++ = (uint8_t)~length;
+        *out++ = (uint8_t)(~length >> 8);
+        memcpy(out, raw + offset, length);
+        out += length;
+    }
+
+    for (size_t k = 0; k < raw_length; k++) {
+        adler_a = (adler_a + raw[k]) % 65521;
+        adler_b = (adler_b + adler_a) % 65521;
+    }
+
+    c8_put_u32(out, (adler_b << 16) | adler_a);
+
+    static const uint8_t signature[] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    uint8_t ihdr[13] = { 0 };
+
+    c8_put_u32(ihdr, width);
+    c8_put_u32(ihdr + 4, height);
+    ihdr[8] = 8;
+    ihdr[9] = 2;
+
+    fwrite(signature, 1, sizeof(signature), file);
+    c8_png_chunk(file, "IHDR", ihdr, sizeof(ihdr));
+    c8_png_chunk(file, "IDAT", zlib, zlib_length);
+    c8_png_chunk(file, "IEND", NULL, 0);
+
+    bool success = !ferror(file);
+
+    if (fclose(file) != 0 || !success) {
+        C8_LOG_ERROR("Error writing %s", path);
+        success = false;
+    }
+
+    free(raw);
+    free(zlib);
+
+    return success;
+}
+
+static void c8_png_chunk(FILE *file, const char *type, const uint8_t *data, size_t length)
+{
+    uint8_t header[8];
+
+    c8_put_u32(header, (uint32_t)length);
+    memcpy(header + 4, type, 4);
+
+    uint32_t crc = c8_crc32(0xFFFFFFFF, header + 4, 4);
+
+    if (length > 0) {
+        crc = c8_crc32(crc, data, length);
+    }
+
+    uint8_t trailer[4];
+    c8_put_u32(trailer, crc ^ 0xFFFFFFFF);
+
+    fwrite(header, 1, sizeof(header), file);
+
+    if (length > 0) {
+        fwrite(data, 1, length, file);
+    }
+
+    fwrite(trailer, 1, sizeof(trailer), file);
+}
+
+static uint32_t c8_crc32(uint32_t crc, const uint8_t *data, size_t length)
+{
+    for (size_t k = 0; k < length; k++) {
+        crc ^= data[k];
+
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+
+    return crc;
+}
+
+static void c8_put_u32(uint8_t *buffer, uint32_t value)
+{
+    buffer[0] = (uint8_t)(value >> 24);
+    buffer[1] = (uint8_t)(value >> 16);
+    buffer[2] = (uint8_t)(value >> 8);
+    buffer[3] = (uint8_t)value;
+}
@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* Searches for the inputs which take a ROM from its start, or from a few
+ * warm up frames in, to a state meeting an objective. The key bitmask for
+ * each step is printed one per line in hex, followed by the display hash
+ * of the state reached. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <getopt.h>
+#include <unistd.h>
+#include "chip8.h"
+#include "chip8_search.h"
+
+static bool c8_search_parse_args(Chip8SearchConfig *config, int argc, char *argv[],
+                                 const char **rom_file_path, Chip8Profile *profile,
+                                 uint64_t *seed, int *warmup);
+static bool c8_search_parse_number(const char *string, uint64_t max, uint64_t *value);
+static void c8_search_print_usage(void);
+
+int main(int argc, char *argv[])
+{
+    Chip8SearchConfig config;
+    const char *rom_file_path = NULL;
+    Chip8Profile profile = C8_PROFILE_DEFAULT;
+    uint64_t seed = 0;
+    int warmup = 0;
+
+    c8_search_default_config(&config);
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    config.num_threads = cores > 0 ? cores : 1;
+
+    if (!c8_search_parse_args(&config, argc, argv, &rom_file_path, &profile, &seed, &warmup)) {
+        c8_search_print_usage();
+        return 1;
+    }
+
+    Chip8 *chip8 = c8_alloc_aligned(sizeof(Chip8));
+
+    if (chip8 == NULL) {
+        C8_LOG_ERROR("Unable to allocate %zu bytes for interpreter", sizeof(Chip8));
+        return 1;
+    }
+
+    c8_init(chip8);
+    c8_seed(chip8, seed);
+    c8_set_profile(chip8, profile);
+
+    if (!c8_load_rom_file(chip8, rom_file_path)) {
+        free(chip8);
+        return 1;
+    }
+
+    for (int frame = 0; frame < warmup; frame++) {
+        for (int k = 0; k < config.instr_per_frame && c8_run_cycle(chip8) != 0; k++);
+        c8_update_timers(chip8);
+    }
+
+    Chip8SearchResult result;
+
+    if (!c8_search(chip8, &config, &result)) {
+        free(chip8);
+        return 1;
+    }
+
+    fprintf(stderr, "%" PRIu64 " states expanded, %" PRIu64 " duplicates%s\n",
+            result.expanded, result.duplicates,
+            result.state_limit ? ", stopped at state limit" : "");
+
+    if (!result.found) {
+        fprintf(stderr, "No solution found\n");
+        c8_search_result_free(&result);
+        free(chip8);
+        return 2;
+    }
+
+    /* Replay the solution to report the display it ends with */
+    for (int step = 0; step < result.depth; step++) {
+        printf("%04" PRIX16 "\n", result.inputs[step]);
+
+        for (uint8_t key = 0; key < C8_KEY_NUM; key++) {
+            bool pressed = (result.inputs[step] >> key) & 0x1;
+
+            if (pressed != chip8->input_keys[key]) {
+                c8_key_event(chip8, key, pressed);
+            }
+        }
+
+        for (int frame = 0; frame < config.frames_per_input; frame++) {
+            for (int k = 0; k < config.instr_per_frame && c8_run_cycle(chip8) != 0; k++);
+            c8_update_timers(chip8);
+        }
+    }
+
+    printf("display 0x%016" PRIx64 "\n", c8_display_hash(chip8));
+
+    c8_search_result_free(&result);
+    free(chip8);
+
+    return 0;
+}
+
+static bool c8_search_parse_args(Chip8SearchConfig *config, int argc, char *argv[],
+                                 const char **rom_file_path, Chip8Profile *profile,
+                                 uint64_t *seed, int *warmup)
+{
+    struct option search_options[] = {
+        { "beam"         , required_argument, 0, 'b' },
+        { "depth"        , required_argument, 0, 'd' },
+        { "frames"       , required_argument, 0, 'f' },
+        { "goal-address" , required_argument, 0, 'a' },
+        { "goal-display" , required_argument, 0, 'H' },
+        { "help"         , no_argument      , 0, 'h' },
+        { "instr"        , required_argument, 0, 'i' },
+        { "max-states"   , required_argument, 0, 'n' },
+        { "profile"      , required_argument, 0, 'p' },
+        { "score-address", required_argument, 0, 's' },
+        { "seed"         , required_argument, 0, 'S' },
+        { "threads"      , required_argument, 0, 't' },
+        { "warmup"       , required_argument, 0, 'w' },
+        { 0, 0, 0, 0 }
+    };
+
+    int ch;
+    uint64_t value;
+
+    while ((ch = getopt_long(argc, argv, "a:b:d:f:H:hi:n:p:s:S:t:w:", search_options, NULL)) != -1) {
+        switch (ch) {
+            case 'a': {
+                char *separator = strchr(optarg, '=');
+                uint64_t goal_value;
+
+                if (separator == NULL) {
+                    fprintf(stderr, "goal-address must be of the form ADDRESS=VALUE\n");
+                    return false;
+                }
+
+                *separator = '\0';
+
+                if (!c8_search_parse_number(optarg, C8_MEMORY_SIZE - 1, &value) ||
+                    !c8_search_parse_number(separator + 1, UINT8_MAX, &goal_value)) {
+                    fprintf(stderr, "Invalid value passed for goal-address\n");
+                    return false;
+                }
+
+                config->goal_address = value;
+                config->goal_value = goal_value;
+                break;
+            }
+            case 'b': {
+                if (!c8_search_parse_number(optarg, INT32_MAX, &value) || value == 0) {
+                    fprintf(stderr, "Invalid value passed for beam: %s\n", optarg);
+                    return false;
+                }
+
+                config->strategy = C8_SEARCH_BEAM;
+                config->beam_width = value;
+                break;
+            }
+            case 'd': {
+                if (!c8_search_parse_number(optarg, 0xFFFE, &value)) {
+                    fprintf(stderr, "Invalid value passed for depth: %s\n", optarg);
+                    return false;
+                }
+
+                config->max_depth = value;
+                break;
+            }
+            case 'f': {
+                if (!c8_search_parse_number(optarg, INT32_MAX, &value) || value == 0) {
+                    fprintf(stderr, "Invalid value passed for frames: %s\n", optarg);
+                    return false;
+                }
+
+                config->frames_per_input = value;
+                break;
+            }
+            case 'H': {
+                if (!c8_search_parse_number(optarg, UINT64_MAX, &value)) {
+                    fprintf(stderr, "Invalid value passed for goal-display: %s\n", optarg);
+                    return false;
+                }
+
+                config->goal_display = true;
+                config->goal_display_hash = value;
+                break;
+            }
+            case 'h': {
+                c8_search_print_usage();
+                exit(0);
+            }
+            case 'i': {
+                if (!c8_search_parse_number(optarg, INT32_MAX, &value) || value == 0) {
+                    fprintf(stderr, "Invalid value passed for instr: %s\n", optarg);
+                    return false;
+                }
+
+                config->instr_per_frame = value;
+                break;
+            }
+            case 'n': {
+                if (!c8_search_parse_number(optarg, SIZE_MAX / 2, &value) || value == 0) {
+                    fprintf(stderr, "Invalid value passed for max-states: %s\n", optarg);
+                    return false;
+                }
+
+                config->max_states = value;
+                break;
+            }
+            case 'p': {
+                if (!c8_parse_profile(optarg, profile)) {
+                    fprintf(stderr,
+                            "Invalid value passed for profile: %s, "
+                            "profile must be one of chip8, schip or xochip\n",
+                            optarg);
+                    return false;
+                }
+
+                break;
+            }
+            case 's': {
+                if (!c8_search_parse_number(optarg, C8_MEMORY_SIZE - 1, &value)) {
+                    fprintf(stderr, "Invalid value passed for score-address: %s\n", optarg);
+                    return false;
+                }
+
+                config->score_address = value;
+                break;
+            }
+            case 'S': {
+                if (!c8_search_parse_number(optarg, UINT64_MAX, seed)) {
+                    fprintf(stderr, "Invalid value passed for seed: %s\n", optarg);
+                    return false;
+                }
+
+                break;
+            }
+            case 't': {
+                if (!c8_search_parse_number(optarg, 1024, &value) || value == 0) {
+                    fprintf(stderr, "Invalid value passed for threads: %s\n", optarg);
+                    return false;
+                }
+
+                config->num_threads = value;
+                break;
+            }
+            case 'w': {
+                if (!c8_search_parse_number(optarg, INT32_MAX, &value)) {
+                    fprintf(stderr, "Invalid value passed for warmup: %s\n", optarg);
+                    return false;
+                }
+
+                *warmup = value;
+                break;
+            }
+            default: {
+                return false;
+            }
+        }
+    }
+
+    if (config->goal_address < 0 && !config->goal_display) {
+        fprintf(stderr, "One of goal-address or goal-display is required\n");
+        return false;
+    }
+
+    if (optind < argc) {
+        *rom_file_path = argv[optind];
+    } else {
+        fprintf(stderr, "No ROM file path provided\n");
+        return false;
+    }
+
+    return true;
+}
+
+/* Accepts decimal, or hex with a 0x prefix */
+static bool c8_search_parse_number(const char *string, uint64_t max, uint64_t *value)
+{
+    char *end_ptr;
+
+    if (*string == '\0' || *string == '-') {
+        return false;
+    }
+
+    errno = 0;
+    unsigned long long parsed = strtoull(string, &end_ptr, 0);
+
+    if (errno != 0 || *end_ptr != '\0' || parsed > max) {
+        return false;
+    }
+
+    *value = parsed;
+
+    return true;
+}
+
+static void c8_search_print_usage(void)
+{
+    const char *help_msg =
+"\n\
+Usage:\n\
+chip8-search [OPTIONS] ROMFILE\n\
+\n\
+OPTIONS:\n\
+-a, --goal-address=ADDR=VALUE  Stop once the byte at ADDR equals VALUE.\n\
+-b, --beam=WIDTH               Keep only the WIDTH best states at each\n\
+                               depth rather than searching breadth first.\n\
+-d, --depth=DEPTH              Try at most DEPTH inputs. Default: 32.\n\
+-f, --frames=FRAMES            Hold each input for FRAMES frames. Default: 4.\n\
+-H, --goal-display=HASH        Stop once the display hash equals HASH.\n\
+-h, --help                     Print this message.\n\
+-i, --instr=COUNT              Run COUNT instructions a frame. Default: 10.\n\
+-n, --max-states=COUNT         Stop after seeing COUNT distinct states.\n\
+-p, --profile=PROFILE          Emulate the quirks of PROFILE. Default: schip.\n\
+-s, --score-address=ADDR       Beam search keeps states with the highest\n\
+                               byte at ADDR.\n\
+-S, --seed=SEED                Seed for the random number generator.\n\
+                               Default: 0.\n\
+-t, --threads=COUNT            Search with COUNT threads. Default: one a core.\n\
+-w, --warmup=FRAMES            Run FRAMES frames without input first.\n\
+\n\
+";
+
+    printf("%s", help_msg);
+}
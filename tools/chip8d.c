@@ -0,0 +1,1213 @@
+/*
+ * Copyright (C) 2015 Richard Burke
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/* Runs headless ROM jobs sent over a Unix domain socket, so that programs
+ * submitting many short jobs don't pay for starting an interpreter each
+ * time. Each worker thread keeps an instance which is reconfigured and
+ * reloaded for every job it takes from a queue shared by all clients.
+ * Requests are line based, in the style of a conformance manifest:
+ *
+ *   # comment
+ *   job (rom=PATH | hash=KEY) cycles=CYCLES [id=ID] [profile=PROFILE]
+ *       [ipf=INSTRUCTIONS] [seed=SEED] [outputs=OUTPUT,...]
+ *   keys CYCLE MASK
+ *   check CYCLE
+ *   run
+ *   stats
+ *
+ * A job is given on one line and is followed by any keys and check lines
+ * for it, then run queues it. KEY is a ROM name or the start of its hash
+ * in the library given with --library, whose settings are used for any
+ * left out of the job. PATH is only allowed when the library is a
+ * directory, and must lead to a file within it, relative paths being
+ * taken from the directory. CYCLES is at most --max-cycles. keys holds
+ * the keys in MASK from the first frame starting at or after CYCLE.
+ * OUTPUT is any of display, registers, memory, frames, sounds and errors,
+ * display and registers being the default. Replies are a line each,
+ * tagged with the job's ID, which is a count of the jobs sent on the
+ * connection unless given:
+ *
+ *   check ID CYCLE DISPLAY_HASH REGISTER_HASH
+ *   result ID cycles=CYCLES [OUTPUT=VALUE ...]
+ *   error ID MESSAGE
+ *   stats workers=COUNT jobs=COUNT queued=COUNT
+ *
+ * Jobs on one connection may finish in any order, though the lines of
+ * one job's reply are always written together. */
+
+#define _XOPEN_SOURCE 700
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <getopt.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "chip8.h"
+#include "chip8_instance.h"
+#include "chip8_library.h"
+
+#define C8_DAEMON_LINE_MAX 4096
+#define C8_DAEMON_ID_MAX 64
+#define C8_DAEMON_ERROR_MAX 128
+#define C8_DAEMON_THREADS_MAX 256
+/* Clients block once this many jobs are waiting for a worker */
+#define C8_DAEMON_QUEUE_MAX 4096
+#define C8_DAEMON_CACHE_DIR_MAX 4096
+/* No job may hold a worker for longer than this many instructions */
+#define C8_DAEMON_MAX_CYCLES_DEFAULT 1000000000
+
+#define C8_DAEMON_OUTPUT_DISPLAY   0x01
+#define C8_DAEMON_OUTPUT_REGISTERS 0x02
+#define C8_DAEMON_OUTPUT_MEMORY    0x04
+#define C8_DAEMON_OUTPUT_FRAMES    0x08
+#define C8_DAEMON_OUTPUT_SOUNDS    0x10
+#define C8_DAEMON_OUTPUT_ERRORS    0x20
+#define C8_DAEMON_OUTPUT_DEFAULT   (C8_DAEMON_OUTPUT_DISPLAY | C8_DAEMON_OUTPUT_REGISTERS)
+
+static const struct {
+    uint32_t output;
+    const char *name;
+} c8_daemon_outputs[] = {
+    { C8_DAEMON_OUTPUT_DISPLAY  , "display"   },
+    { C8_DAEMON_OUTPUT_REGISTERS, "registers" },
+    { C8_DAEMON_OUTPUT_MEMORY   , "memory"    },
+    { C8_DAEMON_OUTPUT_FRAMES   , "frames"    },
+    { C8_DAEMON_OUTPUT_SOUNDS   , "sounds"    },
+    { C8_DAEMON_OUTPUT_ERRORS   , "errors"    }
+};
+
+#define C8_DAEMON_NUM_OUTPUTS (sizeof(c8_daemon_outputs) / sizeof(c8_daemon_outputs[0]))
+
+/* A connection, freed once its reader and all of its jobs are done */
+typedef struct {
+    int fd;
+    /* Serialises replies and guards references */
+    pthread_mutex_t lock;
+    int references;
+} Chip8DaemonClient;
+
+typedef struct {
+    uint64_t cycle;
+    uint16_t keys;
+} Chip8DaemonInput;
+
+typedef struct Chip8DaemonJob {
+    struct Chip8DaemonJob *next;
+    Chip8DaemonClient *client;
+    char id[C8_DAEMON_ID_MAX];
+    Chip8InstanceConfig config;
+    /* Points into the library, or NULL when the worker is to read the
+     * ROM from rom_path */
+    const uint8_t *rom;
+    size_t rom_size;
+    char *rom_path;
+    /* The fused sequence starting at each byte of a library ROM, from its
+     * cached analysis, or NULL when not fusing or not known */
+    const uint8_t *fusion;
+    uint64_t cycles;
+    uint32_t outputs;
+    Chip8DaemonInput *inputs;
+    int num_inputs;
+    uint64_t *checks;
+    int num_checks;
+    /* The first problem found with the request, reported by run */
+    char error[C8_DAEMON_ERROR_MAX];
+} Chip8DaemonJob;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t job_ready;
+    pthread_cond_t space_ready;
+    Chip8DaemonJob *head;
+    Chip8DaemonJob *tail;
+    int num_queued;
+    uint64_t jobs_run;
+    int num_workers;
+    /* NULL when no library was given */
+    const Chip8Library *library;
+    /* The analysis of each ROM in the library, in the same order,
+     * NULL unless fusing */
+    const Chip8RomAnalysis *analyses;
+    /* The canonical path of the library when it is a directory, which
+     * ROMs given by path must be in, otherwise NULL */
+    const char *rom_dir;
+    uint64_t max_cycles;
+    bool fuse;
+} Chip8Daemon;
+
+typedef struct {
+    Chip8Daemon *daemon;
+    Chip8Instance *instance;
+    /* Converting each frame to pixels costs more than running it, so
+     * only jobs which count frames use an instance which is told of them */
+    Chip8Instance *frame_instance;
+    /* ROMs given by path are read into this, one byte larger than the
+     * largest ROM so one which is too large can be told apart */
+    uint8_t *rom_buffer;
+    pthread_t thread;
+    /* State of the job being run, updated by the instance's callbacks */
+    uint16_t keys;
+    uint64_t frames;
+    uint64_t sounds;
+    uint64_t errors;
+} Chip8DaemonWorker;
+
+typedef struct {
+    Chip8Daemon *daemon;
+    Chip8DaemonClient *client;
+    /* The job being read, NULL between jobs */
+    Chip8DaemonJob *job;
+    uint64_t num_jobs;
+} Chip8DaemonReader;
+
+static volatile sig_atomic_t c8_daemon_quit = 0;
+
+static void c8_daemon_handle_signal(int signal_number);
+static int c8_daemon_listen(const char *path);
+static bool c8_daemon_start_reader(Chip8Daemon *daemon, int fd);
+static void *c8_daemon_read_client(void *arg);
+static void c8_daemon_parse_line(Chip8DaemonReader *reader, char *line);
+static Chip8DaemonJob *c8_daemon_parse_job(Chip8DaemonReader *reader, char *save_ptr);
+static void c8_daemon_job_error(Chip8DaemonJob *job, const char *format, ...);
+static bool c8_daemon_read_rom(Chip8DaemonWorker *worker, const Chip8DaemonJob *job, FILE *out,
+                               size_t *rom_size);
+static bool c8_daemon_parse_u64(const char *string, uint64_t *value);
+static void *c8_daemon_grow(void *array, int count, size_t size);
+static void c8_daemon_free_job(Chip8DaemonJob *job);
+static void c8_daemon_submit(Chip8Daemon *daemon, Chip8DaemonJob *job);
+static void *c8_daemon_worker(void *arg);
+static void c8_daemon_run(Chip8DaemonWorker *worker, const Chip8DaemonJob *job);
+static void c8_daemon_reply(Chip8DaemonClient *client, const char *format, ...);
+static void c8_daemon_write(Chip8DaemonClient *client, const char *data, size_t length);
+static void c8_daemon_release(Chip8DaemonClient *client);
+static void c8_daemon_frame(const uint32_t *pixels, int width, int height, void *user_data);
+static void c8_daemon_sound(bool on, void *user_data);
+static bool c8_daemon_key_held(uint8_t key, void *user_data);
+static void c8_daemon_error(const char *message, void *user_data);
+static void c8_daemon_print_usage(void);
+
+int main(int argc, char *argv[])
+{
+    struct option daemon_options[] = {
+        { "cache-dir" , required_argument, 0, 'c' },
+        { "fuse"      , no_argument      , 0, 'f' },
+        { "help"      , no_argument      , 0, 'h' },
+        { "jobs"      , required_argument, 0, 'j' },
+        { "library"   , required_argument, 0, 'L' },
+        { "max-cycles", required_argument, 0, 'm' },
+        { 0, 0, 0, 0 }
+    };
+
+    char default_cache_dir[C8_DAEMON_CACHE_DIR_MAX];
+    const char *cache_dir = NULL;
+    const char *library_path = NULL;
+    uint64_t max_cycles = C8_DAEMON_MAX_CYCLES_DEFAULT;
+    bool fuse = false;
+    long cores = sysconf(_SC_NPROCESSORS_ONLN);
+    int num_workers = cores > 0 ? cores : 1;
+    int ch;
+
+    if (c8_library_default_cache_dir(default_cache_dir, sizeof(default_cache_dir))) {
+        cache_dir = default_cache_dir;
+    }
+
+    while ((ch = getopt_long(argc, argv, "c:fhj:L:m:", daemon_options, NULL)) != -1) {
+        switch (ch) {
+            case 'c': {
+                cache_dir = optarg;
+                break;
+            }
+            case 'f': {
+                fuse = true;
+                break;
+            }
+            case 'h': {
+                c8_daemon_print_usage();
+                return 0;
+            }
+            case 'j': {
+                num_workers = atoi(optarg);
+
+                if (num_workers < 1 || num_workers > C8_DAEMON_THREADS_MAX) {
+                    fprintf(stderr, "Invalid value passed for jobs: %s\n", optarg);
+                    return 1;
+                }
+
+                break;
+            }
+            case 'L': {
+                library_path = optarg;
+                break;
+            }
+            case 'm': {
+                if (!c8_daemon_parse_u64(optarg, &max_cycles) || max_cycles == 0) {
+                    fprintf(stderr, "Invalid value passed for max-cycles: %s\n", optarg);
+                    return 1;
+                }
+
+                break;
+            }
+            default: {
+                c8_daemon_print_usage();
+                return 1;
+            }
+        }
+    }
+
+    if (optind >= argc) {
+        fprintf(stderr, "No socket path provided\n");
+        c8_daemon_print_usage();
+        return 1;
+    }
+
+    const char *socket_path = argv[optind];
+    Chip8Library library;
+
+    Chip8RomAnalysis *analyses = NULL;
+    char *rom_dir = NULL;
+
+    if (library_path != NULL) {
+        if (!c8_library_open(&library, library_path, cache_dir)) {
+            return 1;
+        }
+
+        /* Worked out once, or read from the cache, so every job starts
+         * with the ROM's fused sequences already known. A ROM which can't
+         * be analysed has them found as it runs instead. */
+        if (fuse) {
+            if ((analyses = calloc(MAX(library.num_roms, 1), sizeof(Chip8RomAnalysis))) == NULL) {
+                C8_LOG_ERROR("%s", "Unable to allocate ROM analysis");
+                return 1;
+            }
+
+            for (size_t k = 0; k < library.num_roms; k++) {
+                c8_library_analyse(&library, &library.roms[k], &analyses[k]);
+            }
+        }
+
+        struct stat library_stat;
+
+        if (stat(library_path, &library_stat) == 0 && S_ISDIR(library_stat.st_mode) &&
+            (rom_dir = realpath(library_path, NULL)) == NULL) {
+            fprintf(stderr, "Unable to resolve %s - %s\n", library_path, strerror(errno));
+            return 1;
+        }
+    }
+
+    Chip8Daemon daemon = {
+        .head = NULL,
+        .tail = NULL,
+        .num_queued = 0,
+        .jobs_run = 0,
+        .num_workers = 0,
+        .library = library_path != NULL ? &library : NULL,
+        .analyses = analyses,
+        .rom_dir = rom_dir,
+        .max_cycles = max_cycles,
+        .fuse = fuse
+    };
+
+    pthread_mutex_init(&daemon.lock, NULL);
+    pthread_cond_init(&daemon.job_ready, NULL);
+    pthread_cond_init(&daemon.space_ready, NULL);
+
+    /* Signals are only taken while the main thread waits for a connection,
+     * every other thread inheriting the blocked mask */
+    sigset_t blocked, unblocked;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &blocked, &unblocked);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = c8_daemon_handle_signal;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+
+    Chip8DaemonWorker *workers = calloc(num_workers, sizeof(Chip8DaemonWorker));
+
+    if (workers == NULL) {
+        C8_LOG_ERROR("%s", "Unable to allocate workers");
+        return 1;
+    }
+
+    /* Instances are created up front so that no job waits on allocation */
+    for (int k = 0; k < num_workers; k++) {
+        Chip8DaemonWorker *worker = &workers[k];
+        Chip8Host host = {
+            .sound = c8_daemon_sound,
+            .key_held = c8_daemon_key_held,
+            .error = c8_daemon_error,
+            .user_data = worker
+        };
+        Chip8InstanceConfig config;
+
+        c8_instance_default_config(&config);
+        config.fuse = fuse;
+        worker->daemon = &daemon;
+
+        if ((worker->instance = c8_instance_create(&host, &config)) == NULL) {
+            return 1;
+        }
+
+        host.frame = c8_daemon_frame;
+
+        if ((worker->frame_instance = c8_instance_create(&host, &config)) == NULL) {
+            return 1;
+        }
+
+        if ((worker->rom_buffer = malloc(C8_PROGRAM_MEMORY_SIZE + 1)) == NULL) {
+            C8_LOG_ERROR("%s", "Unable to allocate ROM buffer");
+            return 1;
+        }
+
+        if (pthread_create(&worker->thread, NULL, c8_daemon_worker, worker) != 0) {
+            fprintf(stderr, "Unable to start worker thread\n");
+            return 1;
+        }
+
+        daemon.num_workers++;
+    }
+
+    int listen_fd = c8_daemon_listen(socket_path);
+
+    if (listen_fd == -1) {
+        return 1;
+    }
+
+    fprintf(stderr, "Listening on %s with %d workers\n", socket_path, num_workers);
+
+    struct timespec begin, end;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+
+    while (!c8_daemon_quit) {
+        fd_set ready;
+        FD_ZERO(&ready);
+        FD_SET(listen_fd, &ready);
+
+        if (pselect(listen_fd + 1, &ready, NULL, NULL, NULL, &unblocked) == -1) {
+            if (errno != EINTR) {
+                fprintf(stderr, "Unable to wait for connections - %s\n", strerror(errno));
+                break;
+            }
+
+            continue;
+        }
+
+        int fd = accept(listen_fd, NULL, NULL);
+
+        if (fd == -1) {
+            if (errno != EINTR && errno != ECONNABORTED) {
+                fprintf(stderr, "Unable to accept connection - %s\n", strerror(errno));
+            }
+
+            continue;
+        }
+
+        if (!c8_daemon_start_reader(&daemon, fd)) {
+            close(fd);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    close(listen_fd);
+    unlink(socket_path);
+
+    pthread_mutex_lock(&daemon.lock);
+    fprintf(stderr, "%" PRIu64 " jobs in %.3f seconds\n", daemon.jobs_run,
+            (end.tv_sec - begin.tv_sec) + (end.tv_nsec - begin.tv_nsec) / 1e9);
+    pthread_mutex_unlock(&daemon.lock);
+
+    /* Workers and clients are left to the exit, as a worker may be part way
+     * through a job and a client may never close its connection */
+    return 0;
+}
+
+static void c8_daemon_handle_signal(int signal_number)
+{
+    (void)signal_number;
+
+    c8_daemon_quit = 1;
+}
+
+/* A socket left behind by a daemon which is no longer running is replaced,
+ * but not one which is still accepting connections */
+static int c8_daemon_listen(const char *path)
+{
+    struct sockaddr_un address;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long\n", path);
+        return -1;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd == -1) {
+        fprintf(stderr, "Unable to create socket - %s\n", strerror(errno));
+        return -1;
+    }
+
+    struct stat path_stat;
+
+    if (stat(path, &path_stat) == 0 && S_ISSOCK(path_stat.st_mode)) {
+        if (connect(fd, (struct sockaddr *)&address, sizeof(address)) == 0) {
+            fprintf(stderr, "A daemon is already listening on %s\n", path);
+            close(fd);
+            return -1;
+        }
+
+        unlink(path);
+    }
+
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+        listen(fd, SOMAXCONN) == -1) {
+        fprintf(stderr, "Unable to listen on %s - %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static bool c8_daemon_start_reader(Chip8Daemon *daemon, int fd)
+{
+    Chip8DaemonClient *client = malloc(sizeof(Chip8DaemonClient));
+    Chip8DaemonReader *reader = malloc(sizeof(Chip8DaemonReader));
+
+    if (client == NULL || reader == NULL) {
+        C8_LOG_ERROR("%s", "Unable to allocate client");
+        free(client);
+        free(reader);
+        return false;
+    }
+
+    client->fd = fd;
+    client->references = 1;
+    pthread_mutex_init(&client->lock, NULL);
+    *reader = (Chip8DaemonReader) { daemon, client, NULL, 0 };
+
+    pthread_attr_t attributes;
+    pthread_t thread;
+
+    pthread_attr_init(&attributes);
+    pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    int status = pthread_create(&thread, &attributes, c8_daemon_read_client, reader);
+    pthread_attr_destroy(&attributes);
+
+    if (status != 0) {
+        fprintf(stderr, "Unable to start client thread\n");
+        pthread_mutex_destroy(&client->lock);
+        free(client);
+        free(reader);
+        return false;
+    }
+
+    return true;
+}
+
+static void *c8_daemon_read_client(void *arg)
+{
+    Chip8DaemonReader *reader = arg;
+    int fd = dup(reader->client->fd);
+    FILE *input = fd != -1 ? fdopen(fd, "r") : NULL;
+
+    if (input == NULL) {
+        fprintf(stderr, "Unable to read from client - %s\n", strerror(errno));
+
+        if (fd != -1) {
+            close(fd);
+        }
+    } else {
+        char buffer[C8_DAEMON_LINE_MAX];
+
+        while (fgets(buffer, sizeof(buffer), input) != NULL) {
+            if (strchr(buffer, '\n') == NULL && !feof(input)) {
+                int ch;
+
+                while ((ch = fgetc(input)) != EOF && ch != '\n') {
+                }
+
+                c8_daemon_reply(reader->client, "error - line longer than %d bytes\n",
+                                C8_DAEMON_LINE_MAX - 2);
+                continue;
+            }
+
+            c8_daemon_parse_line(reader, buffer);
+        }
+
+        fclose(input);
+    }
+
+    /* A job without its run line is dropped */
+    c8_daemon_free_job(reader->job);
+    c8_daemon_release(reader->client);
+    free(reader);
+
+    return NULL;
+}
+
+static void c8_daemon_parse_line(Chip8DaemonReader *reader, char *line)
+{
+    const char *whitespace = " \t\r\n";
+    char *save_ptr;
+    char *command = strtok_r(line, whitespace, &save_ptr);
+    Chip8DaemonJob *job = reader->job;
+
+    if (command == NULL || command[0] == '#') {
+        return;
+    }
+
+    if (strcmp(command, "job") == 0) {
+        if (job != NULL) {
+            c8_daemon_reply(reader->client, "error %s job has no run line\n", job->id);
+            c8_daemon_free_job(job);
+        }
+
+        reader->job = c8_daemon_parse_job(reader, save_ptr);
+        return;
+    }
+
+    if (strcmp(command, "stats") == 0) {
+        Chip8Daemon *daemon = reader->daemon;
+
+        pthread_mutex_lock(&daemon->lock);
+        uint64_t jobs_run = daemon->jobs_run;
+        int num_queued = daemon->num_queued;
+        pthread_mutex_unlock(&daemon->lock);
+
+        c8_daemon_reply(reader->client, "stats workers=%d jobs=%" PRIu64 " queued=%d\n",
+                        daemon->num_workers, jobs_run, num_queued);
+        return;
+    }
+
+    if (job == NULL) {
+        c8_daemon_reply(reader->client, "error - %s must follow a job line\n", command);
+        return;
+    }
+
+    if (strcmp(command, "run") == 0) {
+        reader->job = NULL;
+
+        if (job->error[0] != '\0') {
+            c8_daemon_reply(reader->client, "error %s %s\n", job->id, job->error);
+            c8_daemon_free_job(job);
+        } else {
+            c8_daemon_submit(reader->daemon, job);
+        }
+
+        return;
+    }
+
+    if (job->error[0] != '\0') {
+        return;
+    }
+
+    uint64_t cycle;
+    char *cycle_string = strtok_r(NULL, whitespace, &save_ptr);
+
+    if (strcmp(command, "keys") != 0 && strcmp(command, "check") != 0) {
+        c8_daemon_job_error(job, "unknown command %s", command);
+        return;
+    } else if (cycle_string == NULL || !c8_daemon_parse_u64(cycle_string, &cycle)) {
+        c8_daemon_job_error(job, "%s requires a cycle", command);
+        return;
+    } else if (cycle > job->cycles) {
+        c8_daemon_job_error(job, "%s at cycle %" PRIu64 " is after the end of the job",
+                            command, cycle);
+        return;
+    }
+
+    if (strcmp(command, "keys") == 0) {
+        uint64_t keys;
+        char *keys_string = strtok_r(NULL, whitespace, &save_ptr);
+
+        if (keys_string == NULL || !c8_daemon_parse_u64(keys_string, &keys) || keys > UINT16_MAX) {
+            c8_daemon_job_error(job, "keys requires a 16 bit mask");
+            return;
+        }
+
+        if (job->num_inputs > 0 && job->inputs[job->num_inputs - 1].cycle > cycle) {
+            c8_daemon_job_error(job, "keys must be in cycle order");
+            return;
+        }
+
+        Chip8DaemonInput *inputs = c8_daemon_grow(job->inputs, job->num_inputs,
+                                                  sizeof(Chip8DaemonInput));
+
+        if (inputs == NULL) {
+            c8_daemon_job_error(job, "unable to allocate keys");
+            return;
+        }
+
+        job->inputs = inputs;
+        inputs[job->num_inputs].cycle = cycle;
+        inputs[job->num_inputs].keys = keys;
+        job->num_inputs++;
+    } else {
+        if (job->num_checks > 0 && job->checks[job->num_checks - 1] > cycle) {
+            c8_daemon_job_error(job, "checks must be in cycle order");
+            return;
+        }
+
+        uint64_t *checks = c8_daemon_grow(job->checks, job->num_checks, sizeof(uint64_t));
+
+        if (checks == NULL) {
+            c8_daemon_job_error(job, "unable to allocate checks");
+            return;
+        }
+
+        job->checks = checks;
+        checks[job->num_checks++] = cycle;
+    }
+}
+
+/* Always returns a job, unless out of memory, so that the lines which
+ * follow it are taken as part of it even when the job line is invalid */
+static Chip8DaemonJob *c8_daemon_parse_job(Chip8DaemonReader *reader, char *save_ptr)
+{
+    const char *whitespace = " \t\r\n";
+    Chip8DaemonJob *job = calloc(1, sizeof(Chip8DaemonJob));
+
+    if (job == NULL) {
+        C8_LOG_ERROR("%s", "Unable to allocate job");
+        c8_daemon_reply(reader->client, "error - unable to allocate job\n");
+        return NULL;
+    }
+
+    job->client = reader->client;
+    job->outputs = C8_DAEMON_OUTPUT_DEFAULT;
+    c8_instance_default_config(&job->config);
+    job->config.fuse = reader->daemon->fuse;
+    snprintf(job->id, sizeof(job->id), "%" PRIu64, ++reader->num_jobs);
+
+    const char *rom_path = NULL;
+    const char *rom_key = NULL;
+    bool has_cycles = false;
+    bool has_profile = false;
+    bool has_ipf = false;
+    char *option;
+
+    while ((option = strtok_r(NULL, whitespace, &save_ptr)) != NULL) {
+        uint64_t value;
+
+        if (strncmp(option, "id=", 3) == 0) {
+            if (option[3] == '\0' || strlen(option + 3) >= sizeof(job->id)) {
+                c8_daemon_job_error(job, "id must be 1 to %zu characters", sizeof(job->id) - 1);
+            } else {
+                strcpy(job->id, option + 3);
+            }
+        } else if (strncmp(option, "rom=", 4) == 0) {
+            rom_path = option + 4;
+        } else if (strncmp(option, "hash=", 5) == 0) {
+            rom_key = option + 5;
+        } else if (strncmp(option, "cycles=", 7) == 0 &&
+                   c8_daemon_parse_u64(option + 7, &job->cycles)) {
+            has_cycles = true;
+        } else if (strncmp(option, "profile=", 8) == 0 &&
+                   c8_parse_profile(option + 8, &job->config.profile)) {
+            has_profile = true;
+        } else if (strncmp(option, "ipf=", 4) == 0 &&
+                   c8_daemon_parse_u64(option + 4, &value) && value > 0 && value <= INT32_MAX) {
+            job->config.instr_per_frame = value;
+            has_ipf = true;
+        } else if (strncmp(option, "seed=", 5) == 0 &&
+                   c8_daemon_parse_u64(option + 5, &job->config.seed)) {
+            /* Parsed into job */
+        } else if (strncmp(option, "outputs=", 8) == 0) {
+            char *output_save_ptr;
+            char *name = strtok_r(option + 8, ",", &output_save_ptr);
+
+            job->outputs = 0;
+
+            for (; name != NULL; name = strtok_r(NULL, ",", &output_save_ptr)) {
+                size_t k = 0;
+
+                while (k < C8_DAEMON_NUM_OUTPUTS && strcmp(name, c8_daemon_outputs[k].name) != 0) {
+                    k++;
+                }
+
+                if (k == C8_DAEMON_NUM_OUTPUTS) {
+                    c8_daemon_job_error(job, "unknown output %s", name);
+                } else {
+                    job->outputs |= c8_daemon_outputs[k].output;
+                }
+            }
+        } else {
+            c8_daemon_job_error(job, "invalid job option %s", option);
+        }
+    }
+
+    if (!has_cycles) {
+        c8_daemon_job_error(job, "job requires cycles");
+    } else if (job->cycles > reader->daemon->max_cycles) {
+        c8_daemon_job_error(job, "cycles is more than the limit of %" PRIu64,
+                            reader->daemon->max_cycles);
+    } else if ((rom_path == NULL) == (rom_key == NULL)) {
+        c8_daemon_job_error(job, "job requires one of rom or hash");
+    } else if (rom_path != NULL) {
+        if (reader->daemon->rom_dir == NULL) {
+            c8_daemon_job_error(job, "rom requires the daemon to be started with a library directory");
+        } else if ((job->rom_path = strdup(rom_path)) == NULL) {
+            c8_daemon_job_error(job, "unable to allocate ROM path");
+        }
+    } else if (reader->daemon->library == NULL) {
+        c8_daemon_job_error(job, "hash requires the daemon to be started with a library");
+    } else {
+        const Chip8LibraryRom *rom = c8_library_lookup_quiet(reader->daemon->library, rom_key);
+
+        if (rom == NULL) {
+            c8_daemon_job_error(job, "no single ROM in library matches %s", rom_key);
+        } else if (rom->size > C8_PROGRAM_MEMORY_SIZE) {
+            c8_daemon_job_error(job, "ROM %s is too large", rom_key);
+        } else {
+            job->rom = rom->data;
+            job->rom_size = rom->size;
+
+            if (reader->daemon->analyses != NULL) {
+                job->fusion = reader->daemon->analyses[rom - reader->daemon->library->roms].fusion;
+            }
+
+            if (!has_profile && rom->metadata.has_profile) {
+                job->config.profile = rom->metadata.profile;
+            }
+
+            if (!has_ipf && rom->metadata.instr_per_sec > 0) {
+                job->config.instr_per_frame = MAX(1, rom->metadata.instr_per_sec / C8_TIMER_FREQ_HZ);
+            }
+        }
+    }
+
+    return job;
+}
+
+/* Only the first error is kept, as later ones are often caused by it */
+static void c8_daemon_job_error(Chip8DaemonJob *job, const char *format, ...)
+{
+    if (job->error[0] != '\0') {
+        return;
+    }
+
+    va_list args;
+
+    va_start(args, format);
+    vsnprintf(job->error, sizeof(job->error), format, args);
+    va_end(args);
+}
+
+/* Reads the ROM at job->rom_path into the worker's buffer, writing an error
+ * line to out when it can't be read or isn't within the library directory.
+ * Symbolic links are followed before the path is checked. */
+static bool c8_daemon_read_rom(Chip8DaemonWorker *worker, const Chip8DaemonJob *job, FILE *out,
+                               size_t *rom_size)
+{
+    const char *rom_dir = worker->daemon->rom_dir;
+    const char *path = job->rom_path;
+    char joined[PATH_MAX];
+    char resolved[PATH_MAX];
+    struct stat path_stat;
+
+    if (path[0] != '/') {
+        if (snprintf(joined, sizeof(joined), "%s/%s", rom_dir, path) >= (int)sizeof(joined)) {
+            fprintf(out, "error %s ROM path %s is too long\n", job->id, path);
+            return false;
+        }
+
+        path = joined;
+    }
+
+    size_t rom_dir_length = strlen(rom_dir);
+
+    /* A missing file is reported as an outside one would be, so
+     * clients can't find out what exists outside the library */
+    if (realpath(path, resolved) == NULL ||
+        strncmp(resolved, rom_dir, rom_dir_length) != 0 || resolved[rom_dir_length] != '/') {
+        fprintf(out, "error %s no ROM %s in the library directory\n", job->id, job->rom_path);
+        return false;
+    } else if (stat(resolved, &path_stat) != 0 || !S_ISREG(path_stat.st_mode)) {
+        fprintf(out, "error %s ROM %s is not a file\n", job->id, job->rom_path);
+        return false;
+    }
+
+    FILE *file = fopen(resolved, "rb");
+
+    if (file == NULL) {
+        fprintf(out, "error %s unable to open %s - %s\n", job->id, job->rom_path, strerror(errno));
+        return false;
+    }
+
+    *rom_size = fread(worker->rom_buffer, 1, C8_PROGRAM_MEMORY_SIZE + 1, file);
+    bool success = !ferror(file);
+
+    if (!success) {
+        fprintf(out, "error %s unable to read %s\n", job->id, job->rom_path);
+    } else if (*rom_size > C8_PROGRAM_MEMORY_SIZE) {
+        fprintf(out, "error %s ROM %s is too large\n", job->id, job->rom_path);
+        success = false;
+    }
+
+    fclose(file);
+
+    return success;
+}
+
+/* Accepts decimal, or hex with a 0x prefix */
+static bool c8_daemon_parse_u64(const char *string, uint64_t *value)
+{
+    char *end_ptr;
+
+    if (*string == '\0' || *string == '-') {
+        return false;
+    }
+
+    errno = 0;
+    unsigned long long parsed = strtoull(string, &end_ptr, 0);
+
+    if (errno != 0 || *end_ptr != '\0') {
+        return false;
+    }
+
+    *value = parsed;
+
+    return true;
+}
+
+/* Makes room for one more element, returning NULL and leaving array
+ * untouched if that isn't possible */
+static void *c8_daemon_grow(void *array, int count, size_t size)
+{
+    return realloc(array, (count + 1) * size);
+}
+
+static void c8_daemon_free_job(Chip8DaemonJob *job)
+{
+    if (job == NULL) {
+        return;
+    }
+
+    free(job->rom_path);
+    free(job->inputs);
+    free(job->checks);
+    free(job);
+}
+
+/* Blocks while the queue is full, which in turn stops the client's reader */
+static void c8_daemon_submit(Chip8Daemon *daemon, Chip8DaemonJob *job)
+{
+    pthread_mutex_lock(&job->client->lock);
+    job->client->references++;
+    pthread_mutex_unlock(&job->client->lock);
+
+    pthread_mutex_lock(&daemon->lock);
+
+    while (daemon->num_queued >= C8_DAEMON_QUEUE_MAX) {
+        pthread_cond_wait(&daemon->space_ready, &daemon->lock);
+    }
+
+    job->next = NULL;
+
+    if (daemon->tail != NULL) {
+        daemon->tail->next = job;
+    } else {
+        daemon->head = job;
+    }
+
+    daemon->tail = job;
+    daemon->num_queued++;
+    pthread_cond_signal(&daemon->job_ready);
+    pthread_mutex_unlock(&daemon->lock);
+}
+
+static void *c8_daemon_worker(void *arg)
+{
+    Chip8DaemonWorker *worker = arg;
+    Chip8Daemon *daemon = worker->daemon;
+
+    while (true) {
+        pthread_mutex_lock(&daemon->lock);
+
+        while (daemon->head == NULL) {
+            pthread_cond_wait(&daemon->job_ready, &daemon->lock);
+        }
+
+        Chip8DaemonJob *job = daemon->head;
+        daemon->head = job->next;
+
+        if (daemon->head == NULL) {
+            daemon->tail = NULL;
+        }
+
+        daemon->num_queued--;
+        pthread_cond_signal(&daemon->space_ready);
+        pthread_mutex_unlock(&daemon->lock);
+
+        c8_daemon_run(worker, job);
+
+        pthread_mutex_lock(&daemon->lock);
+        daemon->jobs_run++;
+        pthread_mutex_unlock(&daemon->lock);
+
+        c8_daemon_release(job->client);
+        c8_daemon_free_job(job);
+    }
+
+    return NULL;
+}
+
+/* The job is run in pieces which end at each input and checkpoint. Keys
+ * are read by the instance at the start of each frame, so a change of keys
+ * part way through a frame takes effect from the next one. */
+static void c8_daemon_run(Chip8DaemonWorker *worker, const Chip8DaemonJob *job)
+{
+    char *reply = NULL;
+    size_t reply_size = 0;
+    FILE *out = open_memstream(&reply, &reply_size);
+
+    if (out == NULL) {
+        C8_LOG_ERROR("%s", "Unable to allocate reply");
+        c8_daemon_reply(job->client, "error %s unable to allocate reply\n", job->id);
+        return;
+    }
+
+    Chip8Instance *instance = job->outputs & C8_DAEMON_OUTPUT_FRAMES ? worker->frame_instance
+                                                                     : worker->instance;
+    const uint8_t *rom = job->rom_path != NULL ? worker->rom_buffer : job->rom;
+    size_t rom_size = job->rom_size;
+    worker->keys = 0;
+    worker->frames = 0;
+    worker->sounds = 0;
+    worker->errors = 0;
+
+    if (job->rom_path != NULL && !c8_daemon_read_rom(worker, job, out, &rom_size)) {
+        /* The reason has been written to out */
+    } else if (!c8_instance_configure(instance, &job->config) ||
+               !c8_instance_load(instance, rom, rom_size)) {
+        fprintf(out, "error %s unable to load ROM\n", job->id);
+    } else {
+        if (job->fusion != NULL) {
+            c8_instance_warm_fusion(instance, job->fusion, rom_size);
+        }
+
+        const Chip8 *chip8 = c8_instance_state(instance);
+        uint64_t run = 0;
+        int input = 0;
+        int check = 0;
+
+        while (true) {
+            while (input < job->num_inputs && job->inputs[input].cycle <= run) {
+                worker->keys = job->inputs[input++].keys;
+            }
+
+            while (check < job->num_checks && job->checks[check] <= run) {
+                fprintf(out, "check %s %" PRIu64 " 0x%016" PRIx64 " 0x%016" PRIx64 "\n",
+                        job->id, job->checks[check++], c8_display_hash(chip8),
+                        c8_register_hash(chip8));
+            }
+
+            if (run >= job->cycles) {
+                break;
+            }
+
+            uint64_t next_event = job->cycles;
+
+            if (input < job->num_inputs) {
+                next_event = MIN(next_event, job->inputs[input].cycle);
+            }
+
+            if (check < job->num_checks) {
+                next_event = MIN(next_event, job->checks[check]);
+            }
+
+            run += c8_instance_run(instance, next_event - run);
+        }
+
+        fprintf(out, "result %s cycles=%" PRIu64, job->id, run);
+
+        if (job->outputs & C8_DAEMON_OUTPUT_DISPLAY) {
+            fprintf(out, " display=0x%016" PRIx64, c8_display_hash(chip8));
+        }
+
+        if (job->outputs & C8_DAEMON_OUTPUT_REGISTERS) {
+            fprintf(out, " registers=0x%016" PRIx64, c8_register_hash(chip8));
+        }
+
+        if (job->outputs & C8_DAEMON_OUTPUT_MEMORY) {
+            fprintf(out, " memory=0x%016" PRIx64, c8_hash(chip8->memory, C8_MEMORY_SIZE, 0));
+        }
+
+        if (job->outputs & C8_DAEMON_OUTPUT_FRAMES) {
+            fprintf(out, " frames=%" PRIu64, worker->frames);
+        }
+
+        if (job->outputs & C8_DAEMON_OUTPUT_SOUNDS) {
+            fprintf(out, " sounds=%" PRIu64, worker->sounds);
+        }
+
+        if (job->outputs & C8_DAEMON_OUTPUT_ERRORS) {
+            fprintf(out, " errors=%" PRIu64, worker->errors);
+        }
+
+        fprintf(out, "\n");
+    }
+
+    if (fclose(out) != 0) {
+        C8_LOG_ERROR("%s", "Unable to allocate reply");
+        c8_daemon_reply(job->client, "error %s unable to allocate reply\n", job->id);
+    } else {
+        c8_daemon_write(job->client, reply, reply_size);
+    }
+
+    free(reply);
+}
+
+static void c8_daemon_reply(Chip8DaemonClient *client, const char *format, ...)
+{
+    char line[C8_DAEMON_LINE_MAX];
+    va_list args;
+
+    va_start(args, format);
+    int length = vsnprintf(line, sizeof(line), format, args);
+    va_end(args);
+
+    if (length >= (int)sizeof(line)) {
+        length = sizeof(line) - 1;
+        line[length - 1] = '\n';
+    }
+
+    if (length > 0) {
+        c8_daemon_write(client, line, length);
+    }
+}
+
+/* A client which has gone away is only noticed by its reader, so write
+ * errors are ignored */
+static void c8_daemon_write(Chip8DaemonClient *client, const char *data, size_t length)
+{
+    pthread_mutex_lock(&client->lock);
+
+    while (length > 0) {
+        ssize_t written = send(client->fd, data, length, MSG_NOSIGNAL);
+
+        if (written == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+
+            break;
+        }
+
+        data += written;
+        length -= written;
+    }
+
+    pthread_mutex_unlock(&client->lock);
+}
+
+static void c8_daemon_release(Chip8DaemonClient *client)
+{
+    pthread_mutex_lock(&client->lock);
+    int references = --client->references;
+    pthread_mutex_unlock(&client->lock);
+
+    if (references == 0) {
+        close(client->fd);
+        pthread_mutex_destroy(&client->lock);
+        free(client);
+    }
+}
+
+static void c8_daemon_frame(const uint32_t *pixels, int width, int height, void *user_data)
+{
+    Chip8DaemonWorker *worker = user_data;
+
+    (void)pixels;
+    (void)width;
+    (void)height;
+
+    worker->frames++;
+}
+
+static void c8_daemon_sound(bool on, void *user_data)
+{
+    Chip8DaemonWorker *worker = user_data;
+
+    if (on) {
+        worker->sounds++;
+    }
+}
+
+static bool c8_daemon_key_held(uint8_t key, void *user_data)
+{
+    Chip8DaemonWorker *worker = user_data;
+
+    return (worker->keys >> key) & 0x1;
+}
+
+static void c8_daemon_error(const char *message, void *user_data)
+{
+    Chip8DaemonWorker *worker = user_data;
+
+    (void)message;
+
+    worker->errors++;
+}
+
+static void c8_daemon_print_usage(void)
+{
+    const char *help_msg =
+"\n\
+Usage:\n\
+chip8d [OPTIONS] SOCKET\n\
+\n\
+Runs ROM jobs sent to the Unix domain socket SOCKET until interrupted.\n\
+\n\
+OPTIONS:\n\
+-c, --cache-dir=DIR      Cache the analysis of library ROMs in DIR,\n\
+                         which --fuse starts every job with.\n\
+                         Default: $XDG_CACHE_HOME/chip8 or ~/.cache/chip8.\n\
+-f, --fuse               Execute common instruction sequences together.\n\
+-h, --help               Print this message.\n\
+-j, --jobs=COUNT         Run COUNT jobs at once. Default: one a core.\n\
+-L, --library=LIBRARY    Allow ROMs to be given by name or hash from\n\
+                         LIBRARY, a directory of ROMs or an archive.\n\
+                         ROMs may be given by path when it is a\n\
+                         directory, as long as they are within it.\n\
+-m, --max-cycles=CYCLES  Refuse jobs of more than CYCLES instructions.\n\
+                         Default: 1000000000.\n\
+\n\
+";
+
+    printf("%s", help_msg);
+}